@@ -0,0 +1,117 @@
+#include "Arena.h"
+
+#define MIN_CHUNK_SIZE 4096
+#define ALIGNMENT (_Alignof(max_align_t))
+
+/**
+ * Allocate memory from an arena. The memory is suitably aligned for any type.
+ * @param arena The arena to allocate from.
+ * @param size The number of bytes needed.
+ * @return The allocated memory. The shell exits if no memory is available.
+ */
+void *arenaAlloc(Arena *arena, size_t size) {
+    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    
+    // Move on to the chunks kept from before the last reset, if the current one is full
+    while (arena->current && arena->current->used + size > arena->current->size && arena->current->next) {
+        arena->current = arena->current->next;
+        arena->current->used = 0;
+    }
+    
+    ArenaChunk *chunk = arena->current;
+    if (chunk == NULL || chunk->used + size > chunk->size) { // Every chunk is full, so add another
+        size_t chunkSize = chunk ? chunk->size * 2 : arena->firstChunkSize ? arena->firstChunkSize : MIN_CHUNK_SIZE;
+        while (chunkSize < size) {
+            chunkSize *= 2;
+        }
+        if ((chunk = malloc(sizeof(ArenaChunk) + chunkSize)) == NULL) {
+            perror("Unable to allocate memory.\n\r");
+            exit(EXIT_FAILURE);
+        }
+        chunk->next = NULL;
+        chunk->size = chunkSize;
+        chunk->used = 0;
+        if (arena->current) {
+            arena->current->next = chunk;
+        } else {
+            arena->first = chunk;
+        }
+        arena->current = chunk;
+    }
+    
+    void *memory = &chunk->data[chunk->used];
+    chunk->used += size;
+    return memory;
+}
+
+/**
+ * Copy a string into an arena.
+ * @param arena The arena to allocate from.
+ * @param string The characters to copy.
+ * @param length The number of characters to copy.
+ * @return A NUL-terminated copy of the string.
+ */
+char *arenaStrndup(Arena *arena, const char *string, size_t length) {
+    char *copy = arenaAlloc(arena, length + 1);
+    memcpy(copy, string, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+/**
+ * Release every allocation made from an arena at once, keeping its memory around for reuse.
+ * @param arena The arena to reset.
+ */
+void resetArena(Arena *arena) {
+    arena->current = arena->first;
+    if (arena->current) {
+        arena->current->used = 0;
+    }
+}
+
+/**
+ * @param arena An arena.
+ * @return The number of bytes the arena holds, whether or not they are in use.
+ */
+size_t arenaSize(Arena *arena) {
+    size_t size = 0;
+    ArenaChunk *chunk;
+    for (chunk = arena->first; chunk; chunk = chunk->next) {
+        size += sizeof(ArenaChunk) + chunk->size;
+    }
+    return size;
+}
+
+/**
+ * Return all of an arena's memory to the system.
+ * @param arena The arena to free.
+ */
+void freeArena(Arena *arena) {
+    while (arena->first) {
+        ArenaChunk *chunk = arena->first;
+        arena->first = chunk->next;
+        free(chunk);
+    }
+    arena->current = NULL;
+}
+
+/**
+ * Append a word to a growing list of words, doubling the list when it is full. The list is kept NULL-terminated.
+ * @param words The list.
+ * @param numWords The number of words in the list.
+ * @param capacity The number of words the list has room for.
+ * @param word The word to add.
+ * @param arena Where the list is allocated.
+ */
+void appendWord(char ***words, int *numWords, int *capacity, char *word, Arena *arena) {
+    if (*numWords + 1 >= *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 16;
+        char **grown = arenaAlloc(arena, *capacity * sizeof(char *));
+        if (*numWords) {
+            memcpy(grown, *words, *numWords * sizeof(char *));
+        }
+        *words = grown;
+    }
+    (*words)[(*numWords)++] = word;
+    (*words)[*numWords] = NULL;
+}
@@ -0,0 +1,73 @@
+#ifndef Arena_h
+#define Arena_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+/**
+ * A block of memory that allocations are carved out of. Its data starts as aligned as malloc() itself would align it.
+ */
+typedef struct arenaChunk {
+    struct arenaChunk *next;
+    size_t size, used;
+    _Alignas(max_align_t) char data[];
+} ArenaChunk;
+
+/**
+ * A region that many small allocations are made from and then released all at once,
+ * such as every token of a line. Allocations never move, so pointers into an arena
+ * stay valid until the arena is reset.
+ */
+typedef struct arena {
+    ArenaChunk *first, *current;
+    size_t firstChunkSize; // The size of the first chunk, if not the default, for arenas that only ever hold a little
+} Arena;
+
+/**
+ * Allocate memory from an arena. The memory is suitably aligned for any type.
+ * @param arena The arena to allocate from.
+ * @param size The number of bytes needed.
+ * @return The allocated memory. The shell exits if no memory is available.
+ */
+void *arenaAlloc(Arena *arena, size_t size);
+
+/**
+ * Copy a string into an arena.
+ * @param arena The arena to allocate from.
+ * @param string The characters to copy.
+ * @param length The number of characters to copy.
+ * @return A NUL-terminated copy of the string.
+ */
+char *arenaStrndup(Arena *arena, const char *string, size_t length);
+
+/**
+ * Release every allocation made from an arena at once, keeping its memory around for reuse.
+ * @param arena The arena to reset.
+ */
+void resetArena(Arena *arena);
+
+/**
+ * @param arena An arena.
+ * @return The number of bytes the arena holds, whether or not they are in use.
+ */
+size_t arenaSize(Arena *arena);
+
+/**
+ * Return all of an arena's memory to the system.
+ * @param arena The arena to free.
+ */
+void freeArena(Arena *arena);
+
+/**
+ * Append a word to a growing list of words, doubling the list when it is full. The list is kept NULL-terminated.
+ * @param words The list.
+ * @param numWords The number of words in the list.
+ * @param capacity The number of words the list has room for.
+ * @param word The word to add.
+ * @param arena Where the list is allocated.
+ */
+void appendWord(char ***words, int *numWords, int *capacity, char *word, Arena *arena);
+
+#endif /* Arena_h */
@@ -0,0 +1,516 @@
+#include "Execute.h"
+#include "Script.h"
+#include "ParseCache.h"
+#include "Pipes.h"
+#include "Transfer.h"
+#include "Zygote.h"
+#include "Events.h"
+#include "Variables.h"
+#include "Glob.h"
+#include <time.h>
+#include <sys/stat.h>
+
+// A mix of the kinds of lines scripts are made of, from plain commands to quoted pipelines.
+static const char *kSampleLines[] = {
+    "ls -l",
+    "sort < loremIpsum.txt > sortedLatin.txt",
+    "ls -l | sort | head -n 3",
+    "echo 'Hello World' > hello.txt",
+    "grep -v \"a quoted pattern\" access.log | sort | uniq -c | sort -n | tail -n 20",
+    "touch Test\\ File \"Test File2\" 'Test File3'",
+};
+
+// Statements that a script runs without starting any processes, so that the shell's own overhead is what's measured.
+static const char *kScriptStatements[] = {
+    "true",
+    "echo hello world > /dev/null",
+    "printf '%s=%d\\n' answer 42 > /dev/null",
+    "cd .",
+    "# a comment",
+    "false",
+};
+
+/**
+ * The outcome of a single benchmark.
+ */
+typedef struct benchResult {
+    const char *name, *unit;
+    double value, seconds;
+    long iterations;
+} BenchResult;
+
+#define MAX_RESULTS 32
+
+static BenchResult results[MAX_RESULTS];
+static int numResults = 0;
+
+/**
+ * @return The current time in seconds, from a monotonic clock.
+ */
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/**
+ * Record the outcome of a benchmark, and report it on standard error as it finishes.
+ * @param name What was measured.
+ * @param unit The unit of the value.
+ * @param value The measurement.
+ * @param iterations How many times the measured operation was repeated.
+ * @param seconds How long the whole benchmark took.
+ */
+static void record(const char *name, const char *unit, double value, long iterations, double seconds) {
+    if (numResults < MAX_RESULTS) {
+        results[numResults++] = (BenchResult){ name, unit, value, seconds, iterations };
+    }
+    fprintf(stderr, "%-28s %14.1f %-8s (%ld in %.3f s)\n", name, value, unit, iterations, seconds);
+}
+
+/**
+ * Measure how many lines per second parse() can tokenize.
+ * @param iterations How many lines to parse.
+ */
+static void benchParse(long iterations) {
+    int numSamples = sizeof(kSampleLines) / sizeof(kSampleLines[0]);
+    Arena arena = {0};
+    LineInput lineInput;
+    long bytes = 0;
+    
+    double start = now();
+    long i;
+    for (i = 0; i < iterations; i++) {
+        const char *line = kSampleLines[i % numSamples];
+        resetArena(&arena); // Just as the shell does between lines
+        initLineInput(&lineInput, &arena);
+        if (parse(line, &lineInput) != kParseSuccess) {
+            fprintf(stderr, "Unable to parse '%s'.\n", line);
+            exit(EXIT_FAILURE);
+        }
+        bytes += strlen(line);
+    }
+    double elapsed = now() - start;
+    
+    record("parse", "lines/s", iterations / elapsed, iterations, elapsed);
+    record("parse_bytes", "MB/s", bytes / elapsed / 1e6, iterations, elapsed);
+    freeArena(&arena);
+}
+
+/**
+ * Measure how long it takes to run a command that does nothing, through processSingleCommand().
+ * @param name What to call the measurement.
+ * @param mode The launcher to start the command with.
+ * @param iterations How many times to run the command.
+ */
+static void benchSpawn(const char *name, LaunchMode mode, long iterations) {
+    // Named by its path, so that the external command runs rather than the builtin
+    char *path = strdup(resolveCommand("true"));
+    char *cmd[] = { path, NULL };
+    LaunchMode previous = getLaunchMode();
+    setLaunchMode(mode);
+    
+    double start = now();
+    long i;
+    for (i = 0; i < iterations; i++) {
+        if (processSingleCommand(cmd) != EXIT_SUCCESS) {
+            fprintf(stderr, "'%s' failed.\n", path);
+            exit(EXIT_FAILURE);
+        }
+    }
+    double elapsed = now() - start;
+    
+    record(name, "us", elapsed / iterations * 1e6, iterations, elapsed);
+    setLaunchMode(previous);
+    free(path);
+}
+
+/**
+ * Measure how fast bytes flow through a pipeline of external 'cat' commands, run through execute().
+ * @param name What to call the measurement.
+ * @param numStages How many 'cat' commands the bytes pass through.
+ * @param megabytes How many megabytes to send through the pipeline.
+ */
+static void benchPipeline(const char *name, int numStages, long megabytes) {
+    // The 'cat' stages are named by their path, so that they are neither run as the builtin nor removed from the pipeline
+    const char *cat = resolveCommand("cat");
+    char line[LINE_MAX];
+    int length = snprintf(line, sizeof(line), "head -c %ld /dev/zero", megabytes * 1024 * 1024);
+    int i;
+    for (i = 0; i < numStages; i++) {
+        length += snprintf(&line[length], sizeof(line) - length, " | %s", cat);
+    }
+    snprintf(&line[length], sizeof(line) - length, " > /dev/null");
+    
+    Arena arena = {0};
+    LineInput lineInput;
+    initLineInput(&lineInput, &arena);
+    if (parse(line, &lineInput) != kParseSuccess) {
+        fprintf(stderr, "Unable to parse '%s'.\n", line);
+        exit(EXIT_FAILURE);
+    }
+    double start = now();
+    if (execute(&lineInput) != EXIT_SUCCESS) {
+        fprintf(stderr, "'%s' failed.\n", line);
+        exit(EXIT_FAILURE);
+    }
+    double elapsed = now() - start;
+    
+    record(name, "MB/s", megabytes * 1024 * 1024 / elapsed / 1e6, 1, elapsed);
+    freeArena(&arena);
+}
+
+/**
+ * Measure how fast children are reaped while many of them are running at once: every child is started
+ * as a background job before any of them are waited for, and each is waited for through the event loop.
+ * @param name What to call the measurement.
+ * @param numChildren How many children to have running at once.
+ * @param rounds How many times to start and reap them all.
+ */
+static void benchReap(const char *name, int numChildren, long rounds) {
+    char *argv[] = { (char *)resolveCommand("true"), NULL };
+    Job **jobs = malloc(numChildren * sizeof(Job *));
+    if (jobs == NULL) {
+        perror("Unable to allocate memory.\n\r");
+        exit(EXIT_FAILURE);
+    }
+    double start = now();
+    long round;
+    for (round = 0; round < rounds; round++) {
+        int i;
+        for (i = 0; i < numChildren; i++) {
+            Stage stage = { .argv = argv };
+            jobs[i] = startPipeline(&stage, 1, kShellFds, true);
+        }
+        Job *job;
+        while ((job = waitForAnyJob(jobs, numChildren)) != NULL) {
+            for (i = 0; jobs[i] != job; i++) {
+            }
+            jobs[i] = NULL;
+            removeJob(job);
+        }
+    }
+    double elapsed = now() - start;
+    
+    record(name, "children/s", numChildren * rounds / elapsed, numChildren * rounds, elapsed);
+    free(jobs);
+}
+
+/**
+ * Measure how many statements per second a script runs through processLine().
+ * The shell echoes every statement, so standard output is sent to /dev/null meanwhile.
+ * @param name What to call the measurement.
+ * @param cacheLimit How much memory the parse cache may use, or 0 to parse every statement afresh.
+ * @param iterations How many statements to run.
+ */
+static void benchScript(const char *name, size_t cacheLimit, long iterations) {
+    int numStatements = sizeof(kScriptStatements) / sizeof(kScriptStatements[0]);
+    char line[LINE_MAX];
+    fflush(stdout);
+    int savedOutput = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+    close(devNull);
+    
+    clearParseCache();
+    setParseCacheLimit(cacheLimit);
+    double start = now();
+    long i;
+    for (i = 0; i < iterations; i++) {
+        strcpy(line, kScriptStatements[i % numStatements]);
+        processLine(line, NULL);
+    }
+    fflush(stdout);
+    double elapsed = now() - start;
+    
+    dup2(savedOutput, STDOUT_FILENO);
+    close(savedOutput);
+    record(name, "lines/s", iterations / elapsed, iterations, elapsed);
+}
+
+/**
+ * Measure how many passes per second a for loop makes, once parsed, without starting any processes.
+ * @param iterations How many passes to make in total.
+ */
+static void benchLoop(long iterations) {
+    const int numWords = 1000;
+    char *text = malloc(numWords * 8 + 64);
+    if (text == NULL) {
+        perror("Unable to allocate memory.\n\r");
+        exit(EXIT_FAILURE);
+    }
+    int length = sprintf(text, "for i in");
+    int i;
+    for (i = 0; i < numWords; i++) {
+        length += sprintf(&text[length], " %d", i);
+    }
+    sprintf(&text[length], "; do x=$i; echo \"$x\" > /dev/null; done");
+    
+    Arena arena = {0};
+    Node *program;
+    if (parseProgram(text, strlen(text), &arena, &program) != kParseSuccess) {
+        fprintf(stderr, "Unable to parse the loop.\n");
+        exit(EXIT_FAILURE);
+    }
+    double start = now();
+    long passes = 0;
+    while (passes < iterations) {
+        executeNode(program);
+        passes += numWords;
+    }
+    double elapsed = now() - start;
+    
+    record("loop", "passes/s", passes / elapsed, passes, elapsed);
+    freeArena(&arena);
+    free(text);
+}
+
+/**
+ * Measure how many times per second a wildcard is matched against a directory of many files, reading the directory
+ * each time, and through the cached listing of it.
+ * @param numFiles The number of files in the directory.
+ * @param iterations How many times to match the wildcard each way.
+ */
+static void benchGlob(int numFiles, long iterations) {
+    char directory[] = "/tmp/nsh-bench-XXXXXX", path[64];
+    if (mkdtemp(directory) == NULL) {
+        perror("Unable to create a temporary directory.\n\r");
+        exit(EXIT_FAILURE);
+    }
+    int i;
+    for (i = 0; i < numFiles; i++) {
+        snprintf(path, sizeof(path), "%s/file%d", directory, i);
+        int fd = open(path, O_WRONLY | O_CREAT, 0600);
+        if (fd == -1) {
+            perror("Unable to create a temporary file.\n\r");
+            exit(EXIT_FAILURE);
+        }
+        close(fd);
+    }
+    // A directory modified a moment ago is read every time, in case it changed again within the same tick
+    struct timespec times[2] = { { time(NULL) - 60, 0 }, { time(NULL) - 60, 0 } };
+    utimensat(AT_FDCWD, directory, times, 0);
+    
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "%s/file%c*7", directory, GLOB_MARKER);
+    const char *names[] = { "glob_100k_uncached", "glob_100k" };
+    int pass;
+    for (pass = 0; pass < 2; pass++) {
+        double start = now();
+        long j;
+        for (j = 0; j < iterations; j++) {
+            if (pass == 0) {
+                clearGlobCache();
+            }
+            Arena arena = {0};
+            char **words = NULL;
+            int numWords = 0, capacity = 0;
+            expandGlob(pattern, &words, &numWords, &capacity, &arena);
+            freeArena(&arena);
+        }
+        double elapsed = now() - start;
+        record(names[pass], "globs/s", iterations / elapsed, iterations, elapsed);
+    }
+    clearGlobCache();
+    for (i = 0; i < numFiles; i++) {
+        snprintf(path, sizeof(path), "%s/file%d", directory, i);
+        unlink(path);
+    }
+    rmdir(directory);
+}
+
+/**
+ * Measure how fast a file is copied into another file, with read()/write() and with transferData().
+ * @param megabytes The size of the file.
+ */
+static void benchTransfer(long megabytes) {
+    char sourcePath[] = "/tmp/nsh-bench-XXXXXX", destinationPath[] = "/tmp/nsh-bench-XXXXXX";
+    int source = mkstemp(sourcePath), destination = mkstemp(destinationPath);
+    if (source == -1 || destination == -1) {
+        perror("Unable to create a temporary file.\n\r");
+        exit(EXIT_FAILURE);
+    }
+    char buffer[65536];
+    memset(buffer, 'a', sizeof(buffer));
+    long i, size = megabytes * 1024 * 1024;
+    for (i = 0; i < size; i += sizeof(buffer)) {
+        if (writeAll(source, buffer, sizeof(buffer)) == -1) {
+            perror("Unable to write a temporary file.\n\r");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    const char *names[] = { "copy_read_write", "copy_kernel" };
+    int (*moves[])(int, int) = { copyData, transferData };
+    for (i = 0; i < 2; i++) {
+        lseek(source, 0, SEEK_SET);
+        lseek(destination, 0, SEEK_SET);
+        ftruncate(destination, 0);
+        double start = now();
+        if (moves[i](source, destination) == -1) {
+            perror(names[i]);
+            exit(EXIT_FAILURE);
+        }
+        double elapsed = now() - start;
+        record(names[i], "MB/s", size / elapsed / 1e6, 1, elapsed);
+    }
+    close(source);
+    close(destination);
+    unlink(sourcePath);
+    unlink(destinationPath);
+}
+
+/**
+ * Measure how fast the output of a command is duplicated from a pipe into three files, with read()/write() and with
+ * fanOutData().
+ * @param megabytes How much the command writes.
+ */
+static void benchFanOut(long megabytes) {
+    char paths[3][32];
+    int files[3], i;
+    for (i = 0; i < 3; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "/tmp/nsh-bench-XXXXXX");
+        if ((files[i] = mkstemp(paths[i])) == -1) {
+            perror("Unable to create a temporary file.\n\r");
+            exit(EXIT_FAILURE);
+        }
+    }
+    char size[32];
+    snprintf(size, sizeof(size), "%ld", megabytes * 1024 * 1024);
+    char *argv[] = { (char *)resolveCommand("head"), "-c", size, "/dev/zero", NULL };
+    
+    const char *names[] = { "fanout_3_read_write", "fanout_3_kernel" };
+    int (*fanOuts[])(int, const int[], int) = { copyDataToAll, fanOutData };
+    for (i = 0; i < 2; i++) {
+        int j, fd[2];
+        for (j = 0; j < 3; j++) {
+            lseek(files[j], 0, SEEK_SET);
+            ftruncate(files[j], 0);
+        }
+        if (openPipe(fd) == -1) {
+            perror("Unable to create a pipe.\n\r");
+            exit(EXIT_FAILURE);
+        }
+        Stage stage = { .argv = argv };
+        StdFds fds = { STDIN_FILENO, fd[1], STDERR_FILENO };
+        double start = now();
+        Job *job = startPipeline(&stage, 1, fds, true);
+        close(fd[1]);
+        if (fanOuts[i](fd[0], files, 3) == -1) {
+            perror(names[i]);
+            exit(EXIT_FAILURE);
+        }
+        double elapsed = now() - start;
+        close(fd[0]);
+        waitForJob(job, false);
+        removeJob(job);
+        record(names[i], "MB/s", megabytes * 1024 * 1024 / elapsed / 1e6, 1, elapsed);
+    }
+    for (i = 0; i < 3; i++) {
+        close(files[i]);
+        unlink(paths[i]);
+    }
+}
+
+/**
+ * Write every recorded result as JSON.
+ * @param output Where to write the results.
+ */
+static void writeResults(FILE *output) {
+    fprintf(output, "{\n  \"benchmarks\": [\n");
+    int i;
+    for (i = 0; i < numResults; i++) {
+        BenchResult *result = &results[i];
+        fprintf(output, "    {\"name\": \"%s\", \"unit\": \"%s\", \"value\": %.3f, \"iterations\": %ld, \"seconds\": %.6f}%s\n",
+                result->name, result->unit, result->value, result->iterations, result->seconds,
+                i < numResults - 1 ? "," : "");
+    }
+    fprintf(output, "  ]\n}\n");
+}
+
+/*
+ * Run the benchmark suite and write its results as JSON, to standard output or to the given file.
+ * Progress is reported on standard error. -q runs a tenth of the usual iterations.
+ * Usage: nshbench [-q] [-o file]
+ */
+int main(int argc, char *argv[]) {
+    const char *outputPath = NULL;
+    long scale = 10;
+    int i;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-q") == 0) {
+            scale = 1;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [-q] [-o file]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (startZygote() == -1) { // Before anything else, so that the zygote is as small as it can be
+        perror("Unable to start the zygote.\n\r");
+        return EXIT_FAILURE;
+    }
+    initVariables();
+    initJobControl(false); // Children are reaped just as they are in a script
+    if (startEventLoop() == -1) {
+        perror("Unable to start the event loop.\n\r");
+    }
+    
+    benchParse(100000 * scale);
+    benchSpawn("spawn_latency_fork", kLaunchFork, 100 * scale);
+    benchSpawn("spawn_latency_spawn", kLaunchSpawn, 100 * scale);
+    benchSpawn("spawn_latency_zygote", kLaunchZygote, 100 * scale);
+    
+    // Again, once the shell holds a large heap that fork() has to copy the page tables of
+    size_t ballastSize = 256 * 1024 * 1024;
+    char *ballast = malloc(ballastSize);
+    if (ballast == NULL) {
+        perror("Unable to allocate memory.\n\r");
+        exit(EXIT_FAILURE);
+    }
+    memset(ballast, 1, ballastSize);
+    benchSpawn("spawn_latency_fork_256mb", kLaunchFork, 100 * scale);
+    benchSpawn("spawn_latency_spawn_256mb", kLaunchSpawn, 100 * scale);
+    benchSpawn("spawn_latency_zygote_256mb", kLaunchZygote, 100 * scale);
+    free(ballast);
+    
+    // Again, with as large an environment as a script that exports a lot of variables, which each launch hands on
+    char name[32];
+    for (i = 0; i < 500; i++) {
+        snprintf(name, sizeof(name), "NSH_BENCH_%d", i);
+        exportVariable(name, "/usr/local/share/nsh/bench/variable");
+    }
+    benchSpawn("spawn_latency_spawn_500env", kLaunchSpawn, 100 * scale);
+    benchSpawn("spawn_latency_zygote_500env", kLaunchZygote, 100 * scale);
+    for (i = 0; i < 500; i++) {
+        snprintf(name, sizeof(name), "NSH_BENCH_%d", i);
+        unsetVariable(name);
+    }
+    benchPipeline("pipeline_throughput_1", 1, 25 * scale);
+    benchPipeline("pipeline_throughput_4", 4, 25 * scale);
+    setPipeSize(1024 * 1024); // Again, with pipes as large as the system allows, up to 1 MB
+    benchPipeline("pipeline_throughput_4_large_pipes", 4, 25 * scale);
+    setPipeSize(0);
+    setAutoPlacement(true); // Again, with each stage pinned next to the stages it shares a pipe with
+    benchPipeline("pipeline_throughput_4_placed", 4, 25 * scale);
+    setAutoPlacement(false);
+    benchReap("reap_256_children", 256, scale);
+    benchScript("script_uncached", 0, 10000 * scale);
+    benchScript("script", 4 * 1024 * 1024, 10000 * scale);
+    benchLoop(10000 * scale);
+    benchGlob(100000, 2 * scale);
+    benchTransfer(25 * scale);
+    benchFanOut(10 * scale);
+    
+    FILE *output = stdout;
+    if (outputPath && (output = fopen(outputPath, "w")) == NULL) {
+        perror(outputPath);
+        return EXIT_FAILURE;
+    }
+    writeResults(output);
+    if (output != stdout) {
+        fclose(output);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,752 @@
+#include "Builtin.h"
+#include "CommandCache.h"
+#include "Job.h"
+#include "Parallel.h"
+#include "ParseCache.h"
+#include "Pipes.h"
+#include "Placement.h"
+#include "Stats.h"
+#include "Transfer.h"
+#include "Variables.h"
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdarg.h>
+
+// The most buffers a single writev() accepts, which only some headers declare by default
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+const StdFds kShellFds = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+
+/**
+ * Check whether the 'cat' builtin handles a command: only when it is given no options,
+ * and is not left reading a terminal within the shell itself.
+ * @param cmd The command, followed by its arguments and a terminating NULL.
+ * @param interactive Whether the command would run within the shell itself, reading a terminal as its standard input.
+ * @return Whether or not the builtin handles the command.
+ */
+static bool handlesCat(char *cmd[], bool interactive) {
+    bool readsInput = cmd[1] == NULL;
+    int i;
+    for (i = 1; cmd[i]; i++) {
+        if (cmd[i][0] == '-' && cmd[i][1] != '\0') { // Such as -n or --version
+            return false;
+        }
+        readsInput = readsInput || cmd[i][0] == '-';
+    }
+    return !(interactive && readsInput);
+}
+
+/**
+ * Check whether the 'tee' builtin handles a command: only when its one option is a leading -a,
+ * and it is not left reading a terminal within the shell itself.
+ * @param cmd The command, followed by its arguments and a terminating NULL.
+ * @param interactive Whether the command would run within the shell itself, reading a terminal as its standard input.
+ * @return Whether or not the builtin handles the command.
+ */
+static bool handlesTee(char *cmd[], bool interactive) {
+    int i;
+    for (i = 1; cmd[i]; i++) {
+        if (cmd[i][0] == '-' && cmd[i][1] != '\0' && (i > 1 || strcmp(cmd[i], "-a") != 0)) { // Such as -i or --help
+            return false;
+        }
+    }
+    return !interactive;
+}
+
+// Every command the shell runs itself
+static const Builtin kBuiltins[] = {
+    { "bg", processBg },
+    { "cat", processCat, handlesCat },
+    { "cd", processChangeDirectory },
+    { "echo", processEcho },
+    { "exit", processExit },
+    { "export", processExport },
+    { "false", processFalse },
+    { "fg", processFg },
+    { "hash", processHash },
+    { "jobs", processJobs },
+    { "parallel", processParallel },
+    { "parsecache", processParseCache },
+    { "printf", processPrintf },
+    { "set", processSet },
+    { "stats", processStats },
+    { "tee", processTee, handlesTee },
+    { "true", processTrue },
+    { "unset", processUnset },
+    { "wait", processWait },
+};
+
+/**
+ * Look up a command in the builtin dispatch table.
+ * @param cmd The command, followed by its arguments and a terminating NULL.
+ * @param interactive Whether the command would run within the shell itself, reading a terminal as its standard input.
+ * @return The builtin, or NULL if the command is not a builtin, or is a form of one left to the program of the same name.
+ */
+const Builtin *findBuiltin(char *cmd[], bool interactive) {
+    size_t i;
+    for (i = 0; i < sizeof(kBuiltins) / sizeof(kBuiltins[0]); i++) {
+        if (strcmp(kBuiltins[i].name, cmd[0]) == 0) {
+            return kBuiltins[i].handles == NULL || kBuiltins[i].handles(cmd, interactive) ? &kBuiltins[i] : NULL;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Write every buffer of an iovec array, continuing after partial writes.
+ * @param fd The descriptor to write to.
+ * @param buffers The buffers to write. Their entries are modified as they are written.
+ * @param numBuffers The number of buffers.
+ * @return 0 if success, -1 otherwise.
+ */
+int writeBuffers(int fd, struct iovec *buffers, int numBuffers) {
+    while (numBuffers > 0) {
+        ssize_t written = writev(fd, buffers, numBuffers > IOV_MAX ? IOV_MAX : numBuffers);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        // Skip past whatever was written, which may end partway through a buffer
+        while (numBuffers > 0 && (size_t)written >= buffers->iov_len) {
+            written -= buffers->iov_len;
+            buffers++;
+            numBuffers--;
+        }
+        if (numBuffers > 0) {
+            buffers->iov_base = (char *)buffers->iov_base + written;
+            buffers->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Write a whole buffer, continuing after partial writes.
+ * @param fd The descriptor to write to.
+ * @param buffer The bytes to write.
+ * @param length The number of bytes to write.
+ * @return 0 if success, -1 otherwise.
+ */
+int writeAll(int fd, const void *buffer, size_t length) {
+    struct iovec buffers = { (void *)buffer, length };
+    return writeBuffers(fd, &buffers, 1);
+}
+
+/**
+ * Read exactly the given number of bytes.
+ * @param fd The descriptor to read from.
+ * @param buffer Where to put the bytes.
+ * @param length The number of bytes to read.
+ * @return 0 if success, -1 if the other end went away first or the read failed.
+ */
+int readAll(int fd, void *buffer, size_t length) {
+    size_t numRead = 0;
+    while (numRead < length) {
+        ssize_t result = read(fd, (char *)buffer + numRead, length - numRead);
+        if (result == 0) {
+            return -1;
+        } else if (result == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        numRead += result;
+    }
+    return 0;
+}
+
+/**
+ * Process a 'cd' command
+ * @param cmd The 'cd' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processChangeDirectory(char *cmd[], StdFds fds) {
+    const char *directory = cmd[1];
+    if (directory == NULL) { // If just 'cd', go to ~
+        if ((directory = getVariable("HOME")) == NULL) {
+            dprintf(fds.err, "cd: Unable to access the HOME env variable.\n");
+            return EXIT_FAILURE;
+        }
+    }
+    if (chdir(directory) == -1) {
+        dprintf(fds.err, "cd: %s: %s\n", directory, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Process an 'exit' command, leaving the shell with the given status (or 0).
+ * @param cmd The 'exit' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return Never returns.
+ */
+int processExit(char *cmd[], StdFds fds) {
+    fflush(stdout);
+    exit(cmd[1] ? atoi(cmd[1]) : EXIT_SUCCESS);
+}
+
+/**
+ * Process the echo command, writing its arguments separated by spaces with a single writev().
+ * 'echo -n' leaves out the trailing newline.
+ * @param cmd The command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processEcho(char *cmd[], StdFds fds) {
+    int first = 1;
+    bool newline = true;
+    if (cmd[1] && strcmp(cmd[1], "-n") == 0) {
+        newline = false;
+        first = 2;
+    }
+    int numArgs = 0;
+    while (cmd[first + numArgs]) {
+        numArgs++;
+    }
+    
+    // Each argument is followed by either a space or the newline
+    struct iovec localBuffers[64];
+    struct iovec *buffers = localBuffers;
+    if (numArgs * 2 + 1 > 64 && (buffers = malloc((numArgs * 2 + 1) * sizeof(struct iovec))) == NULL) {
+        perror("Unable to allocate memory.\n\r");
+        exit(EXIT_FAILURE);
+    }
+    int numBuffers = 0, i;
+    for (i = 0; i < numArgs; i++) {
+        buffers[numBuffers].iov_base = cmd[first + i];
+        buffers[numBuffers++].iov_len = strlen(cmd[first + i]);
+        if (i < numArgs - 1) {
+            buffers[numBuffers].iov_base = " ";
+            buffers[numBuffers++].iov_len = 1;
+        }
+    }
+    if (newline) {
+        buffers[numBuffers].iov_base = "\n";
+        buffers[numBuffers++].iov_len = 1;
+    }
+    
+    int status = EXIT_SUCCESS;
+    if (writeBuffers(fds.out, buffers, numBuffers) == -1) {
+        dprintf(fds.err, "echo: %s\n", strerror(errno));
+        status = EXIT_FAILURE;
+    }
+    if (buffers != localBuffers) {
+        free(buffers);
+    }
+    return status;
+}
+
+/**
+ * Process a 'true' command.
+ * @param cmd The command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return 0.
+ */
+int processTrue(char *cmd[], StdFds fds) {
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Process a 'false' command.
+ * @param cmd The command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return 1.
+ */
+int processFalse(char *cmd[], StdFds fds) {
+    return EXIT_FAILURE;
+}
+
+/**
+ * A growable buffer that printf's output is collected in, so that it can be written all at once.
+ */
+typedef struct outputBuffer {
+    char *data;
+    size_t length, capacity;
+} OutputBuffer;
+
+/**
+ * Append bytes to an output buffer, growing it as needed.
+ */
+static void appendBytes(OutputBuffer *buffer, const char *bytes, size_t length) {
+    if (buffer->length + length > buffer->capacity) {
+        buffer->capacity = (buffer->length + length) * 2;
+        if ((buffer->data = realloc(buffer->data, buffer->capacity)) == NULL) {
+            perror("Unable to allocate memory.\n\r");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(&buffer->data[buffer->length], bytes, length);
+    buffer->length += length;
+}
+
+/**
+ * Append a single conversion, formatted by the C library, to an output buffer.
+ */
+static void appendFormatted(OutputBuffer *buffer, const char *spec, ...) {
+    va_list arguments;
+    va_start(arguments, spec);
+    char local[256];
+    int length = vsnprintf(local, sizeof(local), spec, arguments);
+    va_end(arguments);
+    if (length < 0) {
+        return;
+    }
+    if ((size_t)length < sizeof(local)) {
+        appendBytes(buffer, local, length);
+        return;
+    }
+    char *large = malloc(length + 1);
+    if (large == NULL) {
+        perror("Unable to allocate memory.\n\r");
+        exit(EXIT_FAILURE);
+    }
+    va_start(arguments, spec);
+    vsnprintf(large, length + 1, spec, arguments);
+    va_end(arguments);
+    appendBytes(buffer, large, length);
+    free(large);
+}
+
+/**
+ * Append the character that a backslash escape stands for.
+ * @param buffer The buffer to append to.
+ * @param escape The characters following the backslash.
+ * @return The first character after the escape, or NULL for '\c', which ends all output.
+ */
+static const char *appendEscape(OutputBuffer *buffer, const char *escape) {
+    char c;
+    switch (*escape) {
+        case 'a': c = '\a'; break;
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'v': c = '\v'; break;
+        case '\\': c = '\\'; break;
+        case 'c': return NULL;
+        case '\0': // A trailing backslash is kept as-is
+            appendBytes(buffer, "\\", 1);
+            return escape;
+        default:
+            if (*escape >= '0' && *escape <= '7') { // Up to three octal digits (after an optional leading 0)
+                int value = 0, digits = 0;
+                if (*escape == '0') {
+                    escape++;
+                }
+                while (digits < 3 && *escape >= '0' && *escape <= '7') {
+                    value = value * 8 + (*escape++ - '0');
+                    digits++;
+                }
+                c = (char)value;
+                appendBytes(buffer, &c, 1);
+                return escape;
+            }
+            appendBytes(buffer, "\\", 1); // Not an escape, so keep the backslash
+            c = *escape;
+            break;
+    }
+    appendBytes(buffer, &c, 1);
+    return escape + 1;
+}
+
+/**
+ * Read a numeric printf argument. A leading quote gives the value of the character that follows it.
+ * @param argument The argument to read, or NULL for a missing argument.
+ * @param fds Where to report an argument that isn't a number.
+ * @param valid Cleared if the argument isn't a number.
+ * @return The argument's value.
+ */
+static long long numericArgument(const char *argument, StdFds fds, bool *valid) {
+    if (argument == NULL || argument[0] == '\0') {
+        return 0;
+    }
+    if (argument[0] == '\'' || argument[0] == '"') {
+        return (unsigned char)argument[1];
+    }
+    char *end;
+    errno = 0;
+    long long value = strtoll(argument, &end, 0);
+    if (*end != '\0' || errno != 0) {
+        dprintf(fds.err, "printf: %s: expected a numeric value\n", argument);
+        *valid = false;
+    }
+    return value;
+}
+
+/**
+ * Process a 'printf format [argument...]' command. The format is reused until every argument is consumed.
+ * Supports the %s, %b, %c, %d, %i, %u, %o, %x, %X and %% conversions, along with flags, widths and precisions,
+ * and the usual backslash escapes.
+ * @param cmd The command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processPrintf(char *cmd[], StdFds fds) {
+    if (cmd[1] == NULL) {
+        dprintf(fds.err, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+    const char *format = cmd[1];
+    char **arguments = &cmd[2];
+    OutputBuffer buffer = { NULL, 0, 0 };
+    bool valid = true, stopped = false;
+    
+    do {
+        char **passStart = arguments;
+        const char *f;
+        for (f = format; *f && !stopped; f++) {
+            if (*f == '\\') {
+                const char *next = appendEscape(&buffer, f + 1);
+                if (next == NULL) {
+                    stopped = true;
+                    break;
+                }
+                f = next - 1;
+                continue;
+            } else if (*f != '%') {
+                appendBytes(&buffer, f, 1);
+                continue;
+            } else if (f[1] == '%') {
+                appendBytes(&buffer, "%", 1);
+                f++;
+                continue;
+            }
+            
+            // Copy the flags, width and precision of the conversion, to hand them to the C library
+            const char *specStart = f++;
+            while (*f && strchr("-+ #0", *f)) {
+                f++;
+            }
+            while (isdigit((unsigned char)*f)) {
+                f++;
+            }
+            if (*f == '.') {
+                f++;
+                while (isdigit((unsigned char)*f)) {
+                    f++;
+                }
+            }
+            char spec[64];
+            size_t specLength = f - specStart;
+            if (specLength > sizeof(spec) - 4) {
+                specLength = sizeof(spec) - 4;
+            }
+            memcpy(spec, specStart, specLength);
+            const char *argument = *arguments ? *arguments++ : NULL;
+            
+            switch (*f) {
+                case 's':
+                    strcpy(&spec[specLength], "s");
+                    appendFormatted(&buffer, spec, argument ? argument : "");
+                    break;
+                case 'b': { // A string whose escapes are expanded
+                    OutputBuffer expanded = { NULL, 0, 0 };
+                    const char *a = argument ? argument : "";
+                    while (*a && !stopped) {
+                        if (*a == '\\') {
+                            if ((a = appendEscape(&expanded, a + 1)) == NULL) {
+                                stopped = true;
+                            }
+                        } else {
+                            appendBytes(&expanded, a++, 1);
+                        }
+                    }
+                    appendBytes(&expanded, "", 1);
+                    strcpy(&spec[specLength], "s");
+                    appendFormatted(&buffer, spec, expanded.data);
+                    free(expanded.data);
+                    break;
+                }
+                case 'c':
+                    strcpy(&spec[specLength], "c");
+                    appendFormatted(&buffer, spec, argument ? argument[0] : '\0');
+                    break;
+                case 'd':
+                case 'i':
+                    strcpy(&spec[specLength], "lld");
+                    appendFormatted(&buffer, spec, numericArgument(argument, fds, &valid));
+                    break;
+                case 'u':
+                case 'o':
+                case 'x':
+                case 'X':
+                    sprintf(&spec[specLength], "ll%c", *f);
+                    appendFormatted(&buffer, spec, (unsigned long long)numericArgument(argument, fds, &valid));
+                    break;
+                default:
+                    dprintf(fds.err, "printf: %.*s: invalid conversion\n", (int)(f - specStart + 1), specStart);
+                    free(buffer.data);
+                    return EXIT_FAILURE;
+            }
+        }
+        if (arguments == passStart) { // The format uses no arguments, so reusing it would never end
+            break;
+        }
+    } while (*arguments && !stopped);
+    
+    int status = valid ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (buffer.length && writeAll(fds.out, buffer.data, buffer.length) == -1) {
+        dprintf(fds.err, "printf: %s\n", strerror(errno));
+        status = EXIT_FAILURE;
+    }
+    free(buffer.data);
+    return status;
+}
+
+/**
+ * Process a 'cat [file...]' command, copying each file (or standard input, given as '-' or no files at all) to standard output.
+ * The kernel moves the bytes whenever it can, so they never pass through the shell.
+ * @param cmd The command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processCat(char *cmd[], StdFds fds) {
+    static char *standardInput[] = { "-", NULL };
+    char **files = cmd[1] ? &cmd[1] : standardInput;
+    int status = EXIT_SUCCESS;
+    int i;
+    for (i = 0; files[i]; i++) {
+        int fileNum = fds.in;
+        if (strcmp(files[i], "-") != 0 && (fileNum = open(files[i], O_RDONLY | O_CLOEXEC)) == -1) {
+            dprintf(fds.err, "cat: %s: %s\n", files[i], strerror(errno));
+            status = EXIT_FAILURE;
+            continue;
+        }
+        if (transferData(fileNum, fds.out) == -1) {
+            dprintf(fds.err, "cat: %s: %s\n", files[i], strerror(errno));
+            status = EXIT_FAILURE;
+        }
+        if (fileNum != fds.in) {
+            close(fileNum);
+        }
+    }
+    return status;
+}
+
+/**
+ * Process a 'tee [-a] [file...]' command, copying standard input to standard output and to every file given,
+ * which are truncated first, or appended to with -a. Reading from a pipe, the kernel duplicates the bytes,
+ * so they never pass through the shell.
+ * @param cmd The command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processTee(char *cmd[], StdFds fds) {
+    bool append = cmd[1] && strcmp(cmd[1], "-a") == 0;
+    char **files = &cmd[append ? 2 : 1];
+    int numFiles = 0, status = EXIT_SUCCESS, i;
+    while (files[numFiles]) {
+        numFiles++;
+    }
+    int *to = malloc((numFiles + 1) * sizeof(int)), numTo = 0;
+    if (to == NULL) {
+        perror("Unable to allocate memory.\n\r");
+        exit(EXIT_FAILURE);
+    }
+    to[numTo++] = fds.out;
+    for (i = 0; i < numFiles; i++) {
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC);
+        if ((to[numTo] = open(files[i], flags, 0666)) == -1) {
+            dprintf(fds.err, "tee: %s: %s\n", files[i], strerror(errno));
+            status = EXIT_FAILURE;
+        } else {
+            numTo++;
+        }
+    }
+    
+    if (fanOutData(fds.in, to, numTo) == -1) {
+        dprintf(fds.err, "tee: %s\n", strerror(errno));
+        status = EXIT_FAILURE;
+    }
+    for (i = 1; i < numTo; i++) {
+        close(to[i]);
+    }
+    free(to);
+    return status;
+}
+
+/**
+ * Read a size in bytes, which may be followed by k, m or g for kibibytes, mebibytes or gibibytes.
+ * @param text The size, such as 1048576 or 1m.
+ * @param bytes Set to the size in bytes.
+ * @return Whether or not the text was a size.
+ */
+bool parseByteSize(const char *text, long *bytes) {
+    char *end;
+    errno = 0;
+    long size = strtol(text, &end, 10);
+    if (end == text || size < 0 || errno == ERANGE) {
+        return false;
+    }
+    int shift = 0;
+    switch (tolower((unsigned char)*end)) {
+        case 'g':
+            shift += 10; // Fall through
+        case 'm':
+            shift += 10; // Fall through
+        case 'k':
+            shift += 10;
+            end++;
+            break;
+    }
+    if (*end != '\0' || size > (LONG_MAX >> shift)) {
+        return false;
+    }
+    *bytes = size << shift;
+    return true;
+}
+
+/**
+ * @param value "on" or "off".
+ * @param on Set to whether the value was "on".
+ * @return Whether or not the value was "on" or "off".
+ */
+static bool parseSwitch(const char *value, bool *on) {
+    *on = strcmp(value, "on") == 0;
+    return *on || strcmp(value, "off") == 0;
+}
+
+/**
+ * Set the capacity of the pipes between pipeline stages, for 'set pipesize=bytes'.
+ * @param value The capacity, which may be followed by k, m or g. 0 goes back to the system's default.
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+static int setPipeSizeOption(const char *value, StdFds fds) {
+    long bytes, size;
+    if (!parseByteSize(value, &bytes)) {
+        dprintf(fds.err, "set: pipesize must be a size in bytes (k or m may follow), not '%s'\n", value);
+        return EXIT_FAILURE;
+    } else if ((size = setPipeSize(bytes)) == -1) {
+        dprintf(fds.err, "set: pipes can't be resized on this system\n");
+        return EXIT_FAILURE;
+    } else if (size < bytes) {
+        dprintf(fds.err, "set: pipesize is limited to %ld bytes, the most the system allows\n", size);
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Turn packet mode on or off for the pipes between pipeline stages, for 'set pipepackets=on|off'.
+ * @param value "on" or "off".
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+static int setPipePacketsOption(const char *value, StdFds fds) {
+    bool on;
+    if (!parseSwitch(value, &on)) {
+        dprintf(fds.err, "set: pipepackets must be on or off, not '%s'\n", value);
+        return EXIT_FAILURE;
+    } else if (setPipePackets(on) == -1) {
+        dprintf(fds.err, "set: pipes have no packet mode on this system\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Turn counting the bytes through pipes between pipeline stages on or off, for 'set pipestats=on|off'.
+ * @param value "on" or "off".
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+static int setPipeStatsOption(const char *value, StdFds fds) {
+    bool on;
+    if (!parseSwitch(value, &on)) {
+        dprintf(fds.err, "set: pipestats must be on or off, not '%s'\n", value);
+        return EXIT_FAILURE;
+    }
+    setPipeCounting(on);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Turn automatic placement of pipeline stages on CPUs on or off, for 'set placement=auto|off'.
+ * @param value "auto" or "off".
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+static int setPlacementOption(const char *value, StdFds fds) {
+    bool automatic = strcmp(value, "auto") == 0;
+    if (!automatic && strcmp(value, "off") != 0) {
+        dprintf(fds.err, "set: placement must be auto or off, not '%s'\n", value);
+        return EXIT_FAILURE;
+    } else if (setAutoPlacement(automatic) == -1) {
+        dprintf(fds.err, "set: processes can't be pinned to CPUs on this system\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Print every option that 'set' changes, along with its value, in a form 'set' accepts.
+ * @param fds The descriptors to use as standard input, output and error.
+ */
+static void printOptions(StdFds fds) {
+    dprintf(fds.out, "pipesize=%ld\n", getPipeSize());
+    dprintf(fds.out, "pipepackets=%s\n", getPipePackets() ? "on" : "off");
+    dprintf(fds.out, "pipestats=%s\n", getPipeCounting() ? "on" : "off");
+    dprintf(fds.out, "placement=%s\n", getAutoPlacement() ? "auto" : "off");
+}
+
+/**
+ * The options that 'set' changes.
+ */
+typedef struct shellOption {
+    const char *name;
+    int (*set)(const char *value, StdFds fds);
+} ShellOption;
+
+static const ShellOption kOptions[] = {
+    { "pipesize", setPipeSizeOption },
+    { "pipepackets", setPipePacketsOption },
+    { "pipestats", setPipeStatsOption },
+    { "placement", setPlacementOption },
+};
+
+/**
+ * Process a 'set [option=value...]' command, which changes how the shell runs commands.
+ * 'set' alone prints every option. The options are:
+ * pipesize=bytes, the capacity of the pipes between pipeline stages (0 for the system's default),
+ * pipepackets=on|off, whether those pipes are opened in packet mode,
+ * pipestats=on|off, whether the bytes through them are counted for 'stats',
+ * and placement=auto|off, whether the stages of pipelines are pinned to CPUs that share cache.
+ * @param cmd The 'set' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processSet(char *cmd[], StdFds fds) {
+    if (cmd[1] == NULL) {
+        printOptions(fds);
+        return EXIT_SUCCESS;
+    }
+    int status = EXIT_SUCCESS;
+    int i;
+    for (i = 1; cmd[i]; i++) {
+        const char *equals = strchr(cmd[i], '=');
+        const ShellOption *option = NULL;
+        size_t j;
+        for (j = 0; equals && j < sizeof(kOptions) / sizeof(kOptions[0]); j++) {
+            if (strncmp(kOptions[j].name, cmd[i], equals - cmd[i]) == 0 && kOptions[j].name[equals - cmd[i]] == '\0') {
+                option = &kOptions[j];
+            }
+        }
+        if (option == NULL) {
+            dprintf(fds.err, "set: usage: set [pipesize=bytes] [pipepackets=on|off] [pipestats=on|off] [placement=auto|off]\n");
+            return 2;
+        }
+        if (option->set(equals + 1, fds) != EXIT_SUCCESS) {
+            status = EXIT_FAILURE;
+        }
+    }
+    return status;
+}
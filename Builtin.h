@@ -0,0 +1,178 @@
+#ifndef Builtin_h
+#define Builtin_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+
+/**
+ * The descriptors a command uses as its standard input, output and error.
+ */
+typedef struct stdFds {
+    int in, out, err;
+} StdFds;
+
+/**
+ * The shell's own standard input, output and error.
+ */
+extern const StdFds kShellFds;
+
+/**
+ * A command that the shell runs itself. It reads and writes through the descriptors it is given,
+ * so redirecting a builtin never touches the shell's own standard input and output.
+ * @param cmd The command, followed by its arguments and a terminating NULL.
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+typedef int (*BuiltinFunction)(char *cmd[], StdFds fds);
+
+/**
+ * Check whether a builtin handles a particular form of its command, rather than leaving it to the program of the same name.
+ * @param cmd The command, followed by its arguments and a terminating NULL.
+ * @param interactive Whether the command would run within the shell itself, reading a terminal as its standard input,
+ * where only the shell would see ^C.
+ * @return Whether or not the builtin handles the command.
+ */
+typedef bool (*BuiltinCheck)(char *cmd[], bool interactive);
+
+/**
+ * An entry of the builtin dispatch table.
+ */
+typedef struct builtin {
+    const char *name;
+    BuiltinFunction run;
+    BuiltinCheck handles; // NULL if the builtin handles every form of its command
+} Builtin;
+
+/**
+ * Look up a command in the builtin dispatch table.
+ * @param cmd The command, followed by its arguments and a terminating NULL.
+ * @param interactive Whether the command would run within the shell itself, reading a terminal as its standard input.
+ * @return The builtin, or NULL if the command is not a builtin, or is a form of one left to the program of the same name.
+ */
+const Builtin *findBuiltin(char *cmd[], bool interactive);
+
+/**
+ * Write every buffer of an iovec array, continuing after partial writes.
+ * @param fd The descriptor to write to.
+ * @param buffers The buffers to write. Their entries are modified as they are written.
+ * @param numBuffers The number of buffers.
+ * @return 0 if success, -1 otherwise.
+ */
+int writeBuffers(int fd, struct iovec *buffers, int numBuffers);
+
+/**
+ * Write a whole buffer, continuing after partial writes.
+ * @param fd The descriptor to write to.
+ * @param buffer The bytes to write.
+ * @param length The number of bytes to write.
+ * @return 0 if success, -1 otherwise.
+ */
+int writeAll(int fd, const void *buffer, size_t length);
+
+/**
+ * Read exactly the given number of bytes.
+ * @param fd The descriptor to read from.
+ * @param buffer Where to put the bytes.
+ * @param length The number of bytes to read.
+ * @return 0 if success, -1 if the other end went away first or the read failed.
+ */
+int readAll(int fd, void *buffer, size_t length);
+
+/**
+ * Process a 'cd' command
+ * @param cmd The 'cd' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processChangeDirectory(char *cmd[], StdFds fds);
+
+/**
+ * Process an 'exit' command, leaving the shell with the given status (or 0).
+ * @param cmd The 'exit' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return Never returns.
+ */
+int processExit(char *cmd[], StdFds fds);
+
+/**
+ * Process the echo command, writing its arguments separated by spaces with a single writev().
+ * 'echo -n' leaves out the trailing newline.
+ * @param cmd The command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processEcho(char *cmd[], StdFds fds);
+
+/**
+ * Process a 'true' command.
+ * @param cmd The command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return 0.
+ */
+int processTrue(char *cmd[], StdFds fds);
+
+/**
+ * Process a 'false' command.
+ * @param cmd The command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return 1.
+ */
+int processFalse(char *cmd[], StdFds fds);
+
+/**
+ * Process a 'printf format [argument...]' command. The format is reused until every argument is consumed.
+ * Supports the %s, %b, %c, %d, %i, %u, %o, %x, %X and %% conversions, along with flags, widths and precisions,
+ * and the usual backslash escapes.
+ * @param cmd The command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processPrintf(char *cmd[], StdFds fds);
+
+/**
+ * Process a 'cat [file...]' command, copying each file (or standard input, given as '-' or no files at all) to standard output.
+ * The kernel moves the bytes whenever it can, so they never pass through the shell.
+ * @param cmd The command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processCat(char *cmd[], StdFds fds);
+
+/**
+ * Process a 'tee [-a] [file...]' command, copying standard input to standard output and to every file given,
+ * which are truncated first, or appended to with -a. Reading from a pipe, the kernel duplicates the bytes,
+ * so they never pass through the shell.
+ * @param cmd The command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processTee(char *cmd[], StdFds fds);
+
+/**
+ * Read a size in bytes, which may be followed by k, m or g for kibibytes, mebibytes or gibibytes.
+ * @param text The size, such as 1048576 or 1m.
+ * @param bytes Set to the size in bytes.
+ * @return Whether or not the text was a size.
+ */
+bool parseByteSize(const char *text, long *bytes);
+
+/**
+ * Process a 'set [option=value...]' command, which changes how the shell runs commands.
+ * 'set' alone prints every option. The options are:
+ * pipesize=bytes, the capacity of the pipes between pipeline stages (0 for the system's default),
+ * pipepackets=on|off, whether those pipes are opened in packet mode,
+ * pipestats=on|off, whether the bytes through them are counted for 'stats',
+ * and placement=auto|off, whether the stages of pipelines are pinned to CPUs that share cache.
+ * @param cmd The 'set' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processSet(char *cmd[], StdFds fds);
+
+#endif /* Builtin_h */
@@ -0,0 +1,189 @@
+#include "CommandCache.h"
+#include "Variables.h"
+
+#define NUM_BUCKETS 256
+
+static CommandEntry *buckets[NUM_BUCKETS];
+static char *cachedPathVar = NULL; // The value of $PATH that every entry was found with
+
+/**
+ * A simple string hash (djb2).
+ * @param name The string to hash.
+ * @return The bucket that the string belongs in.
+ */
+static unsigned bucketOf(const char *name) {
+    unsigned long hash = 5381;
+    for (; *name; name++) {
+        hash = hash * 33 + (unsigned char)*name;
+    }
+    return hash % NUM_BUCKETS;
+}
+
+/**
+ * Empty the cache if $PATH no longer has the value that the cached commands were found with.
+ */
+static void checkPathVar(void) {
+    const char *pathVar = getVariable("PATH");
+    if (pathVar == NULL) {
+        pathVar = "";
+    }
+    if (cachedPathVar != NULL && strcmp(cachedPathVar, pathVar) == 0) {
+        return;
+    }
+    clearCommandCache();
+    cachedPathVar = strdup(pathVar);
+}
+
+/**
+ * Find the executable that a command name refers to, searching $PATH only if it hasn't been found before.
+ * Names containing a '/' are paths already, and are returned as-is.
+ * The cache is emptied whenever $PATH changes.
+ * @param name The name of the command.
+ * @return The path of the executable, or NULL if no executable by that name is on $PATH.
+ */
+const char *resolveCommand(const char *name) {
+    if (strchr(name, '/')) {
+        return name;
+    }
+    checkPathVar();
+    
+    unsigned bucket = bucketOf(name);
+    CommandEntry *entry;
+    for (entry = buckets[bucket]; entry; entry = entry->next) {
+        if (strcmp(entry->name, name) == 0) {
+            entry->hits++;
+            return entry->path;
+        }
+    }
+    
+    char path[PATH_MAX];
+    if (!searchPath(name, path)) {
+        return NULL;
+    }
+    if ((entry = malloc(sizeof(CommandEntry))) == NULL) {
+        perror("Unable to allocate memory.\n\r");
+        exit(EXIT_FAILURE);
+    }
+    entry->name = strdup(name);
+    entry->path = strdup(path);
+    entry->hits = 1;
+    entry->next = buckets[bucket];
+    buckets[bucket] = entry;
+    return entry->path;
+}
+
+/**
+ * Search every directory of $PATH for an executable, without using the cache.
+ * @param name The name of the command.
+ * @param path Filled with the path of the executable, if one is found.
+ * @return Whether or not an executable was found.
+ */
+bool searchPath(const char *name, char path[PATH_MAX]) {
+    const char *dir = getVariable("PATH");
+    if (dir == NULL) {
+        dir = "/usr/local/bin:/usr/bin:/bin";
+    }
+    size_t nameLength = strlen(name);
+    while (true) {
+        size_t dirLength = strcspn(dir, ":");
+        bool fits = (dirLength ? dirLength : 1) + nameLength + 2 <= PATH_MAX; // Entries too long for a path are skipped
+        if (fits && dirLength == 0) { // An empty entry means the current directory
+            sprintf(path, "./%s", name);
+        } else if (fits) {
+            memcpy(path, dir, dirLength);
+            path[dirLength] = '/';
+            memcpy(&path[dirLength + 1], name, nameLength + 1);
+        }
+        
+        struct stat info;
+        if (fits && stat(path, &info) == 0 && S_ISREG(info.st_mode) && access(path, X_OK) == 0) {
+            return true;
+        }
+        if (dir[dirLength] == '\0') {
+            return false;
+        }
+        dir += dirLength + 1;
+    }
+}
+
+/**
+ * Drop a command from the cache, so that its next use searches $PATH again.
+ * This is done when executing the remembered path fails because it no longer exists.
+ * @param name The name of the command.
+ */
+void forgetCommand(const char *name) {
+    CommandEntry **link;
+    for (link = &buckets[bucketOf(name)]; *link; link = &(*link)->next) {
+        if (strcmp((*link)->name, name) == 0) {
+            CommandEntry *entry = *link;
+            *link = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            return;
+        }
+    }
+}
+
+/**
+ * Drop every command from the cache.
+ */
+void clearCommandCache(void) {
+    int i;
+    for (i = 0; i < NUM_BUCKETS; i++) {
+        while (buckets[i]) {
+            CommandEntry *entry = buckets[i];
+            buckets[i] = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+        }
+    }
+    free(cachedPathVar);
+    cachedPathVar = NULL;
+}
+
+/**
+ * Process a 'hash' command.
+ * 'hash' lists every remembered command along with how many times it was used,
+ * 'hash -r' forgets every command, and 'hash name...' remembers the given commands.
+ * @param cmd The 'hash' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processHash(char *cmd[], StdFds fds) {
+    if (cmd[1] == NULL) { // List the cache
+        bool empty = true;
+        int i;
+        for (i = 0; i < NUM_BUCKETS; i++) {
+            CommandEntry *entry;
+            for (entry = buckets[i]; entry; entry = entry->next) {
+                if (empty) {
+                    dprintf(fds.out, "hits\tcommand\n");
+                    empty = false;
+                }
+                dprintf(fds.out, "%4lu\t%s\n", entry->hits, entry->path);
+            }
+        }
+        if (empty) {
+            dprintf(fds.out, "hash: hash table empty\n");
+        }
+        return EXIT_SUCCESS;
+    }
+    
+    if (strcmp(cmd[1], "-r") == 0) { // Forget everything
+        clearCommandCache();
+        return EXIT_SUCCESS;
+    }
+    
+    int status = EXIT_SUCCESS;
+    int i;
+    for (i = 1; cmd[i]; i++) { // Remember each command given
+        forgetCommand(cmd[i]);
+        if (resolveCommand(cmd[i]) == NULL) {
+            dprintf(fds.err, "hash: %s: not found\n", cmd[i]);
+            status = EXIT_FAILURE;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,62 @@
+#ifndef CommandCache_h
+#define CommandCache_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "Builtin.h"
+
+/**
+ * A command whose location along $PATH has already been found.
+ */
+typedef struct commandEntry {
+    char *name, *path;
+    unsigned long hits;
+    struct commandEntry *next;
+} CommandEntry;
+
+/**
+ * Find the executable that a command name refers to, searching $PATH only if it hasn't been found before.
+ * Names containing a '/' are paths already, and are returned as-is.
+ * The cache is emptied whenever $PATH changes.
+ * @param name The name of the command.
+ * @return The path of the executable, or NULL if no executable by that name is on $PATH.
+ */
+const char *resolveCommand(const char *name);
+
+/**
+ * Search every directory of $PATH for an executable, without using the cache.
+ * @param name The name of the command.
+ * @param path Filled with the path of the executable, if one is found.
+ * @return Whether or not an executable was found.
+ */
+bool searchPath(const char *name, char path[PATH_MAX]);
+
+/**
+ * Drop a command from the cache, so that its next use searches $PATH again.
+ * This is done when executing the remembered path fails because it no longer exists.
+ * @param name The name of the command.
+ */
+void forgetCommand(const char *name);
+
+/**
+ * Drop every command from the cache.
+ */
+void clearCommandCache(void);
+
+/**
+ * Process a 'hash' command.
+ * 'hash' lists every remembered command along with how many times it was used,
+ * 'hash -r' forgets every command, and 'hash name...' remembers the given commands.
+ * @param cmd The 'hash' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processHash(char *cmd[], StdFds fds);
+
+#endif /* CommandCache_h */
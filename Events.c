@@ -0,0 +1,210 @@
+#include "Events.h"
+#include "Job.h"
+#include "Stats.h"
+
+#include <fcntl.h>
+#include <time.h>
+#include <sys/select.h>
+#ifdef __linux__
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#endif
+
+static int epollFd = -1; // -1 until the event loop has started, and in copies of the shell that left it
+static int signalFd = -1;
+static int timerFd = -1;
+static bool timerArmed = false;
+
+/**
+ * Start waiting for events through a single epoll instance: a signalfd for SIGCHLD and SIGINT, which are blocked from
+ * now on instead of being handled, a timerfd for the deadlines of jobs, and whatever input is being waited for.
+ * Until this is called (and on systems without epoll), waitForEvents() lets the SIGCHLD handler do the reaping.
+ * @return 0 if success, -1 otherwise.
+ */
+int startEventLoop(void) {
+#ifdef __linux__
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGCHLD);
+    sigaddset(&signals, SIGINT);
+    sigprocmask(SIG_BLOCK, &signals, NULL); // Only ever read from the signalfd, never delivered
+    
+    struct epoll_event watched = { EPOLLIN };
+    if ((epollFd = epoll_create1(EPOLL_CLOEXEC)) == -1 ||
+        (signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC)) == -1 ||
+        (timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1 ||
+        (watched.data.fd = signalFd, epoll_ctl(epollFd, EPOLL_CTL_ADD, signalFd, &watched)) == -1 ||
+        (watched.data.fd = timerFd, epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &watched)) == -1) {
+        leaveEventLoop();
+        sigprocmask(SIG_UNBLOCK, &signals, NULL);
+        return -1;
+    }
+    reapChildren(); // Any child that finished before SIGCHLD was blocked
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/**
+ * Stop using the shell's event loop, in a forked copy of the shell whose signals have been reset.
+ * The copy goes back to reaping its own children with the SIGCHLD handler.
+ */
+void leaveEventLoop(void) {
+    int *fds[] = { &epollFd, &signalFd, &timerFd };
+    int i;
+    for (i = 0; i < 3; i++) {
+        if (*fds[i] != -1) {
+            close(*fds[i]);
+            *fds[i] = -1;
+        }
+    }
+    timerArmed = false;
+}
+
+/**
+ * Wait the way the shell did before it had an event loop: sleep until a signal is handled, input arrives,
+ * or the next deadline passes. The SIGCHLD handler does the reaping.
+ * @param inputFd A descriptor to wait for input on, or -1 for none.
+ * @return The events that happened, as EventKind flags.
+ */
+static int waitForSignals(int inputFd) {
+    sigset_t waiting;
+    sigprocmask(SIG_BLOCK, NULL, &waiting);
+    sigdelset(&waiting, SIGCHLD);
+    
+    struct timespec deadline, now, timeout, *limit = NULL;
+    if (nextJobDeadline(&deadline)) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double remaining = secondsBetween(&now, &deadline);
+        if (remaining < 0) {
+            remaining = 0;
+        }
+        timeout.tv_sec = (time_t)remaining;
+        timeout.tv_nsec = (long)((remaining - timeout.tv_sec) * 1e9);
+        limit = &timeout;
+    }
+    fd_set readable;
+    FD_ZERO(&readable);
+    if (inputFd != -1) {
+        FD_SET(inputFd, &readable);
+    }
+    int ready = pselect(inputFd + 1, &readable, NULL, NULL, limit, &waiting);
+    int events = 0;
+    if (ready == -1 && errno == EINTR) {
+        events |= kEventChild; // Most likely; either way, the handler has run
+    } else if (ready > 0) {
+        events |= kEventInput;
+    }
+    if (enforceJobDeadlines()) {
+        events |= kEventDeadline;
+    }
+    return events;
+}
+
+#ifdef __linux__
+/**
+ * Arm the timer for the earliest deadline of any job, or disarm it if no job has one.
+ */
+static void armDeadlineTimer(void) {
+    struct itimerspec timer;
+    memset(&timer, 0, sizeof(timer));
+    bool armed = nextJobDeadline(&timer.it_value);
+    if (armed || timerArmed) { // Left alone while there are no deadlines at all
+        timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &timer, NULL);
+        timerArmed = armed;
+    }
+}
+
+/**
+ * Read every signal waiting on the signalfd.
+ * @return The events the signals stand for, as EventKind flags.
+ */
+static int readSignals(void) {
+    struct signalfd_siginfo info[16];
+    int events = 0;
+    ssize_t numRead;
+    while ((numRead = read(signalFd, info, sizeof(info))) > 0) {
+        int i;
+        for (i = 0; i < numRead / (ssize_t)sizeof(info[0]); i++) {
+            events |= info[i].ssi_signo == SIGINT ? kEventInterrupt : kEventChild;
+        }
+    }
+    return events;
+}
+#endif
+
+/**
+ * Wait until something happens: a child changes state, ^C is pressed, input arrives, or a job's deadline passes.
+ * Children that changed state have been reaped, and jobs whose deadline passed signalled, by the time this returns.
+ * SIGCHLD must be blocked by the caller, so that a child can't change state between checking and waiting.
+ * @param inputFd A descriptor to wait for input on, or -1 for none.
+ * @return The events that happened, as EventKind flags.
+ */
+int waitForEvents(int inputFd) {
+#ifdef __linux__
+    if (epollFd == -1) {
+        return waitForSignals(inputFd);
+    }
+    armDeadlineTimer();
+    struct epoll_event input = { EPOLLIN, { .fd = inputFd } };
+    if (inputFd != -1 && epoll_ctl(epollFd, EPOLL_CTL_ADD, inputFd, &input) == -1) {
+        return kEventInput; // Can't be watched (such as a regular file), so it never needs waiting for
+    }
+    struct epoll_event ready[3];
+    int numReady;
+    while ((numReady = epoll_wait(epollFd, ready, 3, -1)) == -1 && errno == EINTR) {
+    }
+    if (inputFd != -1) { // Only watched while it is being waited for, or every wait would wake up for it
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, inputFd, NULL);
+    }
+    
+    int events = 0, i;
+    for (i = 0; i < numReady; i++) {
+        if (ready[i].data.fd == signalFd) {
+            events |= readSignals();
+        } else if (ready[i].data.fd == timerFd) {
+            uint64_t expirations;
+            if (read(timerFd, &expirations, sizeof(expirations)) > 0) {
+                timerArmed = false;
+            }
+        } else {
+            events |= kEventInput;
+        }
+    }
+    if (events & kEventChild) {
+        reapChildren();
+    }
+    if (enforceJobDeadlines()) {
+        events |= kEventDeadline;
+    }
+    return events;
+#else
+    return waitForSignals(inputFd);
+#endif
+}
+
+/**
+ * Read a line of input. Input from a terminal is waited for through the event loop, so children are reaped
+ * (and jobs kept to their deadlines) in the meantime, and ^C abandons the wait.
+ * @param line The buffer to read into, grown (and allocated, if NULL) to fit the line.
+ * @param capacity The size of the buffer.
+ * @param input Where to read from.
+ * @return The length of the line, -1 at the end of the input, or -2 if ^C was pressed first.
+ */
+ssize_t readInputLine(char **line, size_t *capacity, FILE *input) {
+    if (isatty(fileno(input))) { // Anything else is read from straight away
+        sigset_t previous;
+        blockChildSignals(&previous);
+        int events;
+        while (!((events = waitForEvents(fileno(input))) & (kEventInput | kEventInterrupt))) {
+        }
+        restoreChildSignals(&previous);
+        if (events & kEventInterrupt) { // The terminal has thrown away whatever was typed
+            return -2;
+        }
+    }
+    return getline(line, capacity, input);
+}
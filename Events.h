@@ -0,0 +1,56 @@
+#ifndef Events_h
+#define Events_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+
+/**
+ * The things that waitForEvents() can wake up for, combined as flags.
+ */
+typedef enum eventKind {
+    kEventChild = 1, // A child changed state, and has been reaped
+    kEventInterrupt = 2, // ^C was pressed
+    kEventInput = 4, // Input is ready to be read
+    kEventDeadline = 8 // A job ran out of time, and has been signalled
+} EventKind;
+
+/**
+ * Start waiting for events through a single epoll instance: a signalfd for SIGCHLD and SIGINT, which are blocked from
+ * now on instead of being handled, a timerfd for the deadlines of jobs, and whatever input is being waited for.
+ * Until this is called (and on systems without epoll), waitForEvents() lets the SIGCHLD handler do the reaping.
+ * @return 0 if success, -1 otherwise.
+ */
+int startEventLoop(void);
+
+/**
+ * Stop using the shell's event loop, in a forked copy of the shell whose signals have been reset.
+ * The copy goes back to reaping its own children with the SIGCHLD handler.
+ */
+void leaveEventLoop(void);
+
+/**
+ * Wait until something happens: a child changes state, ^C is pressed, input arrives, or a job's deadline passes.
+ * Children that changed state have been reaped, and jobs whose deadline passed signalled, by the time this returns.
+ * SIGCHLD must be blocked by the caller, so that a child can't change state between checking and waiting.
+ * @param inputFd A descriptor to wait for input on, or -1 for none.
+ * @return The events that happened, as EventKind flags.
+ */
+int waitForEvents(int inputFd);
+
+/**
+ * Read a line of input. Input from a terminal is waited for through the event loop, so children are reaped
+ * (and jobs kept to their deadlines) in the meantime, and ^C abandons the wait.
+ * @param line The buffer to read into, grown (and allocated, if NULL) to fit the line.
+ * @param capacity The size of the buffer.
+ * @param input Where to read from.
+ * @return The length of the line, -1 at the end of the input, or -2 if ^C was pressed first.
+ */
+ssize_t readInputLine(char **line, size_t *capacity, FILE *input);
+
+#endif /* Events_h */
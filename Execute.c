@@ -1,264 +1,1296 @@
 #include "Execute.h"
+#include "Parallel.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "ParseCache.h"
+#include "Transfer.h"
+#include "Pipes.h"
+#include "Variables.h"
+#include "Glob.h"
+
+#include <ctype.h>
+#include <signal.h>
 
 #define O_RD_WR 0600
 #define O_RD 0200
 #define MAX_PIPES 100
 
 
+static int lastStatus = EXIT_SUCCESS; // The exit status of the most recent pipeline, for $?
+static bool interrupted = false; // Set when a pipeline is interrupted, to abandon the loops and lists around it
+static Node *subshellProgram = NULL; // The commands a forked copy of the shell runs
+static int subshellUnusedFd = -1; // A descriptor of the shell's that the copy must not hold open
+
 /**
- * Process a 'cd' command
- * @param cmd The 'cd' command to process
+ * Run the commands of a subshell, in a forked copy of the shell.
+ * @param cmd The commands' text, for tracing.
+ * @param fds The descriptors the commands should use as their standard input, output and error.
+ * @return The exit status of the last command.
  */
-void processChangeDirectory(char *cmd[]) {
-    const char *homeDir = getenv("HOME");
-    if (homeDir == NULL) {
-        perror("Unable to access the HOME env variable.\n\r");
-        exit(EXIT_FAILURE);
+static int runSubshell(char *cmd[], StdFds fds) {
+    clearJobs(); // The shell's jobs are not this copy's children
+    disableJobControl(); // Every command belongs to the job the copy was started as
+    if (subshellUnusedFd != -1) {
+        close(subshellUnusedFd);
     }
+    int sources[3] = { fds.in, fds.out, fds.err }, i;
+    for (i = 0; i < 3; i++) {
+        if (sources[i] != i && dup2(sources[i], i) == -1) {
+            perror("Unable to duplicate a file descriptor.\n\r");
+            return EXIT_FAILURE;
+        }
+    }
+    for (i = 0; i < 3; i++) {
+        if (sources[i] > STDERR_FILENO) {
+            close(sources[i]);
+        }
+    }
+    return executeNode(subshellProgram);
+}
+
+/**
+ * Run parsed commands in a forked copy of the shell, as a job of its own in the shell's process group.
+ * @param program The commands to run.
+ * @param text The commands' text, which describes the job.
+ * @param fds The descriptors the commands should use as their standard input, output and error.
+ * @param unusedFd A descriptor of the shell's that the copy must not hold open, such as the end of a pipe it reads, or -1.
+ * @return The job, which the caller waits for and removes.
+ */
+Job *startSubshell(Node *program, char *text, StdFds fds, int unusedFd) {
+    // The child may not be reaped before it has been recorded in the job
+    sigset_t previous;
+    blockChildSignals(&previous);
+    Job *job = addJob(1, text);
+    job->pgid = getpgrp();
+    clock_gettime(CLOCK_MONOTONIC, &job->processes[0].started);
+    fflush(stdout); // The copy must not inherit (and later flush) anything still buffered
+    subshellProgram = program;
+    subshellUnusedFd = unusedFd;
+    char *argv[] = { text, NULL };
+    JobProcess *process = &job->processes[0];
+    if ((process->pid = forkBuiltin(runSubshell, argv, fds, -1)) == -1) {
+        process->state = kJobDone;
+        process->exitStatus = EXIT_FAILURE;
+        process->finished = process->started;
+    }
+    restoreChildSignals(&previous);
+    return job;
+}
+
+/**
+ * Run a command substitution in a forked copy of the shell, capturing its standard output over a pipe.
+ * The output is read as it is produced, into a buffer that grows as needed up to the system's limit on the size
+ * of a command's arguments; anything beyond that is cut off. Trailing newlines are removed.
+ * The command is parsed through the parse cache, so a substitution within a loop is only parsed once.
+ * @param text The command's text.
+ * @param length The number of characters in the text.
+ * @param arena Where the output is allocated.
+ * @return The command's output.
+ */
+static const char *substituteCommand(const char *text, size_t length, Arena *arena) {
+    int error;
+    ParsedLine *parsed = acquireParsedLine(text, length, &error);
+    if (parsed == NULL) {
+        fprintf(stderr, "Syntax error in command substitution: %s.\n", describeParseError(error));
+        lastStatus = 2;
+        return "";
+    }
+    int fd[2];
+    if (openPipe(fd) == -1) { // Such as when out of descriptors, which fails only this substitution
+        perror("Unable to create a pipe.\n\r");
+        releaseParsedLine(parsed);
+        lastStatus = EXIT_FAILURE;
+        return "";
+    }
+    
+    StdFds fds = { STDIN_FILENO, fd[1], STDERR_FILENO };
+    Job *job = startSubshell(parsed->program, parsed->text, fds, fd[0]);
+    close(fd[1]);
     
-    if (cmd[1] != NULL) { // If there's a directory to change to
-        if (cmd[1][0] == '\'' || cmd[1][0] == '"') {
-            char *fileName = &cmd[1][1];
-            int i;
-            for (i = 2; cmd[i] != NULL; i++) {
-                strcat(fileName, " ");;
-                strcat(fileName, cmd[i]);
+    long maxLength = sysconf(_SC_ARG_MAX);
+    size_t capacity = 4096, used = 0;
+    char *output = malloc(capacity);
+    if (maxLength <= 0) {
+        maxLength = 2 * 1024 * 1024;
+    }
+    while (output != NULL) {
+        if (used == capacity) {
+            if (capacity >= (size_t)maxLength) {
+                fprintf(stderr, "Command substitution output is longer than %ld bytes, and was cut off.\n", maxLength);
+                break;
             }
-            chdir(fileName);
-            return;
+            char *grown = realloc(output, capacity * 2);
+            if (grown == NULL) { // What was read so far is kept, as if it had been cut off
+                perror("Unable to allocate memory.\n\r");
+                break;
+            }
+            output = grown;
+            capacity *= 2;
+            continue;
         }
-        char *fileName = &cmd[1][0];
-        chdir(fileName);
-    } else {
-        chdir(homeDir); // If just 'cd', go to ~
+        ssize_t numRead = read(fd[0], &output[used], capacity - used);
+        if (numRead == -1 && errno == EINTR) {
+            continue;
+        } else if (numRead <= 0) {
+            break;
+        }
+        used += numRead;
+    }
+    if (output == NULL) {
+        perror("Unable to allocate memory.\n\r");
     }
+    close(fd[0]); // Anything still writing gets SIGPIPE rather than blocking forever
+    
+    lastStatus = waitForJob(job, false);
+    if (jobState(job) == kJobDone) {
+        removeJob(job);
+    }
+    releaseParsedLine(parsed);
+    if (output == NULL) {
+        lastStatus = EXIT_FAILURE;
+        return "";
+    }
+    while (used > 0 && output[used - 1] == '\n') {
+        used--;
+    }
+    char *value = arenaStrndup(arena, output, used);
+    free(output);
+    return value;
 }
 
 /**
- * Process the echo command separately, to only print what follows it.
- * @param cmd The command to process
+ * Look up the value of an expansion within a word, running the command if it is a command substitution.
+ * @param marker The expansion's marker, which is followed by the variable's name (or the command) and EXPAND_END.
+ * @param value Set to the variable's value, or "" if it is unset.
+ * @param status Where the value of $? is read from, once any command substitution before it has run.
+ * @param arena Where values that are not variables are allocated.
+ * @return The character following the expansion.
  */
-void processEcho(char*cmd[]) {
+static const char *lookupExpansion(const char *marker, const char **value, const int *status, Arena *arena) {
+    const char *name = marker + 1, *end = strchr(name, EXPAND_END);
+    if (*marker == SUBSTITUTE_UNQUOTED || *marker == SUBSTITUTE_QUOTED) {
+        *value = substituteCommand(name, end - name, arena);
+        return end + 1;
+    }
+    char variable[256], number[16];
+    snprintf(variable, sizeof(variable), "%.*s", (int)(end - name), name);
+    if (strcmp(variable, "?") == 0 || strcmp(variable, "$") == 0) {
+        snprintf(number, sizeof(number), "%d", variable[0] == '?' ? *status : (int)getpid());
+        *value = arenaStrndup(arena, number, strlen(number));
+    } else if ((*value = getVariable(variable)) == NULL) {
+        *value = "";
+    }
+    return end + 1;
+}
+
+/**
+ * Append a word to a list, or instead every path it matches if it holds a wildcard that matches any.
+ * @param word The word, whose unquoted *, ? and [ are each preceded by GLOB_MARKER.
+ * @param words The list.
+ * @param numWords The number of words in the list.
+ * @param capacity The number of words the list has room for.
+ * @param arena Where the words and the list are allocated.
+ */
+static void appendMatches(char *word, char ***words, int *numWords, int *capacity, Arena *arena) {
+    if (strchr(word, GLOB_MARKER) == NULL) {
+        appendWord(words, numWords, capacity, word, arena);
+    } else if (!hasWildcard(word) || expandGlob(word, words, numWords, capacity, arena) == 0) {
+        appendWord(words, numWords, capacity, removeGlobMarkers(word, arena), arena);
+    }
+}
+
+/**
+ * Expand every variable in a word, appending the resulting words to a list.
+ * @param word The word, which contains at least one expansion.
+ * @param split Whether or not unquoted expansions are split into separate words at whitespace, and each word then
+ * replaced by the paths it matches. A word that expands to nothing at all is then dropped, unless part of it was quoted.
+ * Otherwise, the word's wildcards are left as ordinary characters.
+ * @param words The list.
+ * @param numWords The number of words in the list.
+ * @param capacity The number of words the list has room for.
+ * @param status Where the value of $? is read from.
+ * @param arena Where the words and the list are allocated.
+ */
+static void expandInto(const char *word, bool split, char ***words, int *numWords, int *capacity, const int *status,
+                       Arena *arena) {
+    // Every expansion is looked up just once, first, as a command substitution runs a command.
+    // Measuring them also lets the words be written into a single allocation.
+    const char *c;
+    int numExpansions = 0, i = 0;
+    for (c = word; *c; c++) {
+        numExpansions += strchr(EXPAND_MARKERS, *c) != NULL;
+    }
+    const char **values = arenaAlloc(arena, numExpansions * sizeof(char *));
+    size_t length = 0;
+    for (c = word; *c; ) {
+        if (strchr(EXPAND_MARKERS, *c)) {
+            c = lookupExpansion(c, &values[i], status, arena);
+            length += strlen(values[i++]);
+        } else {
+            c++;
+            length++;
+        }
+    }
+    
+    char *out = arenaAlloc(arena, 2 * length + 2), *field = out;
+    bool started = !split; // Whether or not there is a word to finish
+    for (c = word, i = 0; *c; ) {
+        if (strchr(EXPAND_MARKERS, *c)) {
+            bool splitting = split && (*c == EXPAND_UNQUOTED || *c == SUBSTITUTE_UNQUOTED);
+            started |= !splitting;
+            const char *value;
+            for (value = values[i++]; *value; value++) {
+                if (splitting && strchr(" \t\n", *value)) {
+                    if (started) {
+                        *out++ = '\0';
+                        appendMatches(field, words, numWords, capacity, arena);
+                        field = out;
+                        started = false;
+                    }
+                } else {
+                    if (splitting && strchr("*?[", *value)) { // Wildcards in an unquoted value are expanded too
+                        *out++ = GLOB_MARKER;
+                    }
+                    *out++ = *value;
+                    started = true;
+                }
+            }
+            c = strchr(c, EXPAND_END) + 1;
+        } else if (*c == GLOB_MARKER && !split) {
+            c++;
+        } else {
+            *out++ = *c++;
+            started = true;
+        }
+    }
+    if (started) {
+        *out = '\0';
+        appendMatches(field, words, numWords, capacity, arena);
+    }
+}
+
+/**
+ * Expand every variable and wildcard in a list of words, given the value of $?.
+ * @param words The words, followed by a terminating NULL.
+ * @param status Where the value of $? is read from.
+ * @param arena Where the expanded words are allocated.
+ * @return The expanded words, followed by a terminating NULL: the words themselves, if none of them needed expanding.
+ */
+static char **expandWordsAfter(char *words[], const int *status, Arena *arena) {
     int i;
-    for (i = 1; cmd[i]; i++) {
-        printf("%s ", cmd[i]);
+    for (i = 0; words[i] && strpbrk(words[i], WORD_MARKERS) == NULL; i++) {
+        continue;
     }
-    printf("\n");
-    fflush(stdout);
+    if (words[i] == NULL) {
+        return words;
+    }
+    char **expanded = NULL;
+    int numWords = 0, capacity = 0;
+    appendWord(&expanded, &numWords, &capacity, NULL, arena); // Make sure the list exists, even if it ends up empty
+    numWords = 0;
+    for (i = 0; words[i]; i++) {
+        if (strpbrk(words[i], EXPAND_MARKERS) == NULL) {
+            appendMatches(words[i], &expanded, &numWords, &capacity, arena);
+        } else {
+            expandInto(words[i], true, &expanded, &numWords, &capacity, status, arena);
+        }
+    }
+    return expanded;
+}
+
+/**
+ * Expand every variable and wildcard in a list of words. Unquoted expansions are split into separate words at
+ * whitespace, a word that expands to nothing at all is dropped, and a word holding a wildcard is replaced by the paths
+ * it matches (or kept as it is, if it matches none).
+ * @param words The words, followed by a terminating NULL.
+ * @param arena Where the expanded words are allocated.
+ * @return The expanded words, followed by a terminating NULL: the words themselves, if none of them needed expanding.
+ */
+char **expandWords(char *words[], Arena *arena) {
+    return expandWordsAfter(words, &lastStatus, arena);
+}
+
+/**
+ * Expand every variable in a single word, without splitting it, given the value of $?.
+ * @param word The word.
+ * @param status Where the value of $? is read from.
+ * @param arena Where the expanded word is allocated.
+ * @return The expanded word: the word itself, if it needed no expanding.
+ */
+static char *expandWordAfter(char *word, const int *status, Arena *arena) {
+    if (word == NULL || strpbrk(word, WORD_MARKERS) == NULL) {
+        return word;
+    } else if (strpbrk(word, EXPAND_MARKERS) == NULL) { // Wildcards are not expanded in a single word
+        return removeGlobMarkers(word, arena);
+    }
+    char **expanded = NULL;
+    int numWords = 0, capacity = 0;
+    expandInto(word, false, &expanded, &numWords, &capacity, status, arena);
+    return expanded[0];
+}
+
+/**
+ * Expand every variable in a single word, without splitting it, such as the file of a redirection.
+ * @param word The word.
+ * @param arena Where the expanded word is allocated.
+ * @return The expanded word: the word itself, if it needed no expanding.
+ */
+char *expandWord(char *word, Arena *arena) {
+    return expandWordAfter(word, &lastStatus, arena);
+}
+
+/**
+ * Expand every variable in the arguments and redirections of every stage of a pipeline.
+ * @param stages The stages of the pipeline, in order.
+ * @param numStages The number of stages in the pipeline.
+ * @param status Where the value of $? is read from.
+ * @param arena Where the expanded words are allocated.
+ * @return 0 if success, -1 if a stage no longer has a command once expanded.
+ */
+static int expandStagesFrom(Stage stages[], int numStages, const int *status, Arena *arena) {
+    int i, j, result = 0;
+    for (i = 0; i < numStages; i++) {
+        stages[i].argv = expandWordsAfter(stages[i].argv, status, arena);
+        stages[i].inputFile = expandWordAfter(stages[i].inputFile, status, arena);
+        stages[i].inputText = expandWordAfter(stages[i].inputText, status, arena);
+        for (j = 0; j < stages[i].numRedirections; j++) {
+            stages[i].redirections[j].file = expandWordAfter(stages[i].redirections[j].file, status, arena);
+        }
+        if (stages[i].argv[0] == NULL) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+/**
+ * Expand every variable in the arguments and redirections of every stage of a pipeline.
+ * @param stages The stages of the pipeline, in order.
+ * @param numStages The number of stages in the pipeline.
+ * @param arena Where the expanded words are allocated.
+ * @return 0 if success, -1 if a stage no longer has a command once expanded.
+ */
+int expandStages(Stage stages[], int numStages, Arena *arena) {
+    return expandStagesFrom(stages, numStages, &lastStatus, arena);
+}
+
+/**
+ * Expand every variable in the arguments and redirections of every stage of a pipeline, given the value of $?,
+ * without touching the shell's own state, so that several threads can expand at once.
+ * Command substitutions must not be among the expansions, as running one needs the shell.
+ * @param stages The stages of the pipeline, in order.
+ * @param numStages The number of stages in the pipeline.
+ * @param status The value of $?.
+ * @param arena Where the expanded words are allocated.
+ * @return 0 if success, -1 if a stage no longer has a command once expanded.
+ */
+int expandStagesAfter(Stage stages[], int numStages, int status, Arena *arena) {
+    return expandStagesFrom(stages, numStages, &status, arena);
+}
+
+/**
+ * @param word A word.
+ * @return The length of the variable name the word assigns to, or 0 if the word is not of the form name=value.
+ */
+size_t assignedNameLength(const char *word) {
+    if (!isalpha((unsigned char)word[0]) && word[0] != '_') {
+        return 0;
+    }
+    size_t length = strspn(word, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_");
+    return word[length] == '=' ? length : 0;
+}
+
+/**
+ * Set shell variables, if a stage consists of nothing but assignments (name=value), which are expanded but never split.
+ * @param stage The stage.
+ * @param arena Where the expanded values are allocated.
+ * @return Whether or not the stage was a list of assignments.
+ */
+static bool processAssignments(Stage *stage, Arena *arena) {
+    int i;
+    for (i = 0; stage->argv[i]; i++) {
+        if (assignedNameLength(stage->argv[i]) == 0) {
+            return false;
+        }
+    }
+    for (i = 0; stage->argv[i]; i++) {
+        size_t length = assignedNameLength(stage->argv[i]);
+        char *name = arenaStrndup(arena, stage->argv[i], length);
+        if (setVariable(name, expandWord(&stage->argv[i][length + 1], arena)) == -1) {
+            perror(name);
+        }
+    }
+    return true;
 }
 
 /**
  * Used to process a single command
  * @param cmd The command to process, including any arguments it may have.
+ * @return The exit status of the command.
  */
-void processSingleCommand(char *cmd[]) {
-    int status;
-    pid_t pid;
-    switch (pid = fork()) {
-        case -1:
-            perror("Could not fork a child process.\n\r");
+int processSingleCommand(char *cmd[]) {
+    Stage stage = { .argv = cmd };
+    return executePipeline(&stage, 1, false, 0);
+}
+
+/**
+ * Open whatever a stage reads its input from, in place of its standard input.
+ * @param stage A stage with an input file, or a here-document or here-string.
+ * @return A descriptor for the input, or -1 if it could not be opened.
+ */
+static int openStageInput(Stage *stage) {
+    return stage->inputText ? handleInputText(stage->inputText) : handleInputRedirection(stage->inputFile);
+}
+
+/**
+ * Close the descriptors opened for a stage's redirections.
+ * @param opened The descriptors opened for the stage's input, output and error output, or -1 for each that was not.
+ */
+static void closeRedirections(int opened[3]) {
+    int i;
+    for (i = 0; i < 3; i++) {
+        if (opened[i] != -1 && close(opened[i]) == -1) {
+            perror("Unable to close a file descriptor.\n\r");
             exit(EXIT_FAILURE);
-            return;
-            
-        case 0: // Child
-            if (execvp(cmd[0], cmd) == -1) { // Execute the command w/ any arguments it has
-                perror(*cmd);
-                exit(EXIT_FAILURE);
+        }
+        opened[i] = -1;
+    }
+}
+
+/**
+ * Open every redirection of a stage, in place of the descriptors it would otherwise use.
+ * Output redirections are applied in the order they were typed, so a duplicate (2>&1 or >&2) copies
+ * wherever the other descriptor points at that moment. A file replaced by a later redirection is closed straight away.
+ * @param stage The stage.
+ * @param fds The stage's descriptors, updated with the ones it is redirected to.
+ * @param opened Set to the descriptors opened for the stage that are still in use, or -1 for each unused entry.
+ * @return 0 if success, -1 if a redirection could not be opened, in which case none are left open.
+ */
+static int openStageRedirections(Stage *stage, StdFds *fds, int opened[3]) {
+    opened[0] = opened[1] = opened[2] = -1;
+    if ((stage->inputFile || stage->inputText) && (opened[0] = openStageInput(stage)) == -1) {
+        return -1;
+    }
+    fds->in = opened[0] != -1 ? opened[0] : fds->in;
+    
+    int i, j;
+    for (i = 0; i < stage->numRedirections; i++) {
+        Redirection *redirection = &stage->redirections[i];
+        int *target = redirection->fd == STDOUT_FILENO ? &fds->out : &fds->err;
+        int *other = redirection->fd == STDOUT_FILENO ? &fds->err : &fds->out;
+        int fd = *other;
+        if (redirection->type != kRedirectDuplicate &&
+            (fd = handleOutputRedirection(redirection->file, redirection->type == kRedirectAppend)) == -1) {
+            closeRedirections(opened);
+            return -1;
+        }
+        int replaced = *target;
+        *target = fd;
+        for (j = 0; j < 3; j++) { // At most three are ever in use: one each for input, output and error output
+            if (opened[j] == replaced && replaced != *other && replaced != fds->in) {
+                close(replaced);
+                opened[j] = -1;
             }
-            return;
-            
-        default: // Parent
-            if (waitpid(pid,&status,0) == -1) { // Wait for the child to terminate
-                if (errno != EINTR) { // a signal interrupt is expected
-                    perror("Unable to wait.\n\r");
-                    exit(EXIT_FAILURE);
-                }
+        }
+        for (j = 0; j < 3 && redirection->type != kRedirectDuplicate; j++) {
+            if (opened[j] == -1) {
+                opened[j] = fd;
+                break;
             }
-            return;
+        }
     }
+    return 0;
 }
 
 /**
- * This function checks to see if the cmd matches any built-in commands
- * and simply runs them if it finds any matches.
+ * This function checks to see if the stage's command matches any built-in commands
+ * and simply runs them within the shell if it finds any matches.
+ * The stage's redirections are opened and handed to the built-in command, leaving the shell's own descriptors alone.
+ * @param stage The command to process, along with the files its input and output are redirected to.
+ * @param status Set to the exit status of the built-in command, if one was run.
+ * @param timed Whether or not to report the time and resources the built-in command used.
  * @return Whether or not the command matched a built-in command.
  */
-bool processBuiltInCmd(char *cmd[LINE_MAX]) {
-    if (strcmp(cmd[0], "exit\0") == 0) {      // Handle exit
-        exit(EXIT_SUCCESS);
-        return true;
-    } else if (strcmp(cmd[0], "cd\0") == 0) { // Handle cd
-        processChangeDirectory(cmd);
+bool processBuiltInCmd(Stage *stage, int *status, bool timed) {
+    bool readsTerminal = !stage->inputFile && !stage->inputText && isatty(STDIN_FILENO);
+    const Builtin *builtin = findBuiltin(stage->argv, readsTerminal);
+    if (builtin == NULL) {
+        return false;
+    }
+    
+    StdFds fds = kShellFds;
+    int opened[3];
+    *status = EXIT_FAILURE;
+    if (openStageRedirections(stage, &fds, opened) == -1) {
         return true;
     }
-    return false;
+    fflush(stdout); // Anything the shell has printed comes before what the command writes
+    struct rusage before, after, used;
+    struct timespec started, finished;
+    getrusage(RUSAGE_SELF, &before);
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    *status = builtin->run(stage->argv, fds);
+    if (timed) { // The shell's own usage while the command ran
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+        getrusage(RUSAGE_SELF, &after);
+        usageBetween(&before, &after, &used);
+        UsageTotals usage = {0};
+        addUsage(&usage, secondsBetween(&started, &finished), &used);
+        char *description = describePipeline(stage, 1);
+        printUsageHeader(STDERR_FILENO);
+        printUsage(STDERR_FILENO, &usage, description);
+        free(description);
+    }
+    closeRedirections(opened);
+    return true;
 }
 
 /**
- * This function takes care of any input redirection that may occur.
- * Either sendingFile or sendingCmd must be passed (Exclusive or)
+ * This function takes care of any input redirection that may occur,
+ * by opening the file that a command's input is redirected from.
+ * The descriptor is closed on exec, so only the command it is handed to will read from it.
  *
  * @param sendingFile The file to be read from.
+ * @return A descriptor open on the file, or -1 if it could not be opened.
  */
-void handleInputRedirection(char sendingFile[]) {
-    if (sendingFile) { // If input is coming from a file
-        FILE *readFile;
-        if ((readFile = fopen(sendingFile, "r")) == NULL) { // Open the file for reading
-            perror(sendingFile);
-            exit(EXIT_FAILURE);
-        }
-        int fileNum;
-        if ((fileNum = fileno(readFile)) == -1) {
-            perror(sendingFile);
-            exit(EXIT_FAILURE);
+int handleInputRedirection(char sendingFile[]) {
+    double start = tracingEnabled() ? traceClock() : 0;
+    int fileNum;
+    if ((fileNum = open(sendingFile, O_RDONLY | O_CLOEXEC)) == -1) {
+        perror(sendingFile);
+    }
+    traceSpan("redirect", "open <", start, tracingEnabled() ? traceClock() : 0, 0, sendingFile);
+    return fileNum;
+}
+
+/**
+ * Hand a here-document or here-string to a command as its input, without it ever touching the filesystem.
+ * Text that fits in an empty pipe is written straight into one, and anything larger into an anonymous memory file.
+ * @param text The text to be read.
+ * @return A descriptor, closed on exec, that reads the text from its start, or -1 if the text could not be stored.
+ */
+int handleInputText(const char text[]) {
+    double start = tracingEnabled() ? traceClock() : 0;
+    size_t length = strlen(text);
+    int fileNum = -1;
+    if (length <= PIPE_BUF) { // Never blocks, since even the smallest pipe holds PIPE_BUF bytes
+        int fd[2];
+        if (openPipe(fd) == 0) {
+            if (writeAll(fd[1], text, length) == 0) {
+                fileNum = fd[0];
+            } else {
+                close(fd[0]);
+            }
+            close(fd[1]);
         }
-        if (dup2(fileNum, STDIN_FILENO) == -1) { // Have input come from the file to be read
-            perror("Unable to perform duplicate a process.\n\r");
-            exit(EXIT_FAILURE);
-        }
-        if (fclose(readFile) == -1) {
-            perror("Unable to close a file descriptor.\n\r");
-            exit(EXIT_FAILURE);
+    } else if ((fileNum = openMemoryFile("nsh-here-document")) != -1) {
+        if (writeAll(fileNum, text, length) == -1 || lseek(fileNum, 0, SEEK_SET) == -1) {
+            close(fileNum);
+            fileNum = -1;
         }
     }
+    if (fileNum == -1) {
+        perror("Unable to store a here-document");
+    }
+    traceSpan("redirect", "open <<", start, tracingEnabled() ? traceClock() : 0, 0, "");
+    return fileNum;
 }
 
 /**
- * This function takes care of any output redirection that may occur.
+ * This function takes care of any output redirection that may occur,
+ * by creating (or truncating) the file that a command's output is redirected to.
  * @param receivingFile the file that should outputted to.
+ * @param append Whether to append to the file rather than truncate it.
+ * @return A descriptor open on the file, or -1 if it could not be opened.
  */
-void handleOutputRedirection(char receivingFile[]) {
-    // If output is being redirected to a following token
-    if (receivingFile) {
-        FILE *writeFile;
-        if ((writeFile = fopen(receivingFile, "w+")) == NULL) {
-            perror(receivingFile);
-            exit(EXIT_FAILURE);
+int handleOutputRedirection(char receivingFile[], bool append) {
+    double start = tracingEnabled() ? traceClock() : 0;
+    int fileNum;
+    if ((fileNum = open(receivingFile, O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0666)) == -1) {
+        perror(receivingFile);
+    }
+    traceSpan("redirect", append ? "open >>" : "open >", start, tracingEnabled() ? traceClock() : 0, 0, receivingFile);
+    return fileNum;
+}
+
+/**
+ * Apply a redirection to a stage. An input redirection replaces any earlier one,
+ * while output redirections are added to the stage's list, after those before them.
+ * @param stage The stage. Its redirections must have room for two more entries.
+ * @param operator The redirection operator.
+ * @param word The word following the operator.
+ * @return The number of words the redirection takes after its operator: none for 2>&1 and >&2, and one otherwise.
+ */
+static int applyRedirection(Stage *stage, const char *operator, char *word) {
+    Redirection *added = &stage->redirections[stage->numRedirections];
+    if (isDuplicatingRedirection(operator)) {
+        *added = (Redirection){ kRedirectDuplicate, operator[0] == '2' ? STDERR_FILENO : STDOUT_FILENO, NULL };
+        stage->numRedirections++;
+        return 0;
+    }
+    RedirectionType type = strstr(operator, ">>") ? kRedirectAppend : kRedirectTruncate;
+    switch (operator[0]) {
+        case '<': // <<, <<- and <<< give the text itself
+            stage->inputText = operator[1] == '<' ? word : NULL;
+            stage->inputFile = operator[1] == '<' ? NULL : word;
+            break;
+            
+        case '2':
+            *added = (Redirection){ type, STDERR_FILENO, word };
+            stage->numRedirections++;
+            break;
+            
+        case '&': // The same as '> file 2>&1'
+            added[0] = (Redirection){ type, STDOUT_FILENO, word };
+            added[1] = (Redirection){ kRedirectDuplicate, STDERR_FILENO, NULL };
+            stage->numRedirections += 2;
+            break;
+            
+        default:
+            *added = (Redirection){ type, STDOUT_FILENO, word };
+            stage->numRedirections++;
+            break;
+    }
+    return 1;
+}
+
+/**
+ * Split a line of input into the stages of its pipeline, using pipes as deliminators.
+ * Redirection operators and the files following them are removed from each stage's arguments.
+ * @param input The structure representing a user's input into the shell.
+ * @param stages Filled with one entry per stage. Must have room for input->numPipes + 1 entries.
+ * @param argvStorage Backing storage for every stage's arguments. Must have room for input->numTokens + input->numPipes + 1 entries.
+ * @param redirectionStorage Backing storage for every stage's output redirections. Must have room for 2 * input->numRedirections entries.
+ * @return The number of stages found, or -1 if a stage is missing its command.
+ */
+int splitStages(LineInput *input, Stage stages[], char *argvStorage[], Redirection redirectionStorage[]) {
+    int numStages = 0, numArgs = 0, pipesSeen = 0, redirectionsSeen = 0;
+    Stage *stage = &stages[0];
+    memset(stage, 0, sizeof(Stage));
+    stage->argv = argvStorage;
+    stage->redirections = redirectionStorage;
+    
+    int i;
+    for (i = 0; i < input->numTokens && input->tokens[i]; i++) {
+        if (pipesSeen < input->numPipes && i == input->pipeIndices[pipesSeen]) { // End of this stage
+            pipesSeen++;
+            stage->argv[numArgs] = NULL;
+            if (stage->argv[0] == NULL) {
+                return -1;
+            }
+            argvStorage += numArgs + 1;
+            redirectionStorage += stage->numRedirections;
+            numArgs = 0;
+            stage = &stages[++numStages];
+            memset(stage, 0, sizeof(Stage));
+            stage->argv = argvStorage;
+            stage->redirections = redirectionStorage;
+        } else if (redirectionsSeen < input->numRedirections && i == input->redirectionIndices[redirectionsSeen]) {
+            redirectionsSeen++; // The operator, and then the file (or text) it redirects to or from
+            i += applyRedirection(stage, input->tokens[i], input->tokens[i + 1]);
+        } else {
+            stage->argv[numArgs++] = input->tokens[i];
         }
-        int fileNum;
-        if ((fileNum = fileno(writeFile)) == -1) {
-            perror(receivingFile);
-            exit(EXIT_FAILURE);
+    }
+    stage->argv[numArgs] = NULL;
+    if (stage->argv[0] == NULL) {
+        return -1;
+    }
+    return numStages + 1;
+}
+
+/**
+ * Split a line of input into the stages of its pipeline, allocating room for them.
+ * A parsed line may be executed many times (such as from a script), so the line's own arena is left alone.
+ * @param input The structure representing a user's input into the shell.
+ * @param numStages Set to the number of stages found, 0 if a stage is missing its command, or -1 if there was no memory.
+ * @return The stages, which the caller must free, or NULL if a stage is missing its command (which is reported)
+ * or there was no memory for them (which is left to the caller, with errno set).
+ */
+Stage *buildStages(LineInput *input, int *numStages) {
+    int maxStages = input->numPipes + 1, maxRedirections = 2 * input->numRedirections;
+    Stage *stages = malloc(maxStages * sizeof(Stage) + maxRedirections * sizeof(Redirection) +
+                           (input->numTokens + maxStages) * sizeof(char *));
+    if (stages == NULL) {
+        *numStages = -1;
+        return NULL;
+    }
+    Redirection *redirectionStorage = (Redirection *)&stages[maxStages];
+    char **argvStorage = (char **)&redirectionStorage[maxRedirections];
+    if ((*numStages = splitStages(input, stages, argvStorage, redirectionStorage)) == -1) {
+        fprintf(stderr, "Missing a command in the pipeline.\n");
+        free(stages);
+        *numStages = 0;
+        return NULL;
+    }
+    return stages;
+}
+
+/**
+ * Describe a pipeline the way it would be typed, for listing it as a job.
+ * @param stages The stages of the pipeline, in order.
+ * @param numStages The number of stages in the pipeline.
+ * @return The description, which the caller must free.
+ */
+char *describePipeline(Stage stages[], int numStages) {
+    size_t length = 1;
+    int i, j;
+    for (i = 0; i < numStages; i++) {
+        for (j = 0; stages[i].argv[j]; j++) {
+            length += strlen(stages[i].argv[j]) + 1;
         }
-        if (dup2(fileNum, STDOUT_FILENO) == -1) { // Connect output to the file to write to
-            perror("dup2() failed.\n\r");
-            exit(EXIT_FAILURE);
+        length += (stages[i].inputFile ? strlen(stages[i].inputFile) + 3 : 0) + 2;
+        for (j = 0; j < stages[i].numRedirections; j++) {
+            Redirection *redirection = &stages[i].redirections[j];
+            length += (redirection->file ? strlen(redirection->file) : 0) + 6;
         }
-        if (fclose(writeFile) == -1) {
-            perror(receivingFile);
-            exit(EXIT_FAILURE);
+    }
+    char *description = malloc(length);
+    if (description == NULL) {
+        perror("Unable to allocate memory.\n\r");
+        exit(EXIT_FAILURE);
+    }
+    
+    char *end = description;
+    for (i = 0; i < numStages; i++) {
+        if (i > 0) {
+            end += sprintf(end, "| ");
+        }
+        for (j = 0; stages[i].argv[j]; j++) {
+            end += sprintf(end, "%s ", stages[i].argv[j]);
+        }
+        if (stages[i].inputFile) {
+            end += sprintf(end, "< %s ", stages[i].inputFile);
+        }
+        for (j = 0; j < stages[i].numRedirections; j++) {
+            Redirection *redirection = &stages[i].redirections[j];
+            const char *descriptor = redirection->fd == STDERR_FILENO ? "2" : "";
+            if (redirection->type == kRedirectDuplicate) {
+                end += sprintf(end, "%s>&%d ", descriptor, redirection->fd == STDERR_FILENO ? 1 : 2);
+            } else {
+                end += sprintf(end, "%s%s %s ", descriptor, redirection->type == kRedirectAppend ? ">>" : ">",
+                               redirection->file);
+            }
         }
     }
+    if (end > description) {
+        end[-1] = '\0'; // Drop the trailing space
+    }
+    return description;
 }
 
+/**
+ * Check whether a redirection sends output (and only output) to a file.
+ * @param redirection The redirection to check.
+ * @return Whether or not the redirection is '> file' or '>> file'.
+ */
+static bool isOutputFile(const Redirection *redirection) {
+    return redirection->fd == STDOUT_FILENO && redirection->type != kRedirectDuplicate;
+}
 
-/*
- * Execute a line of input based on the user's input.
- * The general idea is to process the input segment by segment, using pipes as deliminators.
- *
- * @param lineInput The structure representing a user's input into the shell.
+/**
+ * Check whether a stage does nothing but pass data along.
+ * @param stage The stage to check.
+ * @param source Set to the file the stage reads, or NULL if it reads whatever it is given as input.
+ * @return Whether or not the stage is 'cat', 'cat file' or 'cat < file'.
  */
-void execute(LineInput *input) {
-    if (input->tokens[0] == NULL) {
-        return;
+static bool isPassthroughStage(Stage *stage, char **source) {
+    char **argv = stage->argv;
+    if (strcmp(argv[0], "cat") != 0 || stage->inputText || (argv[1] && (argv[2] || argv[1][0] == '-' || stage->inputFile))) {
+        return false;
+    } else if (stage->numRedirections > 1 || (stage->numRedirections == 1 && !isOutputFile(&stage->redirections[0]))) {
+        return false; // Its own errors go somewhere else
     }
-    // Check to see if the input corresponds to a built-in command, performing it if it does.
-    if (processBuiltInCmd(input->tokens)) {
-        return;
+    *source = argv[1] ? argv[1] : stage->inputFile;
+    return true;
+}
+
+/**
+ * Remove the stages of a pipeline that only pass data along ('cat', 'cat file' or 'cat < file'),
+ * by handing their input or output straight to the stage next to them.
+ * 'cat file | cmd' becomes 'cmd < file', 'a | cat | b' becomes 'a | b', and 'cmd | cat > file' becomes 'cmd > file',
+ * so the bytes are never copied and no process is started to copy them.
+ * @param stages The stages of the pipeline, in order. Updated in place.
+ * @param numStages The number of stages in the pipeline.
+ * @return The number of stages left.
+ */
+int elidePassthroughStages(Stage stages[], int numStages) {
+    int i = 0;
+    while (numStages > 1 && i < numStages) {
+        char *source;
+        if (!isPassthroughStage(&stages[i], &source)) {
+            i++;
+            continue;
+        }
+        if (source && access(source, R_OK) == -1) { // Left to 'cat' to report, while the rest of the pipeline still runs
+            i++;
+            continue;
+        }
+        if (stages[i].numRedirections == 0 && i < numStages - 1 && !stages[i + 1].inputFile && !stages[i + 1].inputText) {
+            stages[i + 1].inputFile = source; // The next stage reads what this one would have
+        } else if (source == NULL && stages[i].numRedirections == 1 && i > 0 && stages[i - 1].numRedirections == 0) {
+            stages[i - 1].redirections = stages[i].redirections; // The previous stage writes where this one would have
+            stages[i - 1].numRedirections = 1;
+        } else {
+            i++;
+            continue;
+        }
+        memmove(&stages[i], &stages[i + 1], (numStages - i - 1) * sizeof(Stage));
+        numStages--;
     }
-    // Process echo differently if it's detected
-    if (strcmp(input->tokens[0], "echo") == 0) {
-        processEcho(input->tokens);
-        return;
+    return numStages;
+}
+
+/**
+ * Work out where each stage of a pipeline runs: as its own prefixes ask, and on CPUs of its own
+ * when stages are placed automatically.
+ * @param stages The stages of the pipeline, in order.
+ * @param numStages The number of stages in the pipeline.
+ * @return The placement of each stage, to be freed by the caller, or NULL if no stage needs placing.
+ */
+static Placement *placePipeline(Stage stages[], int numStages) {
+    bool placed = getAutoPlacement() && numStages > 1;
+    int i;
+    for (i = 0; i < numStages && !placed; i++) {
+        placed = stages[i].placement != NULL;
     }
-    int numCmdsProcessed, tokenIndex = 0, inputFileDescriptor = 0;
-    for (numCmdsProcessed = 0; input->tokens[tokenIndex]; numCmdsProcessed++) {
-        char *tokensBeforePipe[1024];
-        // clear tokensBeforePipe
-        int i;
-        for (i = 0; i < 1024; i++) {
-            tokensBeforePipe[i] = NULL;
+    if (!placed) {
+        return NULL;
+    }
+    Placement *placements = calloc(numStages, sizeof(Placement));
+    if (placements == NULL) {
+        perror("Unable to allocate memory.\n\r");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < numStages; i++) {
+        if (stages[i].placement) {
+            placements[i] = *stages[i].placement;
         }
-        
-        bool redirectInput = false, redirectOutput = false;
-        // Determine the tokens that are in the line before the next pipe
-        int numTokensBeforePipe;
-        for (numTokensBeforePipe = 0; input->tokens[tokenIndex] != NULL && input->tokens[tokenIndex][0] != '|'; tokenIndex++, numTokensBeforePipe++) {
-            tokensBeforePipe[numTokensBeforePipe] = input->tokens[tokenIndex];
-            // Note if this series of tokens before the next pipe has redirection within it
-            if (tokenIndex == input->redirectedInputIndex) {
-                redirectInput = true;
-            } else if (tokenIndex == input->redirectedOutputIndex) {
-                redirectOutput = true;
-            }
+    }
+    placeStages(placements, numStages);
+    return placements;
+}
+
+/**
+ * Give up on the stages of a pipeline that have not been started yet, such as when the shell has run out of file descriptors.
+ * The stages that are already running see the end of their input, or SIGPIPE, and finish on their own.
+ * @param job The job running the pipeline.
+ * @param first The first stage that was not started.
+ * @param unusedFd The read end of the pipe from the last stage that was started, or -1 if there is none.
+ */
+static void failStages(Job *job, int first, int unusedFd) {
+    if (unusedFd != -1) {
+        close(unusedFd);
+    }
+    int i;
+    for (i = first; i < job->numProcesses; i++) {
+        JobProcess *process = &job->processes[i];
+        clock_gettime(CLOCK_MONOTONIC, &process->started);
+        process->pid = -1;
+        process->state = kJobDone;
+        process->exitStatus = EXIT_FAILURE;
+        process->finished = process->started;
+    }
+}
+
+/**
+ * Start every stage of a pipeline, connecting each stage's output to the next stage's input, without waiting for any of them.
+ * The stages are recorded as a job, so that they are reaped as soon as they finish.
+ * Stages that only pass data along are removed first, so the job may have fewer processes than there are stages.
+ * @param stages The stages of the pipeline, in order. Updated in place when stages are removed.
+ * @param numStages The number of stages in the pipeline.
+ * @param fds The input of the first stage, the output of the last stage, and the error output of every stage.
+ * @param background Whether or not the job runs in the background.
+ * @return The job running the pipeline.
+ */
+Job *startPipeline(Stage stages[], int numStages, StdFds fds, bool background) {
+    char *description = describePipeline(stages, numStages); // Described the way it was typed
+    numStages = elidePassthroughStages(stages, numStages);
+    if (background && !jobControlEnabled() && stages[0].inputFile == NULL && stages[0].inputText == NULL) {
+        stages[0].inputFile = "/dev/null"; // Without job control, a background job must not compete for the shell's input
+    }
+    // No stage may be reaped before it has been recorded in the job
+    sigset_t previous;
+    blockChildSignals(&previous);
+    Job *job = addJob(numStages, description);
+    job->background = background;
+    free(description);
+    
+    int inputFileDescriptor = fds.in;
+    Placement *placements = placePipeline(stages, numStages);
+    fflush(stdout); // Forked children must not inherit (and later flush) anything still buffered
+    
+    int i;
+    for (i = 0; i < numStages; i++) {
+        int fd[2] = { -1, -1 };
+        if (i < numStages - 1 && openStagePipe(fd) == -1) { // Every stage but the last writes into a pipe
+            perror("Unable to create a pipe.\n\r");
+            failStages(job, i, inputFileDescriptor != fds.in ? inputFileDescriptor : -1);
+            break;
         }
         
-        tokensBeforePipe[numTokensBeforePipe] = NULL; // Remove the operator and replace it with NULL to indicate the end of the command
-        tokenIndex++; // Move past the pipe
+        // Redirection to or from a file takes precedence over the pipe
+        StdFds stageFds = { inputFileDescriptor, fd[1] != -1 ? fd[1] : fds.out, fds.err };
+        int opened[3];
+        bool redirected = openStageRedirections(&stages[i], &stageFds, opened) == 0;
         
-        char *redirectedFile = NULL;
-        // Iterate through each token that exists before the next pipe, or the end of the line.
-        int tokenCount;
-        for (tokenCount = 0; tokenCount < numTokensBeforePipe; tokenCount++) { // Iterate through each token between pipes
-            const char *token = tokensBeforePipe[tokenCount];
-            if ((redirectInput = token[0] == '<') || (redirectOutput = token[0] == '>')) { // If a redirection token is found
-                tokensBeforePipe[tokenCount] = NULL; // Replace the operator with null to facilitate deliminating the previous command and its arguments up to this point
-                redirectedFile = tokensBeforePipe[tokenCount + 1]; // The file will always follow a < or >
-                break;
+        JobProcess *process = &job->processes[i];
+        clock_gettime(CLOCK_MONOTONIC, &process->started);
+        if (!redirected) {
+            process->pid = -1; // The stage can't run, but the rest of the pipeline still does
+            process->exitStatus = EXIT_FAILURE;
+        } else {
+            pid_t pgid = jobControlEnabled() ? job->pgid : -1;
+            const Builtin *builtin = findBuiltin(stages[i].argv, false);
+            setLaunchPlacement(placements ? &placements[i] : NULL);
+            if (builtin) { // Runs in a copy of the shell, so that it can run alongside the other stages
+                process->pid = forkBuiltin(builtin->run, stages[i].argv, stageFds, pgid);
+            } else {
+                process->pid = launchProcess(stages[i].argv, stageFds, pgid, &process->commandMissing);
             }
+            // The system was out of processes or memory, or else the command could not be found or executed
+            process->exitStatus = errno == EAGAIN || errno == ENOMEM ? EXIT_FAILURE : 127;
+            setLaunchPlacement(NULL);
+        }
+        if (tracingEnabled()) {
+            process->name = describePipeline(&stages[i], 1);
+        }
+        if (process->pid == -1) {
+            process->state = kJobDone;
+            process->finished = process->started;
+        } else if (job->pgid == 0) {
+            job->pgid = jobControlEnabled() ? process->pid : getpgrp();
         }
         
-        // At this point, any commands and files to be
-        // worked with in this section of the full line have been identified,
-        // determining which is inputting, which is receiving,
-        int fd[2];
-        pipe(fd);
-        pid_t pid;
-        switch (pid = fork()) {
-            case 0: // Child
-                if (redirectInput) {
-                    handleInputRedirection(redirectedFile);
-                } else {
-                    if (dup2(inputFileDescriptor, STDIN_FILENO) == -1) { // input to should be reset to STDIN
-                        perror("Unable to perform duplicate a process.\n\r");
-                        exit(EXIT_FAILURE);
-                    }
+        // The parent never uses the descriptors it handed to its children,
+        // and holding them open would keep readers from ever seeing EOF.
+        int unused[] = { inputFileDescriptor != fds.in ? inputFileDescriptor : -1, fd[1] };
+        int j;
+        for (j = 0; j < 2; j++) {
+            if (unused[j] != -1 && close(unused[j]) == -1) {
+                perror("Unable to close a file descriptor.\n\r");
+                exit(EXIT_FAILURE);
+            }
+        }
+        closeRedirections(opened);
+        inputFileDescriptor = fd[0];
+        if (fd[0] != -1 && getPipeCounting()) { // The bytes pass through a counter on their way to the next stage
+            char *label = describePipeline(&stages[i], 2);
+            inputFileDescriptor = startPipeCounter(fd[0], label, jobControlEnabled() ? job->pgid : -1);
+            free(label);
+        }
+    }
+    free(placements);
+    restoreChildSignals(&previous);
+    return job;
+}
+
+/**
+ * Print the time and resources each process of a finished job used, followed by the job's totals.
+ * @param job The finished job.
+ * @param stages The stages the job ran, one per process.
+ * @param real How long the whole job took, in seconds.
+ */
+static void reportJobUsage(Job *job, Stage stages[], double real) {
+    UsageTotals totals = {0};
+    fflush(stdout);
+    printUsageHeader(STDERR_FILENO);
+    int i;
+    for (i = 0; i < job->numProcesses; i++) {
+        JobProcess *process = &job->processes[i];
+        UsageTotals stageUsage = {0};
+        addUsage(&stageUsage, secondsBetween(&process->started, &process->finished), &process->usage);
+        addUsage(&totals, 0, &process->usage);
+        char *description = describePipeline(&stages[i], 1);
+        printUsage(STDERR_FILENO, &stageUsage, description);
+        free(description);
+    }
+    if (job->numProcesses > 1) {
+        totals.real = real;
+        printUsage(STDERR_FILENO, &totals, "total");
+    }
+}
+
+/**
+ * Run every stage of a pipeline concurrently, connecting each stage's output to the next stage's input.
+ * All stages are started before any of them are waited on, so that no stage can block on a full pipe.
+ * @param stages The stages of the pipeline, in order.
+ * @param numStages The number of stages in the pipeline.
+ * @param timed Whether or not to report the time and resources each stage used, once the pipeline finishes.
+ * @param timeLimit How many seconds the pipeline may run for before it is stopped, or 0 for no limit.
+ * @return The exit status of the last stage, or 124 if the pipeline ran out of time.
+ */
+int executePipeline(Stage stages[], int numStages, bool timed, double timeLimit) {
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    Job *job = startPipeline(stages, numStages, kShellFds, false);
+    if (timeLimit > 0) {
+        limitJob(job, timeLimit);
+    }
+    double waitStart = tracingEnabled() ? traceClock() : 0;
+    int status = waitForJob(job, true);
+    traceSpan("wait", "wait", waitStart, tracingEnabled() ? traceClock() : 0, 0, job->command);
+    if (jobState(job) == kJobDone) {
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+        if (timed) {
+            reportJobUsage(job, stages, secondsBetween(&started, &finished));
+        }
+        int i;
+        for (i = 0; i < job->numProcesses; i++) {
+            if (job->processes[i].commandMissing) {
+                forgetCommand(stages[i].argv[0]); // A forked child could not find the executable that was remembered
+            }
+        }
+        if (job->timedOut) {
+            status = 124; // As the timeout command reports it
+        }
+        removeJob(job);
+    }
+    return status;
+}
+
+/**
+ * Read a length of time, given in seconds or followed by s, m, h or d, the way the timeout command takes it.
+ * @param text The length of time.
+ * @param seconds Filled with the length of time in seconds. 0 means no limit at all.
+ * @return Whether or not the text was a length of time.
+ */
+static bool parseDuration(const char *text, double *seconds) {
+    char *end;
+    errno = 0;
+    double value = strtod(text, &end);
+    if (end == text || errno || !(value >= 0)) { // Also turns away "nan"
+        return false;
+    }
+    switch (*end) {
+        case 'd':
+            value *= 24; // Fall through
+        case 'h':
+            value *= 60; // Fall through
+        case 'm':
+            value *= 60; // Fall through
+        case 's':
+            end++;
+            break;
+        case '\0':
+            break;
+        default:
+            return false;
+    }
+    *seconds = value < 1e9 ? value : 0; // Longer than the shell could ever run for
+    return *end == '\0';
+}
+
+/**
+ * Remove the 'pin CPUS' and 'limit SETTINGS' prefixes from the start of a stage, and record the placement they give.
+ * @param stage The stage, whose arguments are moved past its prefixes.
+ * @param arena Where to allocate the placement.
+ * @return Whether or not every prefix was followed by its setting and a command. If not, the error has been reported.
+ */
+static bool readPlacementPrefixes(Stage *stage, Arena *arena) {
+    while (strcmp(stage->argv[0], "pin") == 0 || strcmp(stage->argv[0], "limit") == 0) {
+        bool pin = stage->argv[0][0] == 'p';
+        if (stage->argv[1] == NULL || stage->argv[2] == NULL) {
+            fprintf(stderr, pin ? "pin: usage: pin CPUS command\n" :
+                    "limit: usage: limit nice=N,ionice=CLASS[:LEVEL],cpu=SECONDS,as=BYTES,nofile=N command\n");
+            return false;
+        }
+        if (stage->placement == NULL) {
+            stage->placement = arenaAlloc(arena, sizeof(Placement));
+            memset(stage->placement, 0, sizeof(Placement));
+        }
+        const char *bad;
+        if (pin && !parseCpuList(stage->argv[1], stage->placement)) {
+            fprintf(stderr, "pin: '%s' is not a list of CPUs, such as 0-3,8\n", stage->argv[1]);
+            return false;
+        } else if (!pin && !parseLimits(stage->argv[1], stage->placement, &bad)) {
+            fprintf(stderr, "limit: can't understand '%.*s'\n", (int)strcspn(bad, ","), bad);
+            return false;
+        }
+        stage->argv += 2;
+    }
+    return true;
+}
+
+/**
+ * Split a line into the stages of its pipeline and run them, or run the line's built-in command within the shell.
+ * @param input The structure representing a user's input into the shell. Must have at least one token.
+ * @return The exit status of the line.
+ */
+static int executeLine(LineInput *input) {
+    int status, numStages;
+    Stage *stages = buildStages(input, &numStages);
+    if (stages == NULL) {
+        if (numStages == -1) {
+            perror("Unable to allocate memory.\n\r");
+        }
+        return EXIT_FAILURE;
+    }
+    Arena expansions = {0}; // Only allocated from if the line has variables to expand
+    if (numStages == 1 && !stages[0].inputFile && !stages[0].inputText && stages[0].numRedirections == 0 &&
+        processAssignments(&stages[0], &expansions)) {
+        freeArena(&expansions);
+        free(stages);
+        return EXIT_SUCCESS;
+    }
+    if (expandStages(stages, numStages, &expansions) == -1) {
+        freeArena(&expansions);
+        free(stages);
+        if (numStages == 1) { // Every word expanded to nothing
+            return EXIT_SUCCESS;
+        }
+        fprintf(stderr, "Missing a command in the pipeline.\n");
+        return EXIT_FAILURE;
+    }
+    // A leading 'time' reports what every stage of a foreground pipeline used
+    bool timed = strcmp(stages[0].argv[0], "time") == 0;
+    if (timed && (++stages[0].argv)[0] == NULL) {
+        freeArena(&expansions);
+        free(stages);
+        if (numStages == 1) { // Nothing to time
+            return EXIT_SUCCESS;
+        }
+        fprintf(stderr, "Missing a command in the pipeline.\n");
+        return EXIT_FAILURE;
+    }
+    // A leading 'timeout DURATION' stops the pipeline once it has run for that long
+    double timeLimit = 0;
+    if (strcmp(stages[0].argv[0], "timeout") == 0) {
+        if (stages[0].argv[1] == NULL || !parseDuration(stages[0].argv[1], &timeLimit) || stages[0].argv[2] == NULL) {
+            fprintf(stderr, "timeout: usage: timeout DURATION[s|m|h|d] command\n");
+            freeArena(&expansions);
+            free(stages);
+            return 125;
+        }
+        stages[0].argv += 2;
+    }
+    // 'pin CPUS' and 'limit SETTINGS' place the stage they start
+    int i;
+    for (i = 0; i < numStages; i++) {
+        if (!readPlacementPrefixes(&stages[i], &expansions)) {
+            freeArena(&expansions);
+            free(stages);
+            return 125;
+        }
+    }
+    // A lone built-in command in the foreground runs within the shell, without forking at all,
+    // unless it has to be stopped after a time limit or placed
+    if (numStages == 1 && !input->background && timeLimit == 0 && stages[0].placement == NULL &&
+        processBuiltInCmd(&stages[0], &status, timed)) {
+        freeArena(&expansions);
+        free(stages);
+        return status;
+    }
+    
+    if (input->background) {
+        Job *job = startPipeline(stages, numStages, kShellFds, true);
+        if (timeLimit > 0) {
+            limitJob(job, timeLimit);
+        }
+        if (jobControlEnabled()) {
+            printf("[%d] %d\n", job->id, (int)job->processes[job->numProcesses - 1].pid);
+            fflush(stdout);
+        }
+        status = EXIT_SUCCESS;
+    } else {
+        status = executePipeline(stages, numStages, timed, timeLimit);
+    }
+    freeArena(&expansions);
+    free(stages);
+    return status;
+}
+
+/*
+ * Execute a line of input based on the user's input.
+ * The general idea is to split the input into segments, using pipes as deliminators,
+ * and then run every segment at once. A line ending in & is left running in the background.
+ *
+ * @param lineInput The structure representing a user's input into the shell.
+ * @return The exit status of the line.
+ */
+int execute(LineInput *input) {
+    if (input->tokens[0] == NULL) {
+        return EXIT_SUCCESS;
+    }
+    if (tracingEnabled()) {
+        double start = traceClock();
+        lastStatus = executeLine(input);
+        traceSpan("execute", "execute", start, traceClock(), 0, input->tokens[0]);
+        return lastStatus;
+    }
+    return lastStatus = executeLine(input);
+}
+
+/**
+ * Run a command, and every command linked after it.
+ * @param node The first command.
+ * @return The exit status of the last command run.
+ */
+static int executeList(Node *node) {
+    int status = lastStatus;
+    for (; node && !interrupted; node = node->next) {
+        int i;
+        switch (node->type) {
+            case kNodePipeline:
+                status = execute(&node->pipeline);
+                // A foreground pipeline stopped by ^C stops everything around it too, just as it would a script
+                interrupted = !node->pipeline.background && status == 128 + SIGINT;
+                break;
+                
+            case kNodeAnd:
+            case kNodeOr:
+                status = executeList(node->left);
+                if ((status == EXIT_SUCCESS) == (node->type == kNodeAnd) && !interrupted) {
+                    status = executeList(node->right);
                 }
-                handleOutputRedirection(redirectedFile);
-                if (close(fd[0]) == -1) { // The input descriptor is not needed, as this input is just being sent to stdin
-                    perror("Unable to close the stdin file descriptor.\n\r");
-                    exit(EXIT_FAILURE);
+                break;
+                
+            case kNodeIf:
+                if (executeList(node->condition) == EXIT_SUCCESS) {
+                    status = executeList(node->body);
+                } else {
+                    status = node->alternative ? executeList(node->alternative) : EXIT_SUCCESS;
                 }
+                break;
                 
-                // Execute this part of the line
-                if (execvp(tokensBeforePipe[0], tokensBeforePipe) == -1) {
-                    perror(tokensBeforePipe[0]);
-                    exit(EXIT_FAILURE);
+            case kNodeWhile:
+            case kNodeUntil:
+                status = EXIT_SUCCESS;
+                while ((executeList(node->condition) == EXIT_SUCCESS) == (node->type == kNodeWhile) && !interrupted) {
+                    status = executeList(node->body);
                 }
-                perror(tokensBeforePipe[0]);
-                exit(EXIT_FAILURE);
-                return;
-            default: // Parent
-                // Grab the parent's input descriptor before the child begins processing
-                // so that the child can
-                inputFileDescriptor = fd[0];
-                int status;
-                if (waitpid(pid, &status, 0) == -1) {
-                    if (errno != EINTR) { // a signal interrupt is expected
-                        perror("Unable to wait.\n\r");
-                        exit(EXIT_FAILURE);
+                break;
+                
+            case kNodeFor: {
+                Arena expansions = {0};
+                char **words = expandWords(node->words, &expansions);
+                status = EXIT_SUCCESS;
+                for (i = 0; words[i] && !interrupted; i++) {
+                    if (setVariable(node->variable, words[i]) == -1) {
+                        perror(node->variable);
+                        status = EXIT_FAILURE;
+                        break;
                     }
+                    status = executeList(node->body);
                 }
-                if (close(fd[1]) == -1) {
-                    perror("Unable to close a file descriptor.\n\r");
-                    exit(EXIT_FAILURE);
-                }
+                freeArena(&expansions);
                 break;
-            case -1:
-                perror("Unable to fork a child process.\n\r");
-                exit(EXIT_FAILURE);
-                return;
+            }
         }
+        lastStatus = status;
     }
-    return;
+    return status;
+}
+
+/**
+ * Run a parsed command, and every command linked after it, walking the commands without parsing anything again.
+ * A loop runs the same pipelines once per pass. A pipeline interrupted by ^C abandons every command that is left.
+ * @param node The first command.
+ * @return The exit status of the last command run.
+ */
+int executeNode(Node *node) {
+    interrupted = false;
+    int status = executeList(node);
+    interrupted = false;
+    return status;
 }
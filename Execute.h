@@ -2,6 +2,9 @@
 #define Execute_h
 
 #include "Parse.h"
+#include "Spawn.h"
+#include "Job.h"
+#include "Stats.h"
 
 #include <stdio.h>
 #include <unistd.h>
@@ -11,50 +14,219 @@
 #include <limits.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
-#endif /* Execute_h */
+/**
+ * The ways a command's output or error output can be redirected.
+ */
+typedef enum redirectionType {
+    kRedirectTruncate, // > and 2>
+    kRedirectAppend, // >> and 2>>
+    kRedirectDuplicate // 2>&1 and >&2
+} RedirectionType;
+
+/**
+ * A single redirection of a command's output or error output.
+ * A duplicate makes the descriptor a copy of the other one, as it stands when the redirection is applied.
+ */
+typedef struct redirection {
+    RedirectionType type;
+    int fd; // STDOUT_FILENO or STDERR_FILENO
+    char *file; // NULL for a duplicate
+} Redirection;
+
+/**
+ * A single command within a pipeline, along with the files its input and output are redirected to (if any).
+ * A here-document or here-string is kept as the text the command reads, in place of an input file.
+ * Output redirections are kept in the order they were typed, and applied in that order,
+ * so '2>&1 > file' sends error output where output went before the file, and '> file 2>&1' sends both to the file.
+ */
+typedef struct stage {
+    char **argv;
+    char *inputFile;
+    char *inputText;
+    Placement *placement; // Given by 'pin' and 'limit' prefixes, or NULL
+    Redirection *redirections;
+    int numRedirections;
+} Stage;
+
+/**
+ * Expand every variable in a list of words. Unquoted expansions are split into separate words at whitespace,
+ * and a word that expands to nothing at all is dropped.
+ * @param words The words, followed by a terminating NULL.
+ * @param arena Where the expanded words are allocated.
+ * @return The expanded words, followed by a terminating NULL: the words themselves, if none of them needed expanding.
+ */
+char **expandWords(char *words[], Arena *arena);
 
 /**
- * Process a 'cd' command
- * @param cmd The 'cd' command to process
+ * Expand every variable in a single word, without splitting it, such as the file of a redirection.
+ * @param word The word.
+ * @param arena Where the expanded word is allocated.
+ * @return The expanded word: the word itself, if it needed no expanding.
  */
-void processChangeDirectory(char *cmd[]);
+char *expandWord(char *word, Arena *arena);
 
 /**
- * Process the echo command separately, to only print what follows it.
- * @param cmd The command to process
+ * Expand every variable in the arguments and redirections of every stage of a pipeline.
+ * @param stages The stages of the pipeline, in order.
+ * @param numStages The number of stages in the pipeline.
+ * @param arena Where the expanded words are allocated.
+ * @return 0 if success, -1 if a stage no longer has a command once expanded.
  */
-void processEcho(char*cmd[]);
+int expandStages(Stage stages[], int numStages, Arena *arena);
+
+/**
+ * Expand every variable in the arguments and redirections of every stage of a pipeline, given the value of $?,
+ * without touching the shell's own state, so that several threads can expand at once.
+ * Command substitutions must not be among the expansions, as running one needs the shell.
+ * @param stages The stages of the pipeline, in order.
+ * @param numStages The number of stages in the pipeline.
+ * @param status The value of $?.
+ * @param arena Where the expanded words are allocated.
+ * @return 0 if success, -1 if a stage no longer has a command once expanded.
+ */
+int expandStagesAfter(Stage stages[], int numStages, int status, Arena *arena);
+
+/**
+ * @param word A word.
+ * @return The length of the variable name the word assigns to, or 0 if the word is not of the form name=value.
+ */
+size_t assignedNameLength(const char *word);
 
 /**
  * Used to process a single command
  * @param cmd The command to process, including any arguments it may have.
+ * @return The exit status of the command.
  */
-void processSingleCommand(char *cmd[]);
+int processSingleCommand(char *cmd[]);
 
 /**
- * This function checks to see if the cmd matches any built-in commands
- * and simply runs them if it finds any matches.
+ * This function checks to see if the stage's command matches any built-in commands
+ * and simply runs them within the shell if it finds any matches.
+ * The stage's redirections are opened and handed to the built-in command, leaving the shell's own descriptors alone.
+ * @param stage The command to process, along with the files its input and output are redirected to.
+ * @param status Set to the exit status of the built-in command, if one was run.
+ * @param timed Whether or not to report the time and resources the built-in command used.
  * @return Whether or not the command matched a built-in command.
  */
-bool processBuiltInCmd(char *cmd[LINE_MAX]);
+bool processBuiltInCmd(Stage *stage, int *status, bool timed);
 
 /**
- * This function takes care of any input redirection that may occur.
- * Either sendingFile or sendingCmd must be passed (Exclusive or)
+ * This function takes care of any input redirection that may occur,
+ * by opening the file that a command's input is redirected from.
+ * The descriptor is closed on exec, so only the command it is handed to will read from it.
  *
  * @param sendingFile The file to be read from.
+ * @return A descriptor open on the file, or -1 if it could not be opened.
  */
-void handleInputRedirection(char sendingFile[]);
+int handleInputRedirection(char sendingFile[]);
 
 /**
- * This function takes care of any output redirection that may occur.
+ * Hand a here-document or here-string to a command as its input, without it ever touching the filesystem.
+ * Text that fits in an empty pipe is written straight into one, and anything larger into an anonymous memory file.
+ * @param text The text to be read.
+ * @return A descriptor, closed on exec, that reads the text from its start, or -1 if the text could not be stored.
+ */
+int handleInputText(const char text[]);
+
+/**
+ * This function takes care of any output redirection that may occur,
+ * by creating (or truncating) the file that a command's output is redirected to.
  * @param receivingFile the file that should outputted to.
+ * @param append Whether to append to the file rather than truncate it.
+ * @return A descriptor open on the file, or -1 if it could not be opened.
+ */
+int handleOutputRedirection(char receivingFile[], bool append);
+
+/**
+ * Split a line of input into the stages of its pipeline, using pipes as deliminators.
+ * Redirection operators and the files following them are removed from each stage's arguments.
+ * @param input The structure representing a user's input into the shell.
+ * @param stages Filled with one entry per stage. Must have room for input->numPipes + 1 entries.
+ * @param argvStorage Backing storage for every stage's arguments. Must have room for input->numTokens + input->numPipes + 1 entries.
+ * @param redirectionStorage Backing storage for every stage's output redirections. Must have room for 2 * input->numRedirections entries.
+ * @return The number of stages found, or -1 if a stage is missing its command.
  */
-void handleOutputRedirection(char receivingFile[]);
+int splitStages(LineInput *input, Stage stages[], char *argvStorage[], Redirection redirectionStorage[]);
+
+/**
+ * Split a line of input into the stages of its pipeline, allocating room for them.
+ * A parsed line may be executed many times (such as from a script), so the line's own arena is left alone.
+ * @param input The structure representing a user's input into the shell.
+ * @param numStages Set to the number of stages found, 0 if a stage is missing its command, or -1 if there was no memory.
+ * @return The stages, which the caller must free, or NULL if a stage is missing its command (which is reported)
+ * or there was no memory for them (which is left to the caller, with errno set).
+ */
+Stage *buildStages(LineInput *input, int *numStages);
+
+/**
+ * Describe a pipeline the way it would be typed, for listing it as a job.
+ * @param stages The stages of the pipeline, in order.
+ * @param numStages The number of stages in the pipeline.
+ * @return The description, which the caller must free.
+ */
+char *describePipeline(Stage stages[], int numStages);
+
+/**
+ * Remove the stages of a pipeline that only pass data along ('cat', 'cat file' or 'cat < file'),
+ * by handing their input or output straight to the stage next to them.
+ * 'cat file | cmd' becomes 'cmd < file', 'a | cat | b' becomes 'a | b', and 'cmd | cat > file' becomes 'cmd > file',
+ * so the bytes are never copied and no process is started to copy them.
+ * @param stages The stages of the pipeline, in order. Updated in place.
+ * @param numStages The number of stages in the pipeline.
+ * @return The number of stages left.
+ */
+int elidePassthroughStages(Stage stages[], int numStages);
+
+/**
+ * Start every stage of a pipeline, connecting each stage's output to the next stage's input, without waiting for any of them.
+ * The stages are recorded as a job, so that they are reaped as soon as they finish.
+ * Stages that only pass data along are removed first, so the job may have fewer processes than there are stages.
+ * @param stages The stages of the pipeline, in order. Updated in place when stages are removed.
+ * @param numStages The number of stages in the pipeline.
+ * @param fds The input of the first stage, the output of the last stage, and the error output of every stage.
+ * @param background Whether or not the job runs in the background.
+ * @return The job running the pipeline.
+ */
+Job *startPipeline(Stage stages[], int numStages, StdFds fds, bool background);
+
+/**
+ * Run every stage of a pipeline concurrently, connecting each stage's output to the next stage's input.
+ * All stages are started before any of them are waited on, so that no stage can block on a full pipe.
+ * @param stages The stages of the pipeline, in order.
+ * @param numStages The number of stages in the pipeline.
+ * @param timed Whether or not to report the time and resources each stage used, once the pipeline finishes.
+ * @param timeLimit How many seconds the pipeline may run for before it is stopped, or 0 for no limit.
+ * @return The exit status of the last stage, or 124 if the pipeline ran out of time.
+ */
+int executePipeline(Stage stages[], int numStages, bool timed, double timeLimit);
 
 /*
- * Execute a line of input based on the user's input.
+ * Execute a line of input based on the user's input. A line ending in & is left running in the background.
+ * A line starting with 'time' reports the time and resources each stage used once it finishes.
  * @param lineInput The structure representing a user's input into the shell.
+ * @return The exit status of the line.
+ */
+int execute(LineInput *input);
+
+/**
+ * Run a parsed command, and every command linked after it, walking the commands without parsing anything again.
+ * A loop runs the same pipelines once per pass. A pipeline interrupted by ^C abandons every command that is left.
+ * @param node The first command.
+ * @return The exit status of the last command run.
  */
-void execute(LineInput *input);
+int executeNode(Node *node);
+
+/**
+ * Run parsed commands in a forked copy of the shell, as a job of its own in the shell's process group.
+ * @param program The commands to run.
+ * @param text The commands' text, which describes the job.
+ * @param fds The descriptors the commands should use as their standard input, output and error.
+ * @param unusedFd A descriptor of the shell's that the copy must not hold open, such as the end of a pipe it reads, or -1.
+ * @return The job, which the caller waits for and removes.
+ */
+Job *startSubshell(Node *program, char *text, StdFds fds, int unusedFd);
+
+#endif /* Execute_h */
@@ -0,0 +1,439 @@
+#include "Glob.h"
+#include "Parse.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#define NUM_LISTINGS 8
+#define READ_BUFFER_SIZE (64 * 1024)
+
+/**
+ * The names in a directory, as they were when it was last read.
+ */
+typedef struct listing {
+    dev_t device;
+    ino_t inode;
+    struct timespec modified; // The directory's modification time when it was read
+    bool racy; // Read so soon after it was modified that a change within the same tick could have been missed
+    char *names; // Every name, each ending with a NUL
+    size_t *offsets; // Where each name starts
+    unsigned char *types; // Each name's DT_ type, or DT_UNKNOWN
+    size_t numEntries, namesLength, namesCapacity, entriesCapacity;
+    unsigned long lastUsed; // 0 for an empty slot
+} Listing;
+
+#ifdef __linux__
+/**
+ * An entry as getdents64() returns it.
+ */
+typedef struct linuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} LinuxDirent64;
+
+static long readBuffer[READ_BUFFER_SIZE / sizeof(long)]; // Only used while holding listingsLock
+#endif
+
+static Listing listings[NUM_LISTINGS];
+static unsigned long useCount = 0;
+static pthread_mutex_t listingsLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @param status A directory's status.
+ * @return When the directory was last modified, as precisely as the system records it.
+ */
+static struct timespec modifiedTime(const struct stat *status) {
+#ifdef __linux__
+    return status->st_mtim;
+#else
+    struct timespec modified = { status->st_mtime, 0 };
+    return modified;
+#endif
+}
+
+/**
+ * Free a listing's names, leaving its slot empty.
+ * @param listing The listing.
+ */
+static void emptyListing(Listing *listing) {
+    free(listing->names);
+    free(listing->offsets);
+    free(listing->types);
+    memset(listing, 0, sizeof(Listing));
+}
+
+/**
+ * Add a name to a listing, growing it as needed.
+ * @param listing The listing.
+ * @param name The name.
+ * @param type The name's DT_ type, or DT_UNKNOWN.
+ */
+static void addName(Listing *listing, const char *name, unsigned char type) {
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) { // Never matched by anything
+        return;
+    }
+    size_t length = strlen(name) + 1;
+    if (listing->namesLength + length > listing->namesCapacity) {
+        listing->namesCapacity = listing->namesCapacity ? listing->namesCapacity * 2 : 4096;
+        while (listing->namesLength + length > listing->namesCapacity) {
+            listing->namesCapacity *= 2;
+        }
+        if ((listing->names = realloc(listing->names, listing->namesCapacity)) == NULL) {
+            perror("Unable to allocate memory.\n\r");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (listing->numEntries == listing->entriesCapacity) {
+        listing->entriesCapacity = listing->entriesCapacity ? listing->entriesCapacity * 2 : 256;
+        listing->offsets = realloc(listing->offsets, listing->entriesCapacity * sizeof(size_t));
+        listing->types = realloc(listing->types, listing->entriesCapacity);
+        if (listing->offsets == NULL || listing->types == NULL) {
+            perror("Unable to allocate memory.\n\r");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(listing->names + listing->namesLength, name, length);
+    listing->offsets[listing->numEntries] = listing->namesLength;
+    listing->types[listing->numEntries++] = type;
+    listing->namesLength += length;
+}
+
+/**
+ * Read every name in an open directory into a listing, with raw getdents64() calls where there are any,
+ * so that each call fills a large buffer and no DIR is ever allocated.
+ * @param fd The directory, which is closed.
+ * @param listing The empty listing to fill.
+ * @return 0 if success, -1 otherwise.
+ */
+static int readListing(int fd, Listing *listing) {
+#ifdef __linux__
+    long numRead;
+    while ((numRead = syscall(SYS_getdents64, fd, readBuffer, sizeof(readBuffer))) > 0) {
+        long position;
+        for (position = 0; position < numRead; ) {
+            LinuxDirent64 *entry = (LinuxDirent64 *)((char *)readBuffer + position);
+            addName(listing, entry->d_name, entry->d_type);
+            position += entry->d_reclen;
+        }
+    }
+    close(fd);
+    return numRead == -1 ? -1 : 0;
+#else
+    DIR *directory = fdopendir(fd);
+    if (directory == NULL) {
+        close(fd);
+        return -1;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != NULL) {
+        addName(listing, entry->d_name, entry->d_type);
+    }
+    closedir(directory);
+    return 0;
+#endif
+}
+
+/**
+ * Find the names in a directory, reading it only if the cached listing of it is missing or out of date.
+ * Must be called holding listingsLock.
+ * @param path The directory.
+ * @return The listing, valid until the next call, or NULL if the directory could not be read.
+ */
+static Listing *listDirectory(const char *path) {
+    struct stat status;
+    if (stat(path, &status) == -1 || !S_ISDIR(status.st_mode)) {
+        return NULL;
+    }
+    struct timespec modified = modifiedTime(&status);
+    Listing *listing = NULL;
+    int i;
+    for (i = 0; i < NUM_LISTINGS; i++) {
+        if (listings[i].lastUsed && listings[i].device == status.st_dev && listings[i].inode == status.st_ino) {
+            listing = &listings[i];
+            break;
+        }
+    }
+    if (listing && !listing->racy && listing->modified.tv_sec == modified.tv_sec &&
+        listing->modified.tv_nsec == modified.tv_nsec) {
+        listing->lastUsed = ++useCount;
+        return listing;
+    }
+    for (i = 0; i < NUM_LISTINGS && listing == NULL; i++) { // An empty slot, or else the one least recently used
+        if (listings[i].lastUsed == 0) {
+            listing = &listings[i];
+        }
+    }
+    if (listing == NULL) {
+        listing = &listings[0];
+        for (i = 1; i < NUM_LISTINGS; i++) {
+            if (listings[i].lastUsed < listing->lastUsed) {
+                listing = &listings[i];
+            }
+        }
+    }
+    emptyListing(listing);
+    
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &status) == -1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return NULL;
+    }
+    // A change made while reading gives the directory a later time, so it is only one made before now that could hide
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (readListing(fd, listing) == -1) {
+        emptyListing(listing);
+        return NULL;
+    }
+    listing->device = status.st_dev;
+    listing->inode = status.st_ino;
+    listing->modified = modifiedTime(&status);
+    listing->racy = listing->modified.tv_sec >= now.tv_sec - 1;
+    listing->lastUsed = ++useCount;
+    return listing;
+}
+
+/**
+ * Match a character against a bracket expression, such as [abc], [a-z] or [!0-9].
+ * @param bracket The [.
+ * @param end The end of the pattern.
+ * @param c The character.
+ * @param matched Set to whether or not the character matched.
+ * @return The character following the closing ], or NULL if there is none (and so the [ is an ordinary character).
+ */
+static const char *matchBracket(const char *bracket, const char *end, unsigned char c, bool *matched) {
+    const char *p = bracket + 1;
+    bool negated = p < end && (*p == '!' || *p == '^'), found = false, first = true;
+    p += negated;
+    while (p < end) {
+        if (*p == GLOB_MARKER) { // Within brackets, *, ? and [ are ordinary characters
+            p++;
+            continue;
+        }
+        if (*p == ']' && !first) {
+            *matched = found != negated;
+            return p + 1;
+        }
+        first = false;
+        unsigned char low = *p++, high = low;
+        if (p + 1 < end && *p == '-' && p[1] != ']') {
+            p += 1 + (p[1] == GLOB_MARKER && p + 2 < end);
+            high = *p++;
+        }
+        found |= c >= low && c <= high;
+    }
+    return NULL;
+}
+
+/**
+ * Find out whether or not part of a pattern holds a wildcard.
+ * @param pattern The part of the pattern.
+ * @param end The end of the part.
+ * @return Whether or not the part holds a *, a ?, or a [ with a ] to close it.
+ */
+static bool hasWildcardIn(const char *pattern, const char *end) {
+    const char *p;
+    for (p = pattern; p + 1 < end; p++) {
+        bool matched;
+        if (*p == GLOB_MARKER && (p[1] == '*' || p[1] == '?' || matchBracket(p + 1, end, 0, &matched))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @param word A word, whose unquoted *, ? and [ are each preceded by GLOB_MARKER.
+ * @return Whether or not the word holds a wildcard: a *, a ?, or a [ with a ] to close it.
+ */
+bool hasWildcard(const char *word) {
+    return hasWildcardIn(word, word + strlen(word));
+}
+
+/**
+ * Match a name against a single part of a pattern, between two slashes.
+ * @param pattern The part of the pattern.
+ * @param end The end of the part.
+ * @param name The name.
+ * @return Whether or not the name matches.
+ */
+static bool matchName(const char *pattern, const char *end, const char *name) {
+    if (name[0] == '.' && pattern[0] != '.') { // Hidden names are only matched by a literal .
+        return false;
+    }
+    const char *p = pattern, *star = NULL, *starName = NULL;
+    while (*name) {
+        const char *next = NULL;
+        if (p + 1 < end && *p == GLOB_MARKER && p[1] == '*') {
+            p += 2;
+            star = p; // Where to carry on from, with the star taking one more character, if the rest fails to match
+            starName = name;
+            continue;
+        } else if (p + 1 < end && *p == GLOB_MARKER && p[1] == '?') {
+            next = p + 2;
+        } else if (p + 1 < end && *p == GLOB_MARKER && p[1] == '[') {
+            bool matched;
+            const char *after = matchBracket(p + 1, end, *name, &matched);
+            if (after == NULL) {
+                next = *name == '[' ? p + 2 : NULL;
+            } else {
+                next = matched ? after : NULL;
+            }
+        } else if (p < end && *p == *name) {
+            next = p + 1;
+        }
+        
+        if (next) {
+            p = next;
+            name++;
+        } else if (star) {
+            p = star;
+            name = ++starName;
+        } else {
+            return false;
+        }
+    }
+    while (p + 1 < end && *p == GLOB_MARKER && p[1] == '*') {
+        p += 2;
+    }
+    return p == end;
+}
+
+/**
+ * Copy part of a word into an arena, without its markers.
+ * @param arena Where the copy is allocated.
+ * @param prefix What the copy starts with.
+ * @param part The part of the word.
+ * @param length The number of characters in the part.
+ * @param slash Whether or not to end the copy with a /.
+ * @return The copy.
+ */
+static char *joinPath(Arena *arena, const char *prefix, const char *part, size_t length, bool slash) {
+    size_t prefixLength = strlen(prefix);
+    char *path = arenaAlloc(arena, prefixLength + length + 2), *out = path + prefixLength;
+    memcpy(path, prefix, prefixLength);
+    size_t i;
+    for (i = 0; i < length; i++) {
+        if (part[i] != GLOB_MARKER) {
+            *out++ = part[i];
+        }
+    }
+    if (slash) {
+        *out++ = '/';
+    }
+    *out = '\0';
+    return path;
+}
+
+/**
+ * Compare two paths, for sorting them.
+ */
+static int comparePaths(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/**
+ * Expand a word holding wildcards into every path that matches it, appending them in sorted order to a list of words.
+ * Names starting with . are only matched by a pattern whose own . is not a wildcard. Directories are listed through
+ * a small cache of recent listings, which is only read again once a directory's inode or modification time changes.
+ * Safe to call from several threads at once.
+ * @param pattern The word, whose unquoted *, ? and [ are each preceded by GLOB_MARKER.
+ * @param words The list.
+ * @param numWords The number of words in the list.
+ * @param capacity The number of words the list has room for.
+ * @param arena Where the paths and the list are allocated.
+ * @return The number of paths appended, 0 if nothing matched (and the list was left alone).
+ */
+int expandGlob(const char *pattern, char ***words, int *numWords, int *capacity, Arena *arena) {
+    // Each part between slashes turns every path matched so far into the paths that match one more part
+    char **paths = NULL;
+    int numPaths = 0, pathCapacity = 0, start = *numWords;
+    appendWord(&paths, &numPaths, &pathCapacity, pattern[0] == '/' ? "/" : "", arena);
+    const char *part = pattern + (pattern[0] == '/');
+    pthread_mutex_lock(&listingsLock);
+    while (numPaths > 0) {
+        const char *slash = strchr(part, '/'), *end = slash ? slash : part + strlen(part);
+        bool last = slash == NULL;
+        // The last part's paths go straight into the list of words
+        char ***matched = words, **next = NULL;
+        int *numMatched = numWords, *matchedCapacity = capacity, numNext = 0, nextCapacity = 0, i;
+        if (!last) {
+            matched = &next;
+            numMatched = &numNext;
+            matchedCapacity = &nextCapacity;
+        }
+        
+        if (!hasWildcardIn(part, end)) { // Nothing to match, so only the last part is checked for
+            struct stat status;
+            for (i = 0; i < numPaths; i++) {
+                char *path = joinPath(arena, paths[i], part, end - part, !last);
+                if (!last || lstat(path, &status) == 0) {
+                    appendWord(matched, numMatched, matchedCapacity, path, arena);
+                }
+            }
+        } else {
+            for (i = 0; i < numPaths; i++) {
+                Listing *listing = listDirectory(paths[i][0] ? paths[i] : ".");
+                size_t j;
+                for (j = 0; listing && j < listing->numEntries; j++) {
+                    const char *name = listing->names + listing->offsets[j];
+                    unsigned char type = listing->types[j];
+                    if (!last && type != DT_UNKNOWN && type != DT_DIR && type != DT_LNK) { // Can't hold the next part
+                        continue;
+                    }
+                    if (matchName(part, end, name)) {
+                        appendWord(matched, numMatched, matchedCapacity,
+                                   joinPath(arena, paths[i], name, strlen(name), !last), arena);
+                    }
+                }
+            }
+        }
+        if (last) {
+            break;
+        }
+        paths = next;
+        numPaths = numNext;
+        part = slash + 1;
+    }
+    pthread_mutex_unlock(&listingsLock);
+    qsort(*words + start, *numWords - start, sizeof(char *), comparePaths);
+    return *numWords - start;
+}
+
+/**
+ * Copy a word without the markers that make its *, ? and [ wildcards, for when it is used as it is.
+ * @param word The word.
+ * @param arena Where the copy is allocated.
+ * @return The copy: the word itself, if it held no markers.
+ */
+char *removeGlobMarkers(char *word, Arena *arena) {
+    if (strchr(word, GLOB_MARKER) == NULL) {
+        return word;
+    }
+    return joinPath(arena, "", word, strlen(word), false);
+}
+
+/**
+ * Forget every cached directory listing.
+ */
+void clearGlobCache(void) {
+    pthread_mutex_lock(&listingsLock);
+    int i;
+    for (i = 0; i < NUM_LISTINGS; i++) {
+        emptyListing(&listings[i]);
+    }
+    pthread_mutex_unlock(&listingsLock);
+}
@@ -0,0 +1,44 @@
+#ifndef Glob_h
+#define Glob_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "Arena.h"
+
+/**
+ * @param word A word, whose unquoted *, ? and [ are each preceded by GLOB_MARKER.
+ * @return Whether or not the word holds a wildcard: a *, a ?, or a [ with a ] to close it.
+ */
+bool hasWildcard(const char *word);
+
+/**
+ * Expand a word holding wildcards into every path that matches it, appending them in sorted order to a list of words.
+ * Names starting with . are only matched by a pattern whose own . is not a wildcard. Directories are listed through
+ * a small cache of recent listings, which is only read again once a directory's inode or modification time changes.
+ * Safe to call from several threads at once.
+ * @param pattern The word, whose unquoted *, ? and [ are each preceded by GLOB_MARKER.
+ * @param words The list.
+ * @param numWords The number of words in the list.
+ * @param capacity The number of words the list has room for.
+ * @param arena Where the paths and the list are allocated.
+ * @return The number of paths appended, 0 if nothing matched (and the list was left alone).
+ */
+int expandGlob(const char *pattern, char ***words, int *numWords, int *capacity, Arena *arena);
+
+/**
+ * Copy a word without the markers that make its *, ? and [ wildcards, for when it is used as it is.
+ * @param word The word.
+ * @param arena Where the copy is allocated.
+ * @return The copy: the word itself, if it held no markers.
+ */
+char *removeGlobMarkers(char *word, Arena *arena);
+
+/**
+ * Forget every cached directory listing.
+ */
+void clearGlobCache(void);
+
+#endif /* Glob_h */
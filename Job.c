@@ -0,0 +1,637 @@
+#include "Job.h"
+#include "Events.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "Zygote.h"
+
+static Job **jobs = NULL;
+static int numJobs = 0, jobsCapacity = 0;
+static bool jobControl = false;
+static pid_t shellPgid = 0;
+
+/**
+ * Convert a status reported by waitpid() into a shell exit status.
+ * @param status The status reported by waitpid().
+ * @return The exit code of the process, or 128 + the signal number if it was killed by a signal.
+ */
+int exitStatusOf(int status) {
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return EXIT_FAILURE;
+}
+
+/**
+ * Reap children as soon as they change state.
+ */
+static void handleChildSignal(int signum) {
+    reapChildren();
+}
+
+/**
+ * Set up reaping of children. Every child is reaped as soon as it changes state, by a SIGCHLD handler,
+ * until startEventLoop() has SIGCHLD read from a signalfd instead.
+ * When the shell is interactive, every job is also given its own process group, and the foreground job is given the terminal.
+ * @param interactive Whether or not the shell is reading commands from a terminal.
+ */
+void initJobControl(bool interactive) {
+    resetStats();
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handleChildSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART; // Don't interrupt reading the next line
+    if (sigaction(SIGCHLD, &action, NULL) == -1) {
+        perror("Signal failed.\n\r");
+        exit(EXIT_FAILURE);
+    }
+    
+    if (interactive) {
+        // The shell must be able to hand the terminal back and forth without being stopped itself
+        signal(SIGTTOU, SIG_IGN);
+        signal(SIGTTIN, SIG_IGN);
+        signal(SIGTSTP, SIG_IGN);
+        shellPgid = getpid();
+        if (getpgrp() != shellPgid) {
+            setpgid(0, shellPgid);
+        }
+        if (tcsetpgrp(STDIN_FILENO, shellPgid) == 0) {
+            jobControl = true;
+        }
+    }
+}
+
+/**
+ * @return Whether or not jobs are placed in their own process groups.
+ */
+bool jobControlEnabled(void) {
+    return jobControl;
+}
+
+/**
+ * Stop placing jobs in process groups of their own, such as in a forked copy of the shell whose commands
+ * belong to the job that the copy is part of.
+ */
+void disableJobControl(void) {
+    jobControl = false;
+}
+
+/**
+ * Block SIGCHLD, so that the job table can be changed without the reaper running in the middle of it.
+ * @param previous Filled with the signal mask to restore afterwards.
+ */
+void blockChildSignals(sigset_t *previous) {
+    sigset_t childSignals;
+    sigemptyset(&childSignals);
+    sigaddset(&childSignals, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &childSignals, previous);
+}
+
+/**
+ * Restore the signal mask saved by blockChildSignals().
+ * @param previous The signal mask to restore.
+ */
+void restoreChildSignals(const sigset_t *previous) {
+    sigprocmask(SIG_SETMASK, previous, NULL);
+}
+
+/**
+ * Create a job and add it to the job table. SIGCHLD must be blocked until every process of the job has been recorded.
+ * @param numProcesses The number of processes the job will have.
+ * @param command The command the job runs, used when listing jobs. The job keeps its own copy.
+ * @return The new job, with every process marked as running.
+ */
+Job *addJob(int numProcesses, const char *command) {
+    Job *job = calloc(1, sizeof(Job));
+    if (job == NULL || (job->processes = calloc(numProcesses, sizeof(JobProcess))) == NULL ||
+        (job->command = strdup(command)) == NULL) {
+        perror("Unable to allocate memory.\n\r");
+        exit(EXIT_FAILURE);
+    }
+    job->numProcesses = numProcesses;
+    job->id = numJobs ? jobs[numJobs - 1]->id + 1 : 1;
+    
+    sigset_t previous;
+    blockChildSignals(&previous);
+    if (numJobs == jobsCapacity) {
+        jobsCapacity = jobsCapacity ? jobsCapacity * 2 : 16;
+        if ((jobs = realloc(jobs, jobsCapacity * sizeof(Job *))) == NULL) {
+            perror("Unable to allocate memory.\n\r");
+            exit(EXIT_FAILURE);
+        }
+    }
+    jobs[numJobs++] = job;
+    restoreChildSignals(&previous);
+    return job;
+}
+
+/**
+ * Remove a job from the job table and free it. When tracing, the lifetime of each of its finished processes is recorded.
+ * @param job The job to remove.
+ */
+void removeJob(Job *job) {
+    sigset_t previous;
+    blockChildSignals(&previous);
+    int i;
+    for (i = 0; i < numJobs; i++) {
+        if (jobs[i] == job) {
+            memmove(&jobs[i], &jobs[i + 1], (numJobs - i - 1) * sizeof(Job *));
+            numJobs--;
+            break;
+        }
+    }
+    restoreChildSignals(&previous);
+    for (i = 0; i < job->numProcesses; i++) {
+        JobProcess *process = &job->processes[i];
+        if (process->name && process->pid != -1 && process->state == kJobDone) {
+            char status[32];
+            snprintf(status, sizeof(status), "exit %d", process->exitStatus);
+            traceProcessName(process->pid, process->name);
+            traceSpan("process", process->name, traceTimeOf(&process->started), traceTimeOf(&process->finished),
+                      process->pid, status);
+        }
+        free(process->name);
+    }
+    free(job->processes);
+    free(job->command);
+    free(job);
+}
+
+/**
+ * Forget every job without waiting for any of them, such as in a forked copy of the shell that starts over.
+ */
+void clearJobs(void) {
+    sigset_t previous;
+    blockChildSignals(&previous);
+    while (numJobs > 0) {
+        Job *job = jobs[--numJobs];
+        int i;
+        for (i = 0; i < job->numProcesses; i++) {
+            free(job->processes[i].name);
+        }
+        free(job->processes);
+        free(job->command);
+        free(job);
+    }
+    restoreChildSignals(&previous);
+}
+
+/**
+ * Find a job by the number it is listed with.
+ * @param id The job's number, or 0 for the most recently started job.
+ * @return The job, or NULL if there is no such job.
+ */
+Job *findJob(int id) {
+    if (id == 0) {
+        return numJobs ? jobs[numJobs - 1] : NULL;
+    }
+    int i;
+    for (i = 0; i < numJobs; i++) {
+        if (jobs[i]->id == id) {
+            return jobs[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @param job The job to check.
+ * @return The state of the job as a whole. A job is running while any of its processes are.
+ */
+JobState jobState(Job *job) {
+    JobState state = kJobDone;
+    int i;
+    for (i = 0; i < job->numProcesses; i++) {
+        if (job->processes[i].state == kJobRunning) {
+            return kJobRunning;
+        } else if (job->processes[i].state == kJobStopped) {
+            state = kJobStopped;
+        }
+    }
+    return state;
+}
+
+/**
+ * @param job The job to check.
+ * @return The exit status of the job, which is the exit status of its last process.
+ */
+int jobExitStatus(Job *job) {
+    return job->processes[job->numProcesses - 1].exitStatus;
+}
+
+/**
+ * Record that a process of a job has changed state.
+ * @param pid The process.
+ * @param status The status reported by wait4().
+ * @param usage The resources the process used, if it has finished.
+ */
+static void recordChildStatus(pid_t pid, int status, const struct rusage *usage) {
+    int i, j;
+    for (i = 0; i < numJobs; i++) {
+        for (j = 0; j < jobs[i]->numProcesses; j++) {
+            JobProcess *process = &jobs[i]->processes[j];
+            if (process->pid != pid) {
+                continue;
+            }
+            if (WIFSTOPPED(status)) {
+                process->state = kJobStopped;
+            } else if (WIFCONTINUED(status)) {
+                process->state = kJobRunning;
+            } else {
+                process->state = kJobDone;
+                process->exitStatus = exitStatusOf(status);
+                process->usage = *usage;
+                clock_gettime(CLOCK_MONOTONIC, &process->finished);
+                recordUsage(secondsBetween(&process->started, &process->finished), usage);
+            }
+        }
+    }
+}
+
+/**
+ * Reap every child that has changed state, and record the change in the job table.
+ * Children launched by the zygote are reported by it instead, and are recorded in the same way.
+ * The time each child finished and the resources it used are recorded along with its exit status.
+ * This is the SIGCHLD handler's work, and is safe to call from it.
+ */
+void reapChildren(void) {
+    int savedErrno = errno;
+    int status;
+    struct rusage usage;
+    pid_t pid;
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+        recordChildStatus(pid, status, &usage);
+    }
+    while (readZygoteEvent(&pid, &status, &usage)) {
+        recordChildStatus(pid, status, &usage);
+    }
+    errno = savedErrno;
+}
+
+/**
+ * Give a job a time limit. Once it runs out, the job is sent SIGTERM, and then SIGKILL a second later if it is still running.
+ * @param job The job to limit.
+ * @param seconds How long the job may run for, from now.
+ */
+void limitJob(Job *job, double seconds) {
+    clock_gettime(CLOCK_MONOTONIC, &job->deadline);
+    long nanoseconds = job->deadline.tv_nsec + (long)((seconds - (long)seconds) * 1e9);
+    job->deadline.tv_sec += (time_t)seconds + nanoseconds / 1000000000;
+    job->deadline.tv_nsec = nanoseconds % 1000000000;
+}
+
+/**
+ * @param job The job to check.
+ * @return Whether or not the job has a deadline.
+ */
+static bool hasDeadline(Job *job) {
+    return job->deadline.tv_sec != 0 || job->deadline.tv_nsec != 0;
+}
+
+/**
+ * Find the earliest time that a job runs out of time, or has to be killed after being told to stop.
+ * @param deadline Filled with the time, on the CLOCK_MONOTONIC clock.
+ * @return Whether or not any job has a deadline.
+ */
+bool nextJobDeadline(struct timespec *deadline) {
+    bool found = false;
+    int i;
+    for (i = 0; i < numJobs; i++) {
+        if (hasDeadline(jobs[i]) && (!found || secondsBetween(&jobs[i]->deadline, deadline) > 0)) {
+            *deadline = jobs[i]->deadline;
+            found = true;
+        }
+    }
+    return found;
+}
+
+/**
+ * Send a signal to every process of a job that is still running, or has been stopped.
+ * @param job The job to signal.
+ * @param signum The signal to send.
+ */
+static void signalJob(Job *job, int signum) {
+    if (jobControl && job->pgid > 0) {
+        killpg(job->pgid, signum);
+        return;
+    }
+    int i;
+    for (i = 0; i < job->numProcesses; i++) { // Shares the shell's process group, so each one is signalled alone
+        if (job->processes[i].state != kJobDone) {
+            kill(job->processes[i].pid, signum);
+        }
+    }
+}
+
+/**
+ * Signal every job whose deadline has passed.
+ * @return Whether or not any job was signalled.
+ */
+bool enforceJobDeadlines(void) {
+    struct timespec now;
+    bool signalled = false;
+    int i;
+    for (i = 0; i < numJobs; i++) {
+        Job *job = jobs[i];
+        if (!hasDeadline(job)) {
+            continue;
+        }
+        if (jobState(job) == kJobDone) {
+            memset(&job->deadline, 0, sizeof(job->deadline));
+            continue;
+        }
+        if (!signalled) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+        }
+        if (secondsBetween(&job->deadline, &now) < 0) {
+            continue;
+        }
+        if (!job->timedOut) { // Asked to stop first, and given a second to do so
+            job->timedOut = true;
+            signalJob(job, SIGTERM);
+            signalJob(job, SIGCONT); // A stopped job can't stop any further until it is running
+            job->deadline = now;
+            job->deadline.tv_sec += 1;
+        } else {
+            signalJob(job, SIGKILL);
+            memset(&job->deadline, 0, sizeof(job->deadline));
+        }
+        signalled = true;
+    }
+    return signalled;
+}
+
+/**
+ * Stop keeping every job to its deadline, such as in a forked copy of the shell, where they are the shell's to keep.
+ */
+void clearJobDeadlines(void) {
+    int i;
+    for (i = 0; i < numJobs; i++) {
+        memset(&jobs[i]->deadline, 0, sizeof(jobs[i]->deadline));
+    }
+}
+
+/**
+ * Wait until a job is no longer running. A foreground job is given the terminal while it runs.
+ * A job that is stopped becomes a background job. A job that finishes is left for the caller to remove.
+ * @param job The job to wait for.
+ * @param foreground Whether or not the job should be given the terminal.
+ * @return The exit status of the job.
+ */
+int waitForJob(Job *job, bool foreground) {
+    sigset_t previous;
+    blockChildSignals(&previous);
+    
+    if (foreground && jobControl && job->pgid > 0) {
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+    }
+    while (jobState(job) == kJobRunning) {
+        waitForEvents(-1); // Sleep until a child has been reaped, or a deadline has passed
+    }
+    if (foreground && jobControl) {
+        tcsetpgrp(STDIN_FILENO, shellPgid);
+    }
+    
+    int status = jobExitStatus(job);
+    if (jobState(job) == kJobStopped) {
+        job->background = true;
+        printf("\n[%d]+  Stopped\t\t%s\n", job->id, job->command);
+        fflush(stdout);
+        status = 128 + SIGTSTP;
+    }
+    restoreChildSignals(&previous);
+    return status;
+}
+
+/**
+ * Wait until at least one of several jobs is no longer running.
+ * @param candidates The jobs to wait for. NULL entries are skipped.
+ * @param numCandidates The number of entries in candidates.
+ * @return A job that is no longer running, or NULL if none of the jobs are left.
+ */
+Job *waitForAnyJob(Job *candidates[], int numCandidates) {
+    sigset_t previous;
+    blockChildSignals(&previous);
+    
+    Job *finished = NULL;
+    while (true) {
+        bool anyLeft = false;
+        int i;
+        for (i = 0; i < numCandidates && finished == NULL; i++) {
+            if (candidates[i] != NULL) {
+                anyLeft = true;
+                if (jobState(candidates[i]) != kJobRunning) {
+                    finished = candidates[i];
+                }
+            }
+        }
+        if (finished || !anyLeft) {
+            break;
+        }
+        waitForEvents(-1); // Sleep until a child has been reaped, or a deadline has passed
+    }
+    restoreChildSignals(&previous);
+    return finished;
+}
+
+/**
+ * Describe the state of a job, the way it is shown when listing jobs.
+ * @param job The job to describe.
+ * @param description Filled with the description.
+ */
+static void describeJob(Job *job, char description[32]) {
+    switch (jobState(job)) {
+        case kJobRunning:
+            strcpy(description, "Running");
+            break;
+        case kJobStopped:
+            strcpy(description, "Stopped");
+            break;
+        case kJobDone:
+            if (job->timedOut) {
+                strcpy(description, "Timed out");
+            } else if (jobExitStatus(job) == 0) {
+                strcpy(description, "Done");
+            } else {
+                sprintf(description, "Exit %d", jobExitStatus(job));
+            }
+            break;
+    }
+}
+
+/**
+ * Report every background job that has finished since it was last listed, and remove it from the job table.
+ */
+void notifyJobs(void) {
+    sigset_t previous;
+    blockChildSignals(&previous);
+    reapChildren(); // SIGCHLD is only read from while waiting, so a child may have finished since
+    int i;
+    for (i = 0; i < numJobs; i++) {
+        Job *job = jobs[i];
+        if (job->background && jobState(job) == kJobDone) {
+            char description[32];
+            describeJob(job, description);
+            printf("[%d]  %-22s %s\n", job->id, description, job->command);
+            removeJob(job);
+            i--;
+        }
+    }
+    fflush(stdout);
+    restoreChildSignals(&previous);
+}
+
+/**
+ * Read the job a command refers to, given either as 'n' or '%n'.
+ * @param argument The argument naming the job, or NULL for the most recently started job.
+ * @param builtin The command the argument was given to, used when reporting errors.
+ * @param errorFd Where to report errors.
+ * @return The job, or NULL (with the error reported) if there is no such job.
+ */
+static Job *jobFromArgument(const char *argument, const char *builtin, int errorFd) {
+    int id = 0;
+    if (argument != NULL) {
+        id = atoi(argument[0] == '%' ? &argument[1] : argument);
+    }
+    Job *job = findJob(id);
+    if (job == NULL) {
+        dprintf(errorFd, "%s: %s: no such job\n", builtin, argument ? argument : "current");
+    }
+    return job;
+}
+
+/**
+ * Process a 'jobs' command, listing every job along with its state.
+ * @param cmd The 'jobs' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processJobs(char *cmd[], StdFds fds) {
+    sigset_t previous;
+    blockChildSignals(&previous);
+    reapChildren(); // So that children which finished since the last wait are listed as done
+    int i;
+    for (i = 0; i < numJobs; i++) {
+        Job *job = jobs[i];
+        char description[32];
+        describeJob(job, description);
+        char marker = i == numJobs - 1 ? '+' : (i == numJobs - 2 ? '-' : ' ');
+        dprintf(fds.out, "[%d]%c  %-22s %s\n", job->id, marker, description, job->command);
+    }
+    for (i = 0; i < numJobs; i++) { // Finished jobs have now been reported
+        if (jobs[i]->background && jobState(jobs[i]) == kJobDone) {
+            removeJob(jobs[i--]);
+        }
+    }
+    restoreChildSignals(&previous);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Process a 'wait' command. 'wait' waits for every background job, and 'wait n...' waits for the given jobs.
+ * @param cmd The 'wait' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the last job waited for.
+ */
+int processWait(char *cmd[], StdFds fds) {
+    if (cmd[1] == NULL) { // Wait for every job that can still finish
+        while (true) {
+            Job *job = NULL;
+            int i;
+            for (i = 0; i < numJobs && job == NULL; i++) {
+                if (jobState(jobs[i]) != kJobStopped) {
+                    job = jobs[i];
+                }
+            }
+            if (job == NULL) {
+                return EXIT_SUCCESS;
+            }
+            waitForJob(job, false);
+            if (jobState(job) == kJobDone) {
+                removeJob(job);
+            }
+        }
+    }
+    
+    int status = EXIT_SUCCESS;
+    int i;
+    for (i = 1; cmd[i]; i++) {
+        Job *job = jobFromArgument(cmd[i], cmd[0], fds.err);
+        status = 127;
+        if (job) {
+            status = waitForJob(job, false);
+            if (jobState(job) == kJobDone) {
+                removeJob(job);
+            }
+        }
+    }
+    return status;
+}
+
+/**
+ * Continue a job, and note that all of its unfinished processes are running again.
+ * @param job The job to continue.
+ */
+static void continueJob(Job *job) {
+    sigset_t previous;
+    blockChildSignals(&previous);
+    int i;
+    for (i = 0; i < job->numProcesses; i++) {
+        if (job->processes[i].state == kJobStopped) {
+            job->processes[i].state = kJobRunning;
+            kill(job->processes[i].pid, SIGCONT);
+        }
+    }
+    restoreChildSignals(&previous);
+}
+
+/**
+ * Process a 'fg' command, continuing a job in the foreground and waiting for it.
+ * @param cmd The 'fg' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the job.
+ */
+int processFg(char *cmd[], StdFds fds) {
+    if (!jobControl) {
+        dprintf(fds.err, "fg: no job control\n");
+        return EXIT_FAILURE;
+    }
+    Job *job = jobFromArgument(cmd[1], cmd[0], fds.err);
+    if (job == NULL) {
+        return EXIT_FAILURE;
+    }
+    dprintf(fds.out, "%s\n", job->command);
+    job->background = false;
+    if (job->pgid > 0) {
+        tcsetpgrp(STDIN_FILENO, job->pgid); // Give it the terminal before it can try to read from it
+    }
+    continueJob(job);
+    int status = waitForJob(job, true);
+    if (jobState(job) == kJobDone) {
+        removeJob(job);
+    }
+    return status;
+}
+
+/**
+ * Process a 'bg' command, continuing a stopped job in the background.
+ * @param cmd The 'bg' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processBg(char *cmd[], StdFds fds) {
+    if (!jobControl) {
+        dprintf(fds.err, "bg: no job control\n");
+        return EXIT_FAILURE;
+    }
+    Job *job = jobFromArgument(cmd[1], cmd[0], fds.err);
+    if (job == NULL) {
+        return EXIT_FAILURE;
+    }
+    job->background = true;
+    continueJob(job);
+    dprintf(fds.out, "[%d]+ %s &\n", job->id, job->command);
+    return EXIT_SUCCESS;
+}
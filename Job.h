@@ -0,0 +1,218 @@
+#ifndef Job_h
+#define Job_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "Builtin.h"
+
+/**
+ * The states that a job, or one of its processes, can be in.
+ */
+typedef enum jobState {
+    kJobRunning,
+    kJobStopped,
+    kJobDone
+} JobState;
+
+/**
+ * A single process of a job, such as one stage of a pipeline, along with the resources it used once it has finished.
+ */
+typedef struct jobProcess {
+    pid_t pid;
+    JobState state;
+    int exitStatus;
+    bool commandMissing; // Whether the executable the command cache remembered for it had gone, so it should be forgotten
+    struct timespec started, finished;
+    struct rusage usage;
+    char *name; // The stage the process runs, kept only while tracing
+} JobProcess;
+
+/**
+ * A pipeline that has been launched, along with the state of each of its processes.
+ * Jobs are kept in a table until they finish and are waited for (or reported, if they ran in the background).
+ */
+typedef struct job {
+    int id;
+    pid_t pgid;
+    JobProcess *processes;
+    int numProcesses;
+    char *command;
+    bool background;
+    struct timespec deadline; // When the job is stopped if it is still running, or all zero if it may run for ever
+    bool timedOut; // Whether or not the job has been told to stop because it ran out of time
+} Job;
+
+/**
+ * Convert a status reported by waitpid() into a shell exit status.
+ * @param status The status reported by waitpid().
+ * @return The exit code of the process, or 128 + the signal number if it was killed by a signal.
+ */
+int exitStatusOf(int status);
+
+/**
+ * Set up reaping of children. Every child is reaped as soon as it changes state, by a SIGCHLD handler,
+ * until startEventLoop() has SIGCHLD read from a signalfd instead.
+ * When the shell is interactive, every job is also given its own process group, and the foreground job is given the terminal.
+ * @param interactive Whether or not the shell is reading commands from a terminal.
+ */
+void initJobControl(bool interactive);
+
+/**
+ * @return Whether or not jobs are placed in their own process groups.
+ */
+bool jobControlEnabled(void);
+
+/**
+ * Stop placing jobs in process groups of their own, such as in a forked copy of the shell whose commands
+ * belong to the job that the copy is part of.
+ */
+void disableJobControl(void);
+
+/**
+ * Block SIGCHLD, so that the job table can be changed without the reaper running in the middle of it.
+ * @param previous Filled with the signal mask to restore afterwards.
+ */
+void blockChildSignals(sigset_t *previous);
+
+/**
+ * Restore the signal mask saved by blockChildSignals().
+ * @param previous The signal mask to restore.
+ */
+void restoreChildSignals(const sigset_t *previous);
+
+/**
+ * Create a job and add it to the job table. SIGCHLD must be blocked until every process of the job has been recorded.
+ * @param numProcesses The number of processes the job will have.
+ * @param command The command the job runs, used when listing jobs. The job keeps its own copy.
+ * @return The new job, with every process marked as running.
+ */
+Job *addJob(int numProcesses, const char *command);
+
+/**
+ * Remove a job from the job table and free it. When tracing, the lifetime of each of its finished processes is recorded.
+ * @param job The job to remove.
+ */
+void removeJob(Job *job);
+
+/**
+ * Forget every job without waiting for any of them, such as in a forked copy of the shell that starts over.
+ */
+void clearJobs(void);
+
+/**
+ * Find a job by the number it is listed with.
+ * @param id The job's number, or 0 for the most recently started job.
+ * @return The job, or NULL if there is no such job.
+ */
+Job *findJob(int id);
+
+/**
+ * @param job The job to check.
+ * @return The state of the job as a whole. A job is running while any of its processes are.
+ */
+JobState jobState(Job *job);
+
+/**
+ * @param job The job to check.
+ * @return The exit status of the job, which is the exit status of its last process.
+ */
+int jobExitStatus(Job *job);
+
+/**
+ * Reap every child that has changed state, and record the change in the job table.
+ * Children launched by the zygote are reported by it instead, and are recorded in the same way.
+ * The time each child finished and the resources it used are recorded along with its exit status.
+ * This is the SIGCHLD handler's work, and is safe to call from it.
+ */
+void reapChildren(void);
+
+/**
+ * Give a job a time limit. Once it runs out, the job is sent SIGTERM, and then SIGKILL a second later if it is still running.
+ * @param job The job to limit.
+ * @param seconds How long the job may run for, from now.
+ */
+void limitJob(Job *job, double seconds);
+
+/**
+ * Find the earliest time that a job runs out of time, or has to be killed after being told to stop.
+ * @param deadline Filled with the time, on the CLOCK_MONOTONIC clock.
+ * @return Whether or not any job has a deadline.
+ */
+bool nextJobDeadline(struct timespec *deadline);
+
+/**
+ * Signal every job whose deadline has passed.
+ * @return Whether or not any job was signalled.
+ */
+bool enforceJobDeadlines(void);
+
+/**
+ * Stop keeping every job to its deadline, such as in a forked copy of the shell, where they are the shell's to keep.
+ */
+void clearJobDeadlines(void);
+
+/**
+ * Wait until a job is no longer running. A foreground job is given the terminal while it runs.
+ * A job that is stopped becomes a background job. A job that finishes is left for the caller to remove.
+ * @param job The job to wait for.
+ * @param foreground Whether or not the job should be given the terminal.
+ * @return The exit status of the job.
+ */
+int waitForJob(Job *job, bool foreground);
+
+/**
+ * Wait until at least one of several jobs is no longer running.
+ * @param candidates The jobs to wait for. NULL entries are skipped.
+ * @param numCandidates The number of entries in candidates.
+ * @return A job that is no longer running, or NULL if none of the jobs are left.
+ */
+Job *waitForAnyJob(Job *candidates[], int numCandidates);
+
+/**
+ * Report every background job that has finished since it was last listed, and remove it from the job table.
+ */
+void notifyJobs(void);
+
+/**
+ * Process a 'jobs' command, listing every job along with its state.
+ * @param cmd The 'jobs' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processJobs(char *cmd[], StdFds fds);
+
+/**
+ * Process a 'wait' command. 'wait' waits for every background job, and 'wait n...' waits for the given jobs.
+ * @param cmd The 'wait' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the last job waited for.
+ */
+int processWait(char *cmd[], StdFds fds);
+
+/**
+ * Process a 'fg' command, continuing a job in the foreground and waiting for it.
+ * @param cmd The 'fg' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the job.
+ */
+int processFg(char *cmd[], StdFds fds);
+
+/**
+ * Process a 'bg' command, continuing a stopped job in the background.
+ * @param cmd The 'bg' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processBg(char *cmd[], StdFds fds);
+
+#endif /* Job_h */
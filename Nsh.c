@@ -0,0 +1,473 @@
+#include "Nsh.h"
+#include "Execute.h"
+
+#include <pthread.h>
+#include <time.h>
+
+/**
+ * A parsed command line: its own copy of the text, and the commands parsed from it, which are never changed again.
+ */
+struct nshCommand {
+    Arena arena;
+    char *text;
+    Node *program;
+};
+
+/**
+ * What a single run of a command line keeps track of, so that runs in different threads share nothing.
+ */
+typedef struct nshRun {
+    StdFds fds;
+    int status; // $?, the status of the last pipeline run
+    int error; // The first NshError met, or kNshSuccess
+    NshResult result;
+} NshRun;
+
+// The command cache belongs to the whole process, so threads take turns looking commands up
+static pthread_mutex_t commandCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @param word The first word of a stage of a pipeline.
+ * @return Whether or not the word names a builtin that only a shell process can run, such as 'cd' or 'export'.
+ * Builtins that only read and write their descriptors are run as the programs of the same name instead.
+ */
+static bool isShellBuiltin(char *word) {
+    static const char *const kProgramBuiltins[] = { "cat", "echo", "false", "printf", "tee", "true" };
+    char *cmd[] = { word, NULL };
+    size_t i;
+    for (i = 0; i < sizeof(kProgramBuiltins) / sizeof(kProgramBuiltins[0]); i++) {
+        if (strcmp(kProgramBuiltins[i], word) == 0) {
+            return false;
+        }
+    }
+    return findBuiltin(cmd, false) != NULL;
+}
+
+/**
+ * Check that a command, and every command linked after it, can run without a shell process.
+ * @param node The first command.
+ * @return Whether or not every command can be run by libnsh.
+ */
+static bool isSupported(const Node *node) {
+    for (; node; node = node->next) {
+        int i, pipesSeen = 0;
+        switch (node->type) {
+            case kNodePipeline:
+                if (node->pipeline.background ||
+                    (node->pipeline.numTokens > 0 && node->pipeline.tokens[0] && assignedNameLength(node->pipeline.tokens[0]) > 0)) {
+                    return false;
+                }
+                for (i = 0; i < node->pipeline.numTokens && node->pipeline.tokens[i]; i++) {
+                    bool startsStage = i == 0 || (pipesSeen < node->pipeline.numPipes &&
+                                                  i == node->pipeline.pipeIndices[pipesSeen] + 1);
+                    if (startsStage && i > 0) {
+                        pipesSeen++;
+                    }
+                    if (strchr(node->pipeline.tokens[i], SUBSTITUTE_UNQUOTED) ||
+                        strchr(node->pipeline.tokens[i], SUBSTITUTE_QUOTED) ||
+                        (startsStage && isShellBuiltin(node->pipeline.tokens[i]))) {
+                        return false;
+                    }
+                }
+                break;
+            
+            case kNodeAnd:
+            case kNodeOr:
+                if (!isSupported(node->left) || !isSupported(node->right)) {
+                    return false;
+                }
+                break;
+            
+            case kNodeIf:
+                if (!isSupported(node->condition) || !isSupported(node->body) || !isSupported(node->alternative)) {
+                    return false;
+                }
+                break;
+            
+            case kNodeWhile:
+            case kNodeUntil:
+                if (!isSupported(node->condition) || !isSupported(node->body)) {
+                    return false;
+                }
+                break;
+            
+            case kNodeFor:
+                return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Parse a command line into a handle that can be run many times.
+ * @param text The command line, which may span several lines.
+ * @param command Set to the new handle, which must be freed with nshFree().
+ * @param detail If not NULL, set to a description of a syntax error, or NULL if there was none.
+ * @return kNshSuccess, kNshSyntaxError, kNshUnsupported, kNshInvalidArgument or kNshSystemError.
+ */
+int nshParse(const char *text, NshCommand **command, const char **detail) {
+    if (detail) {
+        *detail = NULL;
+    }
+    if (text == NULL || command == NULL) {
+        return kNshInvalidArgument;
+    }
+    NshCommand *parsed = calloc(1, sizeof(NshCommand));
+    if (parsed == NULL || (parsed->text = strdup(text)) == NULL) {
+        free(parsed);
+        return kNshSystemError;
+    }
+    int error = parseProgram(parsed->text, strlen(parsed->text), &parsed->arena, &parsed->program);
+    if (error != kParseSuccess) {
+        if (detail) {
+            *detail = describeParseError(error);
+        }
+        nshFree(parsed);
+        return kNshSyntaxError;
+    }
+    if (!isSupported(parsed->program)) {
+        nshFree(parsed);
+        return kNshUnsupported;
+    }
+    *command = parsed;
+    return kNshSuccess;
+}
+
+/**
+ * Add the resources one process used to a running total.
+ * @param total The total to add to. The peak memory is the largest of any process added.
+ * @param usage The resources the process used, as reported by wait4().
+ */
+static void addProcessUsage(struct rusage *total, const struct rusage *usage) {
+    timeradd(&total->ru_utime, &usage->ru_utime, &total->ru_utime);
+    timeradd(&total->ru_stime, &usage->ru_stime, &total->ru_stime);
+    if (usage->ru_maxrss > total->ru_maxrss) {
+        total->ru_maxrss = usage->ru_maxrss;
+    }
+    total->ru_minflt += usage->ru_minflt;
+    total->ru_majflt += usage->ru_majflt;
+    total->ru_inblock += usage->ru_inblock;
+    total->ru_oublock += usage->ru_oublock;
+    total->ru_nvcsw += usage->ru_nvcsw;
+    total->ru_nivcsw += usage->ru_nivcsw;
+}
+
+/**
+ * Close a descriptor that was opened for a stage, leaving the caller's own descriptors alone.
+ * @param fd The descriptor, or -1.
+ * @param run The run the stage belongs to.
+ */
+static void closeStageFd(int fd, const NshRun *run) {
+    if (fd != -1 && fd != run->fds.in && fd != run->fds.out && fd != run->fds.err) {
+        close(fd);
+    }
+}
+
+/**
+ * Open the redirections of a stage, in place of the descriptors it would otherwise use.
+ * @param stage The stage.
+ * @param fds The stage's descriptors, updated with any it is redirected to.
+ * @param run The run the stage belongs to. Errors are reported on its standard error.
+ * @return Whether or not every redirection could be opened.
+ */
+static bool openRedirections(const Stage *stage, StdFds *fds, NshRun *run) {
+    if (stage->inputText || stage->inputFile) {
+        int fd = stage->inputText ? handleInputText(stage->inputText) : open(stage->inputFile, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            dprintf(run->fds.err, "%s: %s\n", stage->inputFile ? stage->inputFile : "<<", strerror(errno));
+            return false;
+        }
+        closeStageFd(fds->in, run);
+        fds->in = fd;
+    }
+    int i;
+    for (i = 0; i < stage->numRedirections; i++) { // In the order they were typed, so 2>&1 copies output as it stands
+        const Redirection *redirection = &stage->redirections[i];
+        int *target = redirection->fd == STDOUT_FILENO ? &fds->out : &fds->err;
+        int *other = redirection->fd == STDOUT_FILENO ? &fds->err : &fds->out;
+        int fd = *other;
+        if (redirection->type != kRedirectDuplicate) {
+            int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (redirection->type == kRedirectAppend ? O_APPEND : O_TRUNC);
+            if ((fd = open(redirection->file, flags, 0666)) == -1) {
+                dprintf(run->fds.err, "%s: %s\n", redirection->file, strerror(errno));
+                return false;
+            }
+        }
+        if (*target != *other) { // Still in use otherwise
+            closeStageFd(*target, run);
+        }
+        *target = fd;
+    }
+    return true;
+}
+
+/**
+ * Launch a single stage of a pipeline with posix_spawn(), never forking the calling program.
+ * @param stage The stage, already expanded.
+ * @param fds The descriptors the stage uses.
+ * @param run The run the stage belongs to. Errors are reported on its standard error.
+ * @param status Set to the stage's exit status, if it could not be launched.
+ * @return The pid of the stage, or -1 if it could not be launched.
+ */
+static pid_t launchStage(const Stage *stage, StdFds fds, NshRun *run, int *status) {
+    char path[PATH_MAX];
+    pthread_mutex_lock(&commandCacheLock);
+    const char *found = resolveCommand(stage->argv[0]);
+    if (found) {
+        snprintf(path, sizeof(path), "%s", found);
+    }
+    pthread_mutex_unlock(&commandCacheLock);
+    if (found == NULL) {
+        dprintf(run->fds.err, "%s: command not found\n", stage->argv[0]);
+        *status = 127;
+        return -1;
+    }
+    pid_t pid = spawnProcess(path, stage->argv, fds, -1);
+    if (pid == -1) {
+        dprintf(run->fds.err, "%s: %s\n", stage->argv[0], strerror(errno));
+        *status = errno == ENOENT ? 127 : 126;
+    }
+    return pid;
+}
+
+/**
+ * Run every stage of a pipeline at once, and wait for all of them to finish.
+ * @param stages The stages of the pipeline, in order, already expanded.
+ * @param numStages The number of stages in the pipeline.
+ * @param run The run the pipeline belongs to, updated with what the pipeline did.
+ * @return The exit status of the pipeline: that of its last stage.
+ */
+static int runStages(Stage stages[], int numStages, NshRun *run) {
+    pid_t *pids = malloc(numStages * sizeof(pid_t));
+    if (pids == NULL) {
+        if (run->error == kNshSuccess) {
+            run->error = kNshSystemError;
+        }
+        return EXIT_FAILURE;
+    }
+    int status = EXIT_SUCCESS, nextIn = run->fds.in, i;
+    run->result.signal = 0;
+    for (i = 0; i < numStages; i++) {
+        StdFds fds = { nextIn, run->fds.out, run->fds.err };
+        nextIn = run->fds.in;
+        if (i < numStages - 1) {
+            int fd[2];
+            if (openPipe(fd) == -1) { // The stages already started see the end of their input, and finish
+                if (run->error == kNshSuccess) {
+                    run->error = kNshSystemError;
+                }
+                closeStageFd(fds.in, run);
+                numStages = i;
+                status = EXIT_FAILURE;
+                break;
+            }
+            fds.out = fd[1];
+            nextIn = fd[0];
+        }
+        
+        pids[i] = -1;
+        status = EXIT_FAILURE;
+        if (openRedirections(&stages[i], &fds, run)) {
+            pids[i] = launchStage(&stages[i], fds, run, &status);
+        }
+        if (pids[i] != -1) {
+            run->result.numProcesses++;
+        }
+        closeStageFd(fds.in, run);
+        closeStageFd(fds.out, run);
+        if (fds.err != fds.out) {
+            closeStageFd(fds.err, run);
+        }
+    }
+    
+    for (i = 0; i < numStages; i++) {
+        if (pids[i] == -1) {
+            continue;
+        }
+        int waitStatus;
+        struct rusage usage;
+        pid_t waited;
+        while ((waited = wait4(pids[i], &waitStatus, 0, &usage)) == -1 && errno == EINTR) {
+        }
+        if (waited == -1) { // Reaped by someone else, so its status is lost
+            status = i == numStages - 1 ? EXIT_FAILURE : status;
+            continue;
+        }
+        addProcessUsage(&run->result.usage, &usage);
+        if (i == numStages - 1) {
+            status = exitStatusOf(waitStatus);
+            run->result.signal = WIFSIGNALED(waitStatus) ? WTERMSIG(waitStatus) : 0;
+        }
+    }
+    free(pids);
+    return status;
+}
+
+/**
+ * Expand and run a single pipeline.
+ * @param pipeline The pipeline, as parsed.
+ * @param run The run the pipeline belongs to, updated with what the pipeline did.
+ * @return The exit status of the pipeline.
+ */
+static int runPipeline(LineInput *pipeline, NshRun *run) {
+    if (pipeline->numTokens == 0 || pipeline->tokens[0] == NULL) {
+        return run->status;
+    }
+    int numStages, status;
+    Stage *stages = buildStages(pipeline, &numStages);
+    if (stages == NULL) {
+        if (numStages == -1 && run->error == kNshSuccess) {
+            run->error = kNshSystemError;
+        }
+        return EXIT_FAILURE;
+    }
+    Arena expansions = {0};
+    if (expandStagesAfter(stages, numStages, run->status, &expansions) == -1) {
+        dprintf(run->fds.err, "Missing a command in the pipeline.\n");
+        status = EXIT_FAILURE;
+    } else {
+        status = runStages(stages, numStages, run);
+    }
+    freeArena(&expansions);
+    free(stages);
+    return status;
+}
+
+/**
+ * Run a command, and every command linked after it, the same way the shell would.
+ * @param node The first command.
+ * @param run The run the commands belong to, updated with what they did.
+ * @return The exit status of the last command run.
+ */
+static int runList(const Node *node, NshRun *run) {
+    int status = run->status;
+    for (; node && run->error == kNshSuccess; node = node->next) {
+        switch (node->type) {
+            case kNodePipeline:
+                status = runPipeline((LineInput *)&node->pipeline, run);
+                break;
+            
+            case kNodeAnd:
+            case kNodeOr:
+                status = runList(node->left, run);
+                if ((status == EXIT_SUCCESS) == (node->type == kNodeAnd) && run->error == kNshSuccess) {
+                    status = runList(node->right, run);
+                }
+                break;
+            
+            case kNodeIf:
+                if (runList(node->condition, run) == EXIT_SUCCESS) {
+                    status = runList(node->body, run);
+                } else {
+                    status = node->alternative ? runList(node->alternative, run) : EXIT_SUCCESS;
+                }
+                break;
+            
+            case kNodeWhile:
+            case kNodeUntil:
+                status = EXIT_SUCCESS;
+                while ((runList(node->condition, run) == EXIT_SUCCESS) == (node->type == kNodeWhile) &&
+                       run->error == kNshSuccess) {
+                    status = runList(node->body, run);
+                }
+                break;
+            
+            case kNodeFor: // Refused by nshParse()
+                break;
+        }
+        run->status = status;
+    }
+    return status;
+}
+
+/**
+ * Run a parsed command line, and wait for it to finish. Safe to call from several threads at once.
+ * @param command The parsed command line.
+ * @param fds The descriptors every command uses as its standard input, output and error, unless redirected.
+ * Errors, such as a command that can't be found, are reported on the last of them.
+ * @param result If not NULL, filled with what running the command line did.
+ * @return kNshSuccess if the command line ran (whatever its exit status), or else kNshInvalidArgument
+ * or kNshSystemError. Commands that had already started are waited for either way.
+ */
+int nshRun(const NshCommand *command, const int fds[3], NshResult *result) {
+    if (command == NULL || fds == NULL || fds[0] < 0 || fds[1] < 0 || fds[2] < 0) {
+        return kNshInvalidArgument;
+    }
+    NshRun run;
+    memset(&run, 0, sizeof(run));
+    run.fds = (StdFds){ fds[0], fds[1], fds[2] };
+    run.status = EXIT_SUCCESS;
+    run.error = kNshSuccess;
+    
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run.result.status = runList(command->program, &run);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    run.result.seconds = secondsBetween(&start, &end);
+    if (result) {
+        *result = run.result;
+    }
+    return run.error;
+}
+
+/**
+ * Parse and run a command line once, with the calling process's own standard input, output and error:
+ * a replacement for system() that starts no shell.
+ * @param text The command line.
+ * @return The exit status of the command line, 2 if it could not be parsed, or -1 (with errno set) if it could not run.
+ */
+int nshSystem(const char *text) {
+    NshCommand *command;
+    const char *detail;
+    int error = nshParse(text, &command, &detail);
+    if (error == kNshInvalidArgument) {
+        errno = EINVAL;
+        return -1;
+    } else if (error == kNshSystemError) { // errno is left as the failed call set it
+        return -1;
+    } else if (error != kNshSuccess) {
+        fprintf(stderr, "nsh: %s\n", detail ? detail : nshDescribeError(error));
+        return 2;
+    }
+    const int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    NshResult result;
+    error = nshRun(command, fds, &result);
+    int savedErrno = errno;
+    nshFree(command);
+    errno = savedErrno;
+    return error == kNshSuccess ? result.status : -1;
+}
+
+/**
+ * Free a parsed command line. It must not be running in any thread.
+ * @param command The command line, or NULL.
+ */
+void nshFree(NshCommand *command) {
+    if (command == NULL) {
+        return;
+    }
+    freeArena(&command->arena);
+    free(command->text);
+    free(command);
+}
+
+/**
+ * @param error An error returned by libnsh.
+ * @return A description of the error.
+ */
+const char *nshDescribeError(int error) {
+    switch (error) {
+        case kNshSuccess:
+            return "Success";
+        case kNshSyntaxError:
+            return "Syntax error";
+        case kNshUnsupported:
+            return "Needs a shell process (builtins like cd, variables, for loops, command substitution or background jobs)";
+        case kNshInvalidArgument:
+            return "Invalid argument";
+        case kNshSystemError:
+            return "Unable to allocate memory or create a pipe or process";
+        default:
+            return "Unknown error";
+    }
+}
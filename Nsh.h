@@ -0,0 +1,93 @@
+#ifndef Nsh_h
+#define Nsh_h
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/**
+ * libnsh runs shell command lines from within another program, in place of system() or popen(), without starting
+ * /bin/sh for each one. A command line is parsed once into a handle, which can then be run any number of times,
+ * from any number of threads at once, with whatever descriptors the caller chooses.
+ *
+ * Command lines may hold pipelines, redirections (<, >, >>, 2>, &>, 2>&1, >&2, here-documents and here-strings),
+ * quoting, wildcards, ;, &&, ||, if, while and until. $name is read from the environment, $? is the status of the run's previous pipeline, and
+ * $$ is the calling process. Every command is run as a program, so echo, printf, cat, tee, true and false are the
+ * programs of those names. Command lines using the shell's other builtins (such as cd, export or jobs), variables of
+ * the shell's own, for loops, command substitution or background jobs are refused with kNshUnsupported,
+ * as all of those belong to a shell process.
+ *
+ * Children are waited for by pid, so the calling program must not reap children it did not start itself
+ * (such as with waitpid(-1, ...) from a SIGCHLD handler).
+ */
+
+/**
+ * The errors that libnsh reports, rather than exiting. Running out of memory for the words of a command line
+ * (while parsing or expanding them) still ends the process.
+ */
+typedef enum nshError {
+    kNshSuccess = 0,
+    kNshSyntaxError, // The command line could not be parsed
+    kNshUnsupported, // The command line uses something that only a shell process can do
+    kNshInvalidArgument,
+    kNshSystemError // Memory, a pipe or a process could not be allocated. errno is left as the system set it
+} NshError;
+
+/**
+ * A parsed command line. Never changed by running it, so any number of threads may run it at once.
+ */
+typedef struct nshCommand NshCommand;
+
+/**
+ * What running a command line did.
+ */
+typedef struct nshResult {
+    int status; // The exit status of the last pipeline run, or 128 + the signal that killed it, as the shell reports it
+    int signal; // The signal that killed the last process of the last pipeline, or 0
+    int numProcesses; // How many processes were started, in every pipeline
+    double seconds; // How long the whole command line took to run
+    struct rusage usage; // The resources every process used, added together
+} NshResult;
+
+/**
+ * Parse a command line into a handle that can be run many times.
+ * @param text The command line, which may span several lines.
+ * @param command Set to the new handle, which must be freed with nshFree().
+ * @param detail If not NULL, set to a description of a syntax error, or NULL if there was none.
+ * @return kNshSuccess, kNshSyntaxError, kNshUnsupported, kNshInvalidArgument or kNshSystemError.
+ */
+int nshParse(const char *text, NshCommand **command, const char **detail);
+
+/**
+ * Run a parsed command line, and wait for it to finish. Safe to call from several threads at once.
+ * @param command The parsed command line.
+ * @param fds The descriptors every command uses as its standard input, output and error, unless redirected.
+ * Errors, such as a command that can't be found, are reported on the last of them.
+ * @param result If not NULL, filled with what running the command line did.
+ * @return kNshSuccess if the command line ran (whatever its exit status), or else kNshInvalidArgument
+ * or kNshSystemError. Commands that had already started are waited for either way.
+ */
+int nshRun(const NshCommand *command, const int fds[3], NshResult *result);
+
+/**
+ * Parse and run a command line once, with the calling process's own standard input, output and error:
+ * a replacement for system() that starts no shell.
+ * @param text The command line.
+ * @return The exit status of the command line, 2 if it could not be parsed, or -1 (with errno set) if it could not run.
+ */
+int nshSystem(const char *text);
+
+/**
+ * Free a parsed command line. It must not be running in any thread.
+ * @param command The command line, or NULL.
+ */
+void nshFree(NshCommand *command);
+
+/**
+ * @param error An error returned by libnsh.
+ * @return A description of the error.
+ */
+const char *nshDescribeError(int error);
+
+#endif /* Nsh_h */
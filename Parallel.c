@@ -0,0 +1,184 @@
+#include "Parallel.h"
+#include "Execute.h"
+#include "ParseCache.h"
+#include "Transfer.h"
+
+#include <time.h>
+
+/**
+ * @return The current time in seconds, from a monotonic clock.
+ */
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/**
+ * Parse a task's command and start it in a forked copy of the shell, which runs it just as the prompt would,
+ * with its output (and error output) going to a capture file.
+ * A task that can't be started is marked as finished straight away.
+ * @param task The task to start.
+ * @param inputFd The descriptor the task reads its input from, unless it redirects it.
+ */
+static void startTask(ParallelTask *task, int inputFd) {
+    task->job = NULL;
+    task->error = NULL;
+    task->captureFd = -1;
+    task->finished = true;
+    
+    int error;
+    ParsedLine *parsed = acquireParsedLine(task->command, strlen(task->command), &error);
+    if (parsed == NULL) {
+        task->error = describeParseError(error); // Reported in order, along with the task's status
+        task->status = 2;
+        return;
+    }
+    if ((task->captureFd = openMemoryFile("nsh-parallel")) == -1) {
+        perror("parallel: Unable to create a capture file");
+        releaseParsedLine(parsed);
+        task->status = EXIT_FAILURE;
+        return;
+    }
+    
+    StdFds fds = { inputFd, task->captureFd, task->captureFd };
+    task->job = startSubshell(parsed->program, task->command, fds, -1);
+    task->finished = false;
+    releaseParsedLine(parsed); // The copy has commands of its own
+}
+
+/**
+ * Print a finished task's captured output, followed by its exit status, and release it.
+ * @param task The task to print.
+ * @param fds Where the output and the exit status are printed.
+ */
+static void printTask(ParallelTask *task, StdFds fds) {
+    if (task->captureFd != -1) {
+        lseek(task->captureFd, 0, SEEK_SET);
+        if (transferData(task->captureFd, fds.out) == -1) {
+            dprintf(fds.err, "parallel: Unable to write output: %s\n", strerror(errno));
+        }
+        close(task->captureFd);
+    }
+    if (task->error) {
+        dprintf(fds.err, "parallel: [%ld] Syntax error: %s.\n", task->number, task->error);
+    }
+    dprintf(fds.err, "parallel: [%ld] exit %d: %s\n", task->number, task->status, task->command);
+    free(task->command);
+}
+
+/**
+ * Process a 'parallel' command: 'parallel [-j N] [file]'.
+ * Every line of the file (or of standard input, given as fds.in) is parsed and run as its own job, just as it would be
+ * at the prompt, with at most N running at once.
+ * N defaults to the number of online CPUs. Each job's output is captured and printed in the order the lines were given,
+ * followed by its exit status, and a summary of failures and wall time is printed at the end.
+ * @param cmd The 'parallel' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return 0 if every job succeeded, 1 otherwise.
+ */
+int processParallel(char *cmd[], StdFds fds) {
+    long numWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *path = NULL;
+    int i;
+    for (i = 1; cmd[i]; i++) {
+        if (strncmp(cmd[i], "-j", 2) == 0) {
+            const char *count = cmd[i][2] ? &cmd[i][2] : cmd[++i];
+            if (count == NULL || (numWorkers = atol(count)) < 1) {
+                dprintf(fds.err, "parallel: -j needs a positive number of jobs\n");
+                return EXIT_FAILURE;
+            }
+        } else {
+            path = cmd[i];
+        }
+    }
+    if (numWorkers < 1) {
+        numWorkers = 1;
+    }
+    
+    FILE *input = stdin;
+    if (path && (input = fopen(path, "r")) == NULL) {
+        dprintf(fds.err, "parallel: %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    } else if (path == NULL && fds.in != STDIN_FILENO && (input = fdopen(dup(fds.in), "r")) == NULL) {
+        dprintf(fds.err, "parallel: Unable to read the list of commands: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    int devNull = open("/dev/null", O_RDONLY | O_CLOEXEC); // Jobs must not compete for the list of commands
+    
+    // Finished tasks wait in a window until every task before them has been printed,
+    // which bounds how many capture files can be open at once.
+    long window = numWorkers * 16;
+    ParallelTask *tasks = calloc(window, sizeof(ParallelTask));
+    Job **running = calloc(window, sizeof(Job *));
+    if (tasks == NULL || running == NULL) {
+        perror("Unable to allocate memory.\n\r");
+        exit(EXIT_FAILURE);
+    }
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    long started = 0, printed = 0, numRunning = 0, numFailed = 0;
+    bool moreInput = true;
+    double startTime = now();
+    
+    while (moreInput || printed < started) {
+        // Start as many tasks as there are free workers
+        while (moreInput && numRunning < numWorkers && started - printed < window) {
+            ssize_t length = getline(&line, &lineCapacity, input);
+            if (length == -1) {
+                moreInput = false;
+                break;
+            }
+            line[strcspn(line, "\n")] = '\0';
+            if (line[strspn(line, " \t")] == '\0' || line[0] == '#') {
+                continue;
+            }
+            ParallelTask *task = &tasks[started % window];
+            task->number = ++started;
+            task->command = strdup(line);
+            startTask(task, devNull);
+            if (!task->finished) {
+                running[(task->number - 1) % window] = task->job;
+                numRunning++;
+            }
+        }
+        
+        // Print every finished task whose turn has come
+        while (printed < started && tasks[printed % window].finished) {
+            ParallelTask *task = &tasks[printed % window];
+            if (task->status != EXIT_SUCCESS) {
+                numFailed++;
+            }
+            printTask(task, fds);
+            printed++;
+        }
+        
+        // Wait for a worker to free up
+        if (numRunning > 0) {
+            Job *job = waitForAnyJob(running, window);
+            long j;
+            for (j = 0; j < window; j++) {
+                if (running[j] == job) {
+                    running[j] = NULL;
+                    tasks[j].status = jobExitStatus(job);
+                    tasks[j].finished = true;
+                    tasks[j].job = NULL;
+                }
+            }
+            removeJob(job);
+            numRunning--;
+        }
+    }
+    
+    dprintf(fds.err, "parallel: %ld jobs, %ld failed, %.3f s\n", started, numFailed, now() - startTime);
+    free(line);
+    free(tasks);
+    free(running);
+    if (devNull != -1) {
+        close(devNull);
+    }
+    if (input != stdin) {
+        fclose(input);
+    }
+    return numFailed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
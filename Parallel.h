@@ -0,0 +1,38 @@
+#ifndef Parallel_h
+#define Parallel_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "Job.h"
+
+/**
+ * A command line given to 'parallel', along with the job running it and the file its output is captured in.
+ */
+typedef struct parallelTask {
+    long number;
+    char *command;
+    const char *error;
+    Job *job;
+    int captureFd;
+    int status;
+    bool finished;
+} ParallelTask;
+
+/**
+ * Process a 'parallel' command: 'parallel [-j N] [file]'.
+ * Every line of the file (or of standard input, given as fds.in) is parsed and run as its own job, just as it would be
+ * at the prompt, with at most N running at once.
+ * N defaults to the number of online CPUs. Each job's output is captured and printed in the order the lines were given,
+ * followed by its exit status, and a summary of failures and wall time is printed at the end.
+ * @param cmd The 'parallel' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return 0 if every job succeeded, 1 otherwise.
+ */
+int processParallel(char *cmd[], StdFds fds);
+
+#endif /* Parallel_h */
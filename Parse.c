@@ -1,106 +1,1057 @@
 #include "Parse.h"
+#include "Trace.h"
 
-// An arbitrary character limit used for this assignment in lines.
-const int kCharLimit = 10000;
+#include <ctype.h>
 
 /**
- * Parse a given line by tokenizing it and placings its components into a LineInput structure.
- * @param line The line that the user inputted, which is to be parsed.
- * @param lineInput A structure containing the logical parsing of the line, which is filled by this function.
- * @return 0 if success, a non-zero integer otherwise.
+ * The quoting context that the lexer is in.
  */
-int parse(char *line, LineInput *lineInput) {
-    // Remove the trailing new line if one exists
-    if (strchr(line, '\n')) {
-        line[strcspn(line, "\n")] = 0;
-    }
-    printf("%s\n", line);
-    
-    char *tokens[kCharLimit];
-    
-    // to start with, assume no redirection
-    lineInput->redirectedOutputIndex = -1;
+typedef enum lexState {
+    kUnquoted,
+    kSingleQuoted,
+    kDoubleQuoted
+} LexState;
+
+/**
+ * Prepare an empty LineInput that allocates from the given arena.
+ * @param lineInput The structure to prepare.
+ * @param arena The arena that tokens are allocated from. Tokens stay valid until the arena is reset.
+ */
+void initLineInput(LineInput *lineInput, Arena *arena) {
+    memset(lineInput, 0, sizeof(LineInput));
+    lineInput->arena = arena;
     lineInput->redirectedInputIndex = -1;
+    lineInput->redirectedOutputIndex = -1;
+}
+
+/**
+ * Append a token to a LineInput, doubling its token array when it is full.
+ * The array is always kept NULL-terminated.
+ * @param lineInput The structure to add the token to.
+ * @param token The token to add.
+ */
+static void addToken(LineInput *lineInput, char *token) {
+    if (lineInput->numTokens + 1 >= lineInput->tokenCapacity) {
+        int capacity = lineInput->tokenCapacity ? lineInput->tokenCapacity * 2 : 16;
+        char **tokens = arenaAlloc(lineInput->arena, capacity * sizeof(char *));
+        if (lineInput->numTokens) {
+            memcpy(tokens, lineInput->tokens, lineInput->numTokens * sizeof(char *));
+        }
+        lineInput->tokens = tokens;
+        lineInput->tokenCapacity = capacity;
+    }
+    lineInput->tokens[lineInput->numTokens++] = token;
+    lineInput->tokens[lineInput->numTokens] = NULL;
+}
+
+/**
+ * Record that the most recently added token is a | operator, doubling the pipe index array when it is full.
+ * @param lineInput The structure to add the pipe to.
+ */
+static void addPipe(LineInput *lineInput) {
+    if (lineInput->numPipes == lineInput->pipeCapacity) {
+        int capacity = lineInput->pipeCapacity ? lineInput->pipeCapacity * 2 : 4;
+        int *pipeIndices = arenaAlloc(lineInput->arena, capacity * sizeof(int));
+        if (lineInput->numPipes) {
+            memcpy(pipeIndices, lineInput->pipeIndices, lineInput->numPipes * sizeof(int));
+        }
+        lineInput->pipeIndices = pipeIndices;
+        lineInput->pipeCapacity = capacity;
+    }
+    lineInput->pipeIndices[lineInput->numPipes++] = lineInput->numTokens - 1;
+}
+
+/**
+ * Record that the most recently added token is a redirection operator, doubling the redirection index array when it is full.
+ * @param lineInput The structure to add the redirection to.
+ */
+static void addRedirection(LineInput *lineInput) {
+    if (lineInput->numRedirections == lineInput->redirectionCapacity) {
+        int capacity = lineInput->redirectionCapacity ? lineInput->redirectionCapacity * 2 : 4;
+        int *redirectionIndices = arenaAlloc(lineInput->arena, capacity * sizeof(int));
+        if (lineInput->numRedirections) {
+            memcpy(redirectionIndices, lineInput->redirectionIndices, lineInput->numRedirections * sizeof(int));
+        }
+        lineInput->redirectionIndices = redirectionIndices;
+        lineInput->redirectionCapacity = capacity;
+    }
+    lineInput->redirectionIndices[lineInput->numRedirections++] = lineInput->numTokens - 1;
+}
+
+/**
+ * @param operator A redirection operator.
+ * @return Whether or not the operator joins one output to another (2>&1 or >&2), rather than being followed by a file.
+ */
+bool isDuplicatingRedirection(const char *operator) {
+    return strchr(operator, '&') != NULL && operator[0] != '&';
+}
+
+/**
+ * The words and operators found so far, and the word that is being built.
+ */
+typedef struct lexer {
+    Parser *parser;
+    char *out; // Where the next character of a word is written
+    char *word; // The start of the word being built, if any
+    const char *wordStart;
+    bool quoted;
+    int lineNumber, wordLine;
+    int hereDocuments; // The first token that may be a << still waiting for its body, or -1
+} Lexer;
+
+/**
+ * Append a token to a parser, doubling its token array when it is full.
+ * @param parser The parser to add the token to.
+ * @param kind The kind of token.
+ * @param text The token's text.
+ * @param quoted Whether or not any part of the token was quoted or escaped.
+ * @param start Where the token starts in the parser's text.
+ * @param lineNumber The line the token starts on.
+ */
+static void addLexeme(Parser *parser, TokenKind kind, char *text, bool quoted, const char *start, int lineNumber) {
+    if (parser->numTokens == parser->tokenCapacity) {
+        int capacity = parser->tokenCapacity ? parser->tokenCapacity * 2 : 16;
+        Token *tokens = arenaAlloc(parser->arena, capacity * sizeof(Token));
+        if (parser->numTokens) {
+            memcpy(tokens, parser->tokens, parser->numTokens * sizeof(Token));
+        }
+        parser->tokens = tokens;
+        parser->tokenCapacity = capacity;
+    }
+    parser->tokens[parser->numTokens++] = (Token){ kind, text, quoted, start, lineNumber };
+}
+
+/**
+ * Finish the word being built, if there is one.
+ * @param lexer The lexer.
+ */
+static void endWord(Lexer *lexer) {
+    if (lexer->word) {
+        Parser *parser = lexer->parser;
+        Token *previous = parser->numTokens ? &parser->tokens[parser->numTokens - 1] : NULL;
+        if (previous && previous->kind == kTokenInput && strcmp(previous->text, "<<<") == 0) {
+            *lexer->out++ = '\n'; // A here-string ends in a newline, just like a here-document
+        }
+        *lexer->out++ = '\0';
+        addLexeme(lexer->parser, kTokenWord, lexer->word, lexer->quoted, lexer->wordStart, lexer->wordLine);
+        lexer->word = NULL;
+    }
+}
+
+/**
+ * End any word before an operator, and add the operator as a token of its own.
+ * @param lexer The lexer.
+ * @param kind The kind of operator.
+ * @param text The operator's text.
+ * @param start Where the operator starts in the parser's text.
+ */
+static void addOperator(Lexer *lexer, TokenKind kind, const char *text, const char *start) {
+    endWord(lexer);
+    char *operator = lexer->out;
+    lexer->out = stpcpy(lexer->out, text) + 1;
+    addLexeme(lexer->parser, kind, operator, false, start, lexer->lineNumber);
+}
+
+/**
+ * Write the expansion starting at a $ into the word being built, as a marker, the variable's name and EXPAND_END.
+ * A $ that is not followed by a name, {name}, ? or $ is just a $.
+ * @param lexer The lexer.
+ * @param c The $.
+ * @param end The end of the text.
+ * @param marker EXPAND_UNQUOTED or EXPAND_QUOTED.
+ * @return The last character of the expansion.
+ */
+static const char *lexExpansion(Lexer *lexer, const char *c, const char *end, char marker) {
+    const char *name = c + 1, *nameEnd = name, *last;
+    if (name < end && (isalpha((unsigned char)*name) || *name == '_')) {
+        while (nameEnd < end && (isalnum((unsigned char)*nameEnd) || *nameEnd == '_')) {
+            nameEnd++;
+        }
+        last = nameEnd - 1;
+    } else if (name < end && (*name == '?' || *name == '$')) {
+        last = name;
+        nameEnd = name + 1;
+    } else if (name < end && *name == '{' && (nameEnd = memchr(name, '}', end - name)) != NULL) {
+        last = nameEnd; // The closing brace
+        name++;
+    } else {
+        *lexer->out++ = '$';
+        return c;
+    }
+    *lexer->out++ = marker;
+    memcpy(lexer->out, name, nameEnd - name);
+    lexer->out += nameEnd - name;
+    *lexer->out++ = EXPAND_END;
+    return last;
+}
+
+/**
+ * Find the parenthesis that closes a $(, skipping over quotes and any parentheses nested within.
+ * @param c The ( that follows the $.
+ * @param end The end of the text.
+ * @return The closing parenthesis, or NULL if there is none.
+ */
+static const char *findClosingParenthesis(const char *c, const char *end) {
+    int depth = 0;
+    for (; c < end; c++) {
+        if (*c == '\\') {
+            c++;
+        } else if (*c == '\'') {
+            if ((c = memchr(c + 1, '\'', end - c - 1)) == NULL) {
+                return NULL;
+            }
+        } else if (*c == '"') {
+            for (c++; c < end && *c != '"'; c++) {
+                c += *c == '\\';
+            }
+        } else if (*c == '(') {
+            depth++;
+        } else if (*c == ')' && --depth == 0) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Write the command substitution starting at a $( or ` into the word being built, as a marker,
+ * the command's text and EXPAND_END. The command is only parsed when it runs.
+ * Within backquotes, a \ before another \, a ` or a $ is removed, as it only stops that character ending the command.
+ * @param lexer The lexer.
+ * @param c The $ of a $(, or the opening `.
+ * @param end The end of the text.
+ * @param marker SUBSTITUTE_UNQUOTED or SUBSTITUTE_QUOTED.
+ * @return The closing ) or `, or NULL if there is none.
+ */
+static const char *lexSubstitution(Lexer *lexer, const char *c, const char *end, char marker) {
+    const char *close;
+    *lexer->out++ = marker;
+    if (*c == '$') {
+        if ((close = findClosingParenthesis(c + 1, end)) == NULL) {
+            return NULL;
+        }
+        memcpy(lexer->out, c + 2, close - c - 2);
+        lexer->out += close - c - 2;
+    } else {
+        for (close = c + 1; close < end && *close != '`'; close++) {
+            if (*close == '\\' && close + 1 < end && strchr("\\`$", close[1])) {
+                close++;
+            }
+            *lexer->out++ = *close;
+        }
+        if (close == end) {
+            return NULL;
+        }
+    }
+    for (; c < close; c++) { // The command may span several lines
+        lexer->lineNumber += *c == '\n';
+    }
+    *lexer->out++ = EXPAND_END;
+    return close;
+}
+
+/**
+ * @param parser The parser.
+ * @param i The index of one of the parser's tokens.
+ * @return Whether or not the token is a << or <<- followed by its delimiter, and so has a body to read.
+ */
+static bool startsHereDocument(Parser *parser, int i) {
+    Token *token = &parser->tokens[i];
+    return token->kind == kTokenInput && (strcmp(token->text, "<<") == 0 || strcmp(token->text, "<<-") == 0) &&
+           i + 1 < parser->numTokens && parser->tokens[i + 1].kind == kTokenWord;
+}
+
+/**
+ * Write one line of a here-document's body, along with its newline, into the lexer's buffer.
+ * Unless the body is literal, its expansions and command substitutions are kept as markers (which never split),
+ * and a \ before a $, ` or another \ is removed.
+ * @param lexer The lexer.
+ * @param line The start of the line.
+ * @param lineEnd The end of the line, not including its newline.
+ * @param literal Whether or not the body's delimiter was quoted.
+ * @return 0 if success, a ParseError otherwise.
+ */
+static int lexBodyLine(Lexer *lexer, const char *line, const char *lineEnd, bool literal) {
+    const char *c;
+    for (c = line; c < lineEnd; c++) {
+        if (literal) {
+            *lexer->out++ = *c;
+        } else if (*c == '\\' && c + 1 < lineEnd && strchr("\\$`", c[1])) {
+            *lexer->out++ = *++c;
+        } else if ((*c == '$' && c + 1 < lineEnd && c[1] == '(') || *c == '`') {
+            if ((c = lexSubstitution(lexer, c, lineEnd, SUBSTITUTE_QUOTED)) == NULL) {
+                return kParseUnterminatedSubstitution;
+            }
+        } else if (*c == '$') {
+            c = lexExpansion(lexer, c, lineEnd, EXPAND_QUOTED);
+        } else {
+            *lexer->out++ = *c;
+        }
+    }
+    *lexer->out++ = '\n';
+    return kParseSuccess;
+}
+
+/**
+ * Read the bodies of the here-documents (<< and <<-) started on the line that just ended. The bodies follow the line
+ * in order, each running up to a line holding nothing but its delimiter, and each becomes the text of its delimiter's
+ * token. <<- removes the tabs that every line of its body (and its delimiter's line) starts with.
+ * @param lexer The lexer, which has just added the newline ending the line.
+ * @param c The newline. Set to the last character of the last delimiter's line.
+ * @param end The end of the text.
+ * @return 0 if success, a ParseError otherwise.
+ */
+static int lexHereDocuments(Lexer *lexer, const char **c, const char *end) {
+    Parser *parser = lexer->parser;
+    const char *next = *c + 1; // The start of the next line
+    int i;
+    for (i = lexer->hereDocuments; i < parser->numTokens; i++) {
+        if (!startsHereDocument(parser, i)) {
+            continue;
+        }
+        Token *delimiter = &parser->tokens[i + 1];
+        bool stripTabs = parser->tokens[i].text[2] == '-';
+        size_t delimiterLength = strlen(delimiter->text);
+        char *body = lexer->out;
+        while (true) {
+            if (next >= end) {
+                parser->errorLine = parser->tokens[i].lineNumber;
+                return kParseUnterminatedHereDocument;
+            }
+            const char *line = next, *lineEnd;
+            while (stripTabs && line < end && *line == '\t') {
+                line++;
+            }
+            if ((lineEnd = memchr(line, '\n', end - line)) == NULL) {
+                lineEnd = end;
+            }
+            next = lineEnd + 1;
+            if ((size_t)(lineEnd - line) == delimiterLength && memcmp(line, delimiter->text, delimiterLength) == 0) {
+                lexer->lineNumber += lineEnd < end;
+                break;
+            }
+            if (lexBodyLine(lexer, line, lineEnd, delimiter->quoted)) {
+                parser->errorLine = lexer->lineNumber;
+                return kParseUnterminatedSubstitution;
+            }
+            lexer->lineNumber++;
+        }
+        *lexer->out++ = '\0';
+        delimiter->text = body;
+        delimiter->quoted = true;
+    }
+    lexer->hereDocuments = -1;
+    *c = next - 1 < end ? next - 1 : end - 1;
+    return kParseSuccess;
+}
+
+/**
+ * Split text into words and operators in a single pass, handling quotes, escapes, expansions, comments and here-documents.
+ * @param parser The parser to fill with tokens, which always end with a kTokenEnd.
+ * @param text The text to split.
+ * @param length The number of characters in the text.
+ * @return 0 if success, a ParseError otherwise.
+ */
+static int lex(Parser *parser, const char *text, size_t length) {
+    const char *end = text + length;
+    // Every token is written into a single buffer. A word is never longer than the text it came from,
+    // an operator takes at most three bytes for its two characters, an expansion three bytes for its two,
+    // and a wildcard two bytes for its one, so twice the text's length is always enough.
+    // A here-document's body takes no more than the lines it came from.
+    Lexer lexer = { parser, arenaAlloc(parser->arena, 2 * length + 2), NULL, NULL, false, 1, 1, -1 };
+    LexState state = kUnquoted;
+    int quoteLine = 1, error;
     
-    // Split the line into tokens.
-    char *token = strtok(line, " ");
-    
-    int i = 0;
-    for (i = 0; token != NULL; i++) {
-        lineInput->tokens[i] = token;
-        lineInput->numTokens++;
-        tokens[i] = token;
-        if (token[0] == '|' && token[1] == '\0') { // | operator
-            lineInput->pipeIndices[lineInput->numPipes] = i;
-            lineInput->numPipes++;
-        } else if (token[0] == '<' && token[1] == '\0') { // < operator
-            lineInput->redirectedInputIndex = i; // The index of the token to be redirected
-            // Offset each further array element to the left, to remove this element.
-            token = strtok(NULL, " ");
+    const char *c;
+    for (c = text; c < end; c++) {
+        if (state == kSingleQuoted) { // Everything is literal until the closing quote
+            if (*c == '\'') {
+                state = kUnquoted;
+            } else {
+                lexer.lineNumber += *c == '\n';
+                *lexer.out++ = *c;
+            }
             continue;
-        } else if (token[0] == '>' && token[1] == '\0') { // > operator
-            lineInput->redirectedOutputIndex = i; // The index of the token to be redirected
-            // Offset each further array element to the left, to remove this element.
-            token = strtok(NULL, " ");
+        } else if (state == kDoubleQuoted) { // Only \ before one of " \ $ ` or a newline is an escape
+            if (*c == '"') {
+                state = kUnquoted;
+            } else if (*c == '\\' && c + 1 < end && c[1] == '\n') { // A line continuation
+                c++;
+                lexer.lineNumber++;
+            } else if (*c == '\\' && c + 1 < end && strchr("\"\\$`", c[1])) {
+                *lexer.out++ = *++c;
+            } else if ((*c == '$' && c + 1 < end && c[1] == '(') || *c == '`') {
+                if ((c = lexSubstitution(&lexer, c, end, SUBSTITUTE_QUOTED)) == NULL) {
+                    parser->errorLine = lexer.lineNumber;
+                    return kParseUnterminatedSubstitution;
+                }
+            } else if (*c == '$') {
+                c = lexExpansion(&lexer, c, end, EXPAND_QUOTED);
+            } else {
+                lexer.lineNumber += *c == '\n';
+                *lexer.out++ = *c;
+            }
             continue;
-            // Do nothing for part 1
-        } else if (token[0] == '-' || token[0] == '\342') { // Arguments
-            // Do nothing special with arguments for part 1
         }
-        token = strtok(NULL, " ");
+        
+        switch (*c) {
+            case ' ':
+            case '\t': // End of a word
+                endWord(&lexer);
+                break;
+                
+            case '\n':
+                addOperator(&lexer, kTokenNewline, "\n", c);
+                lexer.lineNumber++;
+                if (lexer.hereDocuments != -1 && (error = lexHereDocuments(&lexer, &c, end))) {
+                    return error;
+                }
+                break;
+                
+            case ';':
+                addOperator(&lexer, kTokenSeparator, ";", c);
+                break;
+                
+            case '<':
+                if (c + 2 < end && c[1] == '<' && c[2] == '<') { // A here-string
+                    addOperator(&lexer, kTokenInput, "<<<", c);
+                    c += 2;
+                } else if (c + 1 < end && c[1] == '<') { // A here-document, whose body starts on the next line
+                    bool stripTabs = c + 2 < end && c[2] == '-';
+                    addOperator(&lexer, kTokenInput, stripTabs ? "<<-" : "<<", c);
+                    if (lexer.hereDocuments == -1) {
+                        lexer.hereDocuments = parser->numTokens - 1;
+                    }
+                    c += 1 + stripTabs;
+                } else {
+                    addOperator(&lexer, kTokenInput, "<", c);
+                }
+                break;
+                
+            case '>':
+                if (c + 2 < end && c[1] == '&' && c[2] == '2') { // Output goes wherever error output does
+                    addOperator(&lexer, kTokenOutput, ">&2", c);
+                    c += 2;
+                } else if (c + 1 < end && c[1] == '>') {
+                    addOperator(&lexer, kTokenOutput, ">>", c++);
+                } else {
+                    addOperator(&lexer, kTokenOutput, ">", c);
+                }
+                break;
+                
+            case '|':
+                if (c + 1 < end && c[1] == '|') {
+                    addOperator(&lexer, kTokenOr, "||", c++);
+                } else {
+                    addOperator(&lexer, kTokenPipe, "|", c);
+                }
+                break;
+                
+            case '&':
+                if (c + 1 < end && c[1] == '>') { // Both output and error output go to the file
+                    bool append = c + 2 < end && c[2] == '>';
+                    addOperator(&lexer, kTokenOutput, append ? "&>>" : "&>", c);
+                    c += 1 + append;
+                } else if (c + 1 < end && c[1] == '&') {
+                    addOperator(&lexer, kTokenAnd, "&&", c++);
+                } else {
+                    addOperator(&lexer, kTokenBackground, "&", c);
+                }
+                break;
+                
+            case '#':
+                if (lexer.word == NULL) { // A comment runs to the end of the line
+                    while (c + 1 < end && c[1] != '\n') {
+                        c++;
+                    }
+                    break;
+                }
+                *lexer.out++ = *c;
+                break;
+                
+            default:
+                if (*c == '\\' && c + 1 < end && c[1] == '\n') { // A line continuation, which is not part of any word
+                    c++;
+                    lexer.lineNumber++;
+                    break;
+                }
+                if (*c == '2' && lexer.word == NULL && c + 1 < end && c[1] == '>') { // Redirects error output
+                    if (c + 3 < end && c[2] == '&' && c[3] == '1') { // Error output goes wherever output does
+                        addOperator(&lexer, kTokenOutput, "2>&1", c);
+                        c += 3;
+                    } else {
+                        bool append = c + 2 < end && c[2] == '>';
+                        addOperator(&lexer, kTokenOutput, append ? "2>>" : "2>", c);
+                        c += 1 + append;
+                    }
+                    break;
+                }
+                if (lexer.word == NULL) {
+                    lexer.word = lexer.out;
+                    lexer.wordStart = c;
+                    lexer.wordLine = lexer.lineNumber;
+                    lexer.quoted = false;
+                }
+                if (*c == '\'' || *c == '"') {
+                    state = *c == '\'' ? kSingleQuoted : kDoubleQuoted;
+                    quoteLine = lexer.lineNumber;
+                    lexer.quoted = true;
+                } else if (*c == '\\') { // Outside of quotes, \ makes the next character literal
+                    if (c + 1 < end) {
+                        *lexer.out++ = *++c;
+                    }
+                    lexer.quoted = true;
+                } else if ((*c == '$' && c + 1 < end && c[1] == '(') || *c == '`') {
+                    if ((c = lexSubstitution(&lexer, c, end, SUBSTITUTE_UNQUOTED)) == NULL) {
+                        parser->errorLine = lexer.wordLine;
+                        return kParseUnterminatedSubstitution;
+                    }
+                } else if (*c == '$') {
+                    c = lexExpansion(&lexer, c, end, EXPAND_UNQUOTED);
+                } else if (*c == '*' || *c == '?' || *c == '[') {
+                    *lexer.out++ = GLOB_MARKER;
+                    *lexer.out++ = *c;
+                } else {
+                    *lexer.out++ = *c;
+                }
+                break;
+        }
+    }
+    
+    if (state != kUnquoted) {
+        parser->errorLine = quoteLine;
+        return kParseUnterminatedQuote;
+    }
+    endWord(&lexer);
+    const char *last = end - 1; // A here-document started on the last line has no body at all
+    if (lexer.hereDocuments != -1 && (error = lexHereDocuments(&lexer, &last, end))) {
+        return error;
     }
-    stripEscapeChars(lineInput);
-    processQuotes(lineInput);
-    return 0;
+    addLexeme(parser, kTokenEnd, "", false, end, lexer.lineNumber);
+    return kParseSuccess;
 }
 
 /**
- * All this does is remove '\' characters
- * @param input The input to remove '\' from
+ * @param parser The parser.
+ * @return The token to be parsed next.
  */
-void stripEscapeChars(LineInput *input) {
+static Token *peekToken(Parser *parser) {
+    return &parser->tokens[parser->position];
+}
+
+/**
+ * Report an error at the token to be parsed next.
+ * @param parser The parser.
+ * @param error The error.
+ * @return The error.
+ */
+static int parseFailure(Parser *parser, int error) {
+    parser->errorLine = peekToken(parser)->lineNumber;
+    return error;
+}
+
+/**
+ * @param token A token.
+ * @param keyword The keyword to compare it to.
+ * @return Whether or not the token is that keyword, unquoted.
+ */
+static bool isKeyword(Token *token, const char *keyword) {
+    return token->kind == kTokenWord && !token->quoted && strcmp(token->text, keyword) == 0;
+}
+
+/**
+ * @param token A token.
+ * @param keywords The keywords to compare it to, followed by a terminating NULL. May be NULL itself.
+ * @return Whether or not the token is one of the keywords.
+ */
+static bool isAnyKeyword(Token *token, const char *keywords[]) {
     int i;
-    for (i = 0; input->tokens[i]; i++) {
-        int j;
-        for (j = i; input->tokens[i][j]; j++) {
-            if (input->tokens[i][j] == '\\') { // If there's an escape character, remove the '\'
-                input->tokens[i][j] = input->tokens[i][j+1];
+    for (i = 0; keywords && keywords[i]; i++) {
+        if (isKeyword(token, keywords[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Skip any newlines, such as those after && or do.
+ * @param parser The parser.
+ */
+static void skipNewlines(Parser *parser) {
+    while (peekToken(parser)->kind == kTokenNewline) {
+        parser->position++;
+    }
+}
+
+/**
+ * Consume the keyword that closes (or continues) a compound command.
+ * @param parser The parser.
+ * @param keyword The keyword that must come next.
+ * @return 0 if success, kParseIncomplete if the text ended first, or kParseUnexpectedWord.
+ */
+static int expectKeyword(Parser *parser, const char *keyword) {
+    Token *token = peekToken(parser);
+    if (isKeyword(token, keyword)) {
+        parser->position++;
+        return kParseSuccess;
+    }
+    return parseFailure(parser, token->kind == kTokenEnd ? kParseIncomplete : kParseUnexpectedWord);
+}
+
+/**
+ * @param parser The parser.
+ * @param type The kind of node.
+ * @return A new, empty node.
+ */
+static Node *newNode(Parser *parser, NodeType type) {
+    Node *node = arenaAlloc(parser->arena, sizeof(Node));
+    memset(node, 0, sizeof(Node));
+    node->type = type;
+    return node;
+}
+
+/**
+ * Parse a single pipeline, made of words, | and redirection operators, into a LineInput.
+ * Parsing stops at the first token that is none of those.
+ * @param parser The parser.
+ * @param lineInput Filled with the pipeline's tokens.
+ * @return 0 if success, a ParseError otherwise.
+ */
+static int parsePipeline(Parser *parser, LineInput *lineInput) {
+    initLineInput(lineInput, parser->arena);
+    // Size the token array for the pipeline's tokens up front, so that it only grows if a | is followed by a newline
+    int last = parser->position;
+    while (parser->tokens[last].kind <= kTokenOutput) { // A word, |, < or >
+        last++;
+    }
+    lineInput->tokenCapacity = last - parser->position + 2;
+    lineInput->tokens = arenaAlloc(parser->arena, lineInput->tokenCapacity * sizeof(char *));
+    lineInput->tokens[0] = NULL;
+    
+    TokenKind lastOperator = kTokenWord; // The operator most recently seen, until a word follows it
+    while (true) {
+        Token *token = peekToken(parser);
+        if (token->kind == kTokenWord) {
+            addToken(lineInput, token->text);
+            lastOperator = kTokenWord;
+        } else if (token->kind == kTokenPipe || token->kind == kTokenInput || token->kind == kTokenOutput) {
+            if (lastOperator == kTokenInput || lastOperator == kTokenOutput) {
+                return parseFailure(parser, kParseMissingFile);
+            }
+            if (token->kind == kTokenPipe && (lineInput->numTokens == 0 || lastOperator == kTokenPipe)) {
+                return parseFailure(parser, kParseMissingCommand);
             }
+            lastOperator = token->kind;
+            addToken(lineInput, token->text);
+            if (token->kind == kTokenPipe) {
+                addPipe(lineInput);
+                parser->position++;
+                skipNewlines(parser); // A pipeline carries on past a newline after a |
+                continue;
+            }
+            addRedirection(lineInput);
+            if (token->kind == kTokenInput) {
+                lineInput->redirectedInputIndex = lineInput->numTokens - 1;
+            } else {
+                lineInput->redirectedOutputIndex = lineInput->numTokens - 1;
+                if (isDuplicatingRedirection(token->text)) { // Needs no file
+                    lastOperator = kTokenWord;
+                }
+            }
+        } else {
+            break;
         }
+        parser->position++;
     }
+    
+    if (lastOperator == kTokenInput || lastOperator == kTokenOutput) {
+        return parseFailure(parser, kParseMissingFile);
+    } else if (lastOperator == kTokenPipe || lineInput->numTokens == 0) {
+        return parseFailure(parser, kParseMissingCommand);
+    }
+    return kParseSuccess;
+}
+
+static int parseList(Parser *parser, const char *terminators[], bool multiline, Node **list);
+
+/**
+ * Parse the rest of an if or elif, after its keyword, up to and including the closing fi.
+ * @param parser The parser.
+ * @param node The if node to fill.
+ * @return 0 if success, a ParseError otherwise.
+ */
+static int parseIf(Parser *parser, Node *node) {
+    static const char *conditionEnd[] = { "then", NULL }, *bodyEnd[] = { "elif", "else", "fi", NULL };
+    static const char *alternativeEnd[] = { "fi", NULL };
+    int error;
+    if ((error = parseList(parser, conditionEnd, true, &node->condition)) ||
+        (error = expectKeyword(parser, "then")) ||
+        (error = parseList(parser, bodyEnd, true, &node->body))) {
+        return error;
+    }
+    if (isKeyword(peekToken(parser), "elif")) { // Another if, which shares this one's fi
+        parser->position++;
+        node->alternative = newNode(parser, kNodeIf);
+        return parseIf(parser, node->alternative);
+    } else if (isKeyword(peekToken(parser), "else")) {
+        parser->position++;
+        if ((error = parseList(parser, alternativeEnd, true, &node->alternative))) {
+            return error;
+        }
+    }
+    return expectKeyword(parser, "fi");
+}
+
+/**
+ * Parse the rest of a while or until loop, after its keyword, up to and including the closing done.
+ * @param parser The parser.
+ * @param node The loop's node to fill.
+ * @return 0 if success, a ParseError otherwise.
+ */
+static int parseWhile(Parser *parser, Node *node) {
+    static const char *conditionEnd[] = { "do", NULL }, *bodyEnd[] = { "done", NULL };
+    int error;
+    if ((error = parseList(parser, conditionEnd, true, &node->condition)) ||
+        (error = expectKeyword(parser, "do")) ||
+        (error = parseList(parser, bodyEnd, true, &node->body))) {
+        return error;
+    }
+    return expectKeyword(parser, "done");
 }
 
 /**
- * If the command is followed by quotes, then convert everything in the quotes
- * into a single string argument that is used with the command.
- * @param input The input to check and modify if quotes are found.
+ * Parse the rest of a for loop, after its keyword: a name, in, the words to loop over, and then the body.
+ * @param parser The parser.
+ * @param node The loop's node to fill.
+ * @return 0 if success, a ParseError otherwise.
  */
-void processQuotes(LineInput *input) {
-    if (input->tokens[1] == NULL) {
-        return;
+static int parseFor(Parser *parser, Node *node) {
+    static const char *bodyEnd[] = { "done", NULL };
+    Token *token = peekToken(parser);
+    if (token->kind != kTokenWord || token->quoted || (!isalpha((unsigned char)token->text[0]) && token->text[0] != '_') ||
+        token->text[strspn(token->text, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_")] != '\0') {
+        return parseFailure(parser, token->kind == kTokenEnd ? kParseIncomplete : kParseBadForLoop);
     }
-    char firstArgChar = input->tokens[1][0];
-    if (firstArgChar != '\'' && firstArgChar != '"') { // Check if quotes need to be processed.
-        return;
+    node->variable = token->text;
+    parser->position++;
+    if (!isKeyword(peekToken(parser), "in")) {
+        return parseFailure(parser, peekToken(parser)->kind == kTokenEnd ? kParseIncomplete : kParseBadForLoop);
     }
-    input->tokens[1] = &input->tokens[1][1]; // start past the first quote
+    parser->position++;
     
-    char concatArg[1024] = "";
+    int first = parser->position, numWords = 0;
+    while (peekToken(parser)->kind == kTokenWord) {
+        parser->position++;
+        numWords++;
+    }
+    node->words = arenaAlloc(parser->arena, (numWords + 1) * sizeof(char *));
     int i;
-    for (i = 1; input->tokens[i] != NULL; i++) {
-        int j;
-        for (j = 1; input->tokens[i][j]; j++) {
-            if ((input->tokens[i][j] == '\'' || input->tokens[i][j]== '"') && input->tokens[i][j+1] == '\0') { // If this is the ending quote
-                input->tokens[i][j] = '\0';
+    for (i = 0; i < numWords; i++) {
+        node->words[i] = parser->tokens[first + i].text;
+    }
+    node->words[numWords] = NULL;
+    
+    token = peekToken(parser);
+    if (token->kind != kTokenSeparator && token->kind != kTokenNewline) {
+        return parseFailure(parser, token->kind == kTokenEnd ? kParseIncomplete : kParseBadForLoop);
+    }
+    parser->position++;
+    skipNewlines(parser);
+    int error;
+    if ((error = expectKeyword(parser, "do")) ||
+        (error = parseList(parser, bodyEnd, true, &node->body))) {
+        return error;
+    }
+    return expectKeyword(parser, "done");
+}
+
+/**
+ * Parse a single command: a pipeline, or an if, while, until or for.
+ * @param parser The parser.
+ * @param node Set to the command.
+ * @return 0 if success, a ParseError otherwise.
+ */
+static int parseCommand(Parser *parser, Node **node) {
+    static const char *reserved[] = { "then", "elif", "else", "fi", "do", "done", NULL };
+    Token *token = peekToken(parser);
+    int error;
+    if (isKeyword(token, "if")) {
+        parser->position++;
+        *node = newNode(parser, kNodeIf);
+        error = parseIf(parser, *node);
+    } else if (isKeyword(token, "while") || isKeyword(token, "until")) {
+        parser->position++;
+        *node = newNode(parser, token->text[0] == 'w' ? kNodeWhile : kNodeUntil);
+        error = parseWhile(parser, *node);
+    } else if (isKeyword(token, "for")) {
+        parser->position++;
+        *node = newNode(parser, kNodeFor);
+        error = parseFor(parser, *node);
+    } else if (isAnyKeyword(token, reserved)) {
+        return parseFailure(parser, kParseUnexpectedWord);
+    } else {
+        *node = newNode(parser, kNodePipeline);
+        return parsePipeline(parser, &(*node)->pipeline);
+    }
+    
+    TokenKind next = peekToken(parser)->kind;
+    if (!error && (next == kTokenWord || next == kTokenPipe || next == kTokenInput || next == kTokenOutput)) {
+        return parseFailure(parser, kParseUnexpectedWord); // Compound commands can't be piped or redirected
+    }
+    return error;
+}
+
+/**
+ * Parse commands joined by && and ||, which are grouped from the left.
+ * @param parser The parser.
+ * @param node Set to the outermost command.
+ * @return 0 if success, a ParseError otherwise.
+ */
+static int parseAndOr(Parser *parser, Node **node) {
+    int error;
+    if ((error = parseCommand(parser, node))) {
+        return error;
+    }
+    TokenKind kind;
+    while ((kind = peekToken(parser)->kind) == kTokenAnd || kind == kTokenOr) {
+        parser->position++;
+        skipNewlines(parser);
+        Node *joined = newNode(parser, kind == kTokenAnd ? kNodeAnd : kNodeOr);
+        joined->left = *node;
+        if ((error = parseCommand(parser, &joined->right))) {
+            return error;
+        }
+        *node = joined;
+    }
+    return kParseSuccess;
+}
+
+/**
+ * Parse commands separated by ; or &, until the end of the text or one of the given keywords.
+ * @param parser The parser.
+ * @param terminators The keywords that end the list, followed by a terminating NULL. May be NULL.
+ * @param multiline Whether or not newlines separate commands too (as in the body of a loop), rather than end the list.
+ * @param list Set to the first command of the list, or NULL if there are none.
+ * @return 0 if success, a ParseError otherwise.
+ */
+static int parseList(Parser *parser, const char *terminators[], bool multiline, Node **list) {
+    Node **last = list;
+    *list = NULL;
+    while (true) {
+        Token *token = peekToken(parser);
+        if (token->kind == kTokenSeparator || (multiline && token->kind == kTokenNewline)) {
+            parser->position++;
+            continue;
+        }
+        if (token->kind == kTokenEnd || token->kind == kTokenNewline || isAnyKeyword(token, terminators)) {
+            break;
+        }
+        
+        Node *node;
+        int error;
+        if ((error = parseAndOr(parser, &node))) {
+            return error;
+        }
+        *last = node;
+        last = &node->next;
+        
+        token = peekToken(parser);
+        if (token->kind == kTokenBackground) { // Run the pipeline before it in the background
+            if (node->type != kNodePipeline) {
+                return parseFailure(parser, kParseMisplacedBackground);
             }
+            node->pipeline.background = true;
+            parser->position++;
+        } else if (token->kind == kTokenSeparator || (multiline && token->kind == kTokenNewline)) {
+            parser->position++;
+        } else if (token->kind != kTokenEnd && token->kind != kTokenNewline && !isAnyKeyword(token, terminators)) {
+            return parseFailure(parser, kParseUnexpectedWord);
+        }
+    }
+    if (terminators && *list == NULL) { // The condition or body of a compound command can't be empty
+        return parseFailure(parser, peekToken(parser)->kind == kTokenEnd ? kParseIncomplete : kParseUnexpectedWord);
+    }
+    return kParseSuccess;
+}
+
+/**
+ * Record a span on the trace timeline for parsing some text.
+ * @param start When parsing started.
+ * @param text The text that was parsed.
+ * @param length The number of characters in the text.
+ */
+static void traceParse(double start, const char *text, size_t length) {
+    char detail[128];
+    snprintf(detail, sizeof(detail), "%.*s", (int)length, text);
+    traceSpan("parse", "parse", start, traceClock(), 0, detail);
+}
+
+/**
+ * Parse a given line by tokenizing it and placings its components into a LineInput structure.
+ * The line is scanned once, handling quotes, escapes and the |, <, >, >>, 2>, &> and & operators as they are found.
+ * Parsing stops at the end of the string or at the first newline. The line itself is never modified.
+ * The line must be a single pipeline: ;, &&, || and & before the end of the line are reported as errors.
+ * @param line The line that the user inputted, which is to be parsed.
+ * @param lineInput A structure containing the logical parsing of the line, which is filled by this function.
+ * @return 0 if success, a ParseError otherwise.
+ */
+int parse(const char *line, LineInput *lineInput) {
+    return parseSpan(line, strcspn(line, "\n"), lineInput);
+}
+
+/**
+ * Parse a line of known length, which need not be NUL-terminated (such as a line within a memory-mapped script).
+ * @param line The start of the line to be parsed.
+ * @param length The number of characters in the line, not including any newline.
+ * @param lineInput A structure containing the logical parsing of the line, which is filled by this function.
+ * @return 0 if success, a ParseError otherwise.
+ */
+int parseSpan(const char *line, size_t length, LineInput *lineInput) {
+    double start = tracingEnabled() ? traceClock() : 0;
+    Arena *arena = lineInput->arena;
+    Parser parser;
+    int error = initParser(&parser, line, length, arena);
+    if (!error && peekToken(&parser)->kind == kTokenEnd) { // An empty line
+        initLineInput(lineInput, arena);
+        addToken(lineInput, NULL);
+        lineInput->numTokens = 0;
+    } else if (!error && !(error = parsePipeline(&parser, lineInput))) {
+        if (peekToken(&parser)->kind == kTokenBackground) {
+            lineInput->background = true;
+            parser.position++;
+            error = peekToken(&parser)->kind == kTokenEnd ? kParseSuccess : kParseMisplacedBackground;
+        } else if (peekToken(&parser)->kind != kTokenEnd) {
+            error = kParseCompound;
+        }
+    }
+    if (tracingEnabled()) {
+        traceParse(start, line, length);
+    }
+    return error;
+}
+
+/**
+ * Split text into tokens, ready for its commands to be parsed with parseNext().
+ * @param parser The parser to prepare.
+ * @param text The text to parse, which need not be NUL-terminated and is never modified.
+ * @param length The number of characters in the text.
+ * @param arena The arena that tokens and commands are allocated from. They stay valid until the arena is reset.
+ * @return 0 if success, a ParseError otherwise (with parser->errorLine set to where it happened).
+ */
+int initParser(Parser *parser, const char *text, size_t length, Arena *arena) {
+    memset(parser, 0, sizeof(Parser));
+    parser->text = text;
+    parser->length = length;
+    parser->arena = arena;
+    int error = lex(parser, text, length);
+    if (error) {
+        parser->numTokens = 0;
+        addLexeme(parser, kTokenEnd, "", false, text + length, parser->errorLine);
+    }
+    return error;
+}
+
+/**
+ * Parse the next line's worth of commands, which is more than one line of text when an if, while, until or for
+ * spans several. After an error, the rest of the line is skipped so that parsing can carry on from the next one.
+ * @param parser The parser, prepared by initParser().
+ * @param node Set to the first of the commands, or NULL once there are none left.
+ * @return 0 if success, a ParseError otherwise (with parser->errorLine set to where it happened).
+ */
+int parseNext(Parser *parser, Node **node) {
+    double start = tracingEnabled() ? traceClock() : 0;
+    *node = NULL;
+    skipNewlines(parser);
+    Token *first = peekToken(parser);
+    if (first->kind == kTokenEnd) {
+        return kParseSuccess;
+    }
+    int error = parseList(parser, NULL, false, node);
+    if (error) {
+        while (peekToken(parser)->kind != kTokenNewline && peekToken(parser)->kind != kTokenEnd) {
+            parser->position++;
         }
-        strcat(concatArg, input->tokens[i]);
-        if (input->tokens[i+1] != NULL) {
-            strcat(concatArg, " ");
+        *node = NULL;
+        return error;
+    }
+    if (*node == NULL) { // Nothing but separators
+        return parseNext(parser, node);
+    }
+    
+    // The command's source runs from the start of its first line to the end of its last
+    const char *source = first->start;
+    while (source > parser->text && source[-1] != '\n') {
+        source--;
+    }
+    (*node)->source = source;
+    (*node)->sourceLength = peekToken(parser)->start - source;
+    (*node)->lineNumber = first->lineNumber;
+    if (tracingEnabled()) {
+        traceParse(start, source, (*node)->sourceLength);
+    }
+    return kParseSuccess;
+}
+
+/**
+ * Parse every command in some text, linking them all together in order.
+ * @param text The text to parse, which need not be NUL-terminated and is never modified.
+ * @param length The number of characters in the text.
+ * @param arena The arena that tokens and commands are allocated from. They stay valid until the arena is reset.
+ * @param program Set to the first command, or NULL if there are none.
+ * @return 0 if success, the first ParseError otherwise.
+ */
+int parseProgram(const char *text, size_t length, Arena *arena, Node **program) {
+    Parser parser;
+    Node **last = program;
+    *program = NULL;
+    int error = initParser(&parser, text, length, arena);
+    while (!error) {
+        Node *node;
+        if ((error = parseNext(&parser, &node)) || node == NULL) {
+            break;
+        }
+        *last = node;
+        while (node->next) {
+            node = node->next;
         }
+        last = &node->next;
+    }
+    return error;
+}
+
+/**
+ * Describe why a line failed to parse.
+ * @param error The ParseError returned by parse().
+ * @return A message describing the error.
+ */
+const char *describeParseError(int error) {
+    switch (error) {
+        case kParseSuccess:
+            return "Success";
+        case kParseUnterminatedQuote:
+            return "A quotation is never closed";
+        case kParseMissingFile:
+            return "A redirection is missing its file";
+        case kParseMissingCommand:
+            return "A pipe, && or || is missing its command";
+        case kParseMisplacedBackground:
+            return "A & can only follow a pipeline";
+        case kParseIncomplete:
+            return "An if, while, until or for is never closed";
+        case kParseUnexpectedWord:
+            return "A keyword or operator is out of place";
+        case kParseBadForLoop:
+            return "A for loop is written 'for name in words; do commands; done'";
+        case kParseCompound:
+            return "Only a single pipeline can be run here";
+        case kParseUnterminatedSubstitution:
+            return "A $( or ` is never closed";
+        case kParseUnterminatedHereDocument:
+            return "A here-document is never ended by its delimiter";
+        default:
+            return "Unknown error";
     }
-    input->tokens[2] = NULL;
-    input->tokens[1] = concatArg;
 }
 
 /**
@@ -6,42 +6,200 @@
 #include <stdbool.h>
 #include <stdlib.h>
 
+#include "Arena.h"
 
-#endif /* Parse_h */
+/**
+ * The reasons a line can fail to parse.
+ */
+typedef enum parseError {
+    kParseSuccess = 0,
+    kParseUnterminatedQuote,
+    kParseMissingFile,
+    kParseMissingCommand,
+    kParseMisplacedBackground,
+    kParseIncomplete,
+    kParseUnexpectedWord,
+    kParseBadForLoop,
+    kParseCompound,
+    kParseUnterminatedSubstitution,
+    kParseUnterminatedHereDocument
+} ParseError;
+
+// A $ expansion is kept within a word as one of these markers, then the variable's name, then EXPAND_END
+#define EXPAND_UNQUOTED '\001' // Split into separate words at whitespace
+#define EXPAND_QUOTED '\002' // Within double quotes, so never split
+#define EXPAND_END '\003'
+// A command substitution, $(...) or `...`, is kept the same way, with the command's text in place of a name
+#define SUBSTITUTE_UNQUOTED '\004'
+#define SUBSTITUTE_QUOTED '\005'
+// Every marker that starts an expansion
+#define EXPAND_MARKERS "\001\002\004\005"
+// Comes before a *, ? or [ that was not quoted, which makes it a wildcard
+#define GLOB_MARKER '\006'
+// Every marker a word can hold, for finding the words that need expanding
+#define WORD_MARKERS "\001\002\004\005\006"
 
 /**
  * A structure used to contain a logical parsing of a user's input.
+ * The tokens and indices grow as needed, and are allocated from the arena given to initLineInput().
  */
 typedef struct lineInput {
-    int numPipes, numTokens;
-    char *tokens[80];
-    int redirectedInputIndex, redirectedOutputIndex;
-    int pipeIndices[80];
+    int numPipes, numTokens, numRedirections;
+    char **tokens;
+    int redirectedInputIndex, redirectedOutputIndex; // The last of each kind of redirection operator
+    int *pipeIndices;
+    int *redirectionIndices; // Every redirection operator, in order
+    int tokenCapacity, pipeCapacity, redirectionCapacity;
+    bool background;
+    Arena *arena;
 } LineInput;
 
+/**
+ * The kinds of token that the lexer produces.
+ */
+typedef enum tokenKind {
+    kTokenWord,
+    kTokenPipe,
+    kTokenInput,
+    kTokenOutput,
+    kTokenBackground,
+    kTokenSeparator,
+    kTokenNewline,
+    kTokenAnd,
+    kTokenOr,
+    kTokenEnd
+} TokenKind;
+
+/**
+ * A word or operator, along with where it was found. Keywords are only recognized in words that had no quoting.
+ */
+typedef struct token {
+    TokenKind kind;
+    char *text;
+    bool quoted;
+    const char *start;
+    int lineNumber;
+} Token;
+
+/**
+ * The kinds of node in a parsed command.
+ */
+typedef enum nodeType {
+    kNodePipeline,
+    kNodeAnd,
+    kNodeOr,
+    kNodeIf,
+    kNodeWhile,
+    kNodeUntil,
+    kNodeFor
+} NodeType;
+
+/**
+ * A command, parsed once and then executed as many times as needed without looking at its text again.
+ * Commands run one after the other (separated by ; or a newline) are linked through next.
+ * A pipeline keeps its tokens in a LineInput. && and || run left, and then maybe right.
+ * if runs body when condition succeeds and otherwise alternative (another if, for an elif).
+ * while and until run body for as long as condition succeeds or fails. for runs body once per word,
+ * with variable set to it. The first command of each line also records the text it was parsed from.
+ */
+typedef struct node {
+    NodeType type;
+    struct node *next;
+    LineInput pipeline;
+    struct node *left, *right;
+    struct node *condition, *body, *alternative;
+    char *variable;
+    char **words;
+    const char *source;
+    size_t sourceLength;
+    int lineNumber;
+} Node;
+
+/**
+ * Text that has been split into tokens, and is being parsed into commands one line at a time.
+ */
+typedef struct parser {
+    Token *tokens;
+    int numTokens, tokenCapacity, position;
+    const char *text;
+    size_t length;
+    int errorLine;
+    Arena *arena;
+} Parser;
+
+/**
+ * Prepare an empty LineInput that allocates from the given arena.
+ * @param lineInput The structure to prepare.
+ * @param arena The arena that tokens are allocated from. Tokens stay valid until the arena is reset.
+ */
+void initLineInput(LineInput *lineInput, Arena *arena);
+
+/**
+ * @param operator A redirection operator.
+ * @return Whether or not the operator joins one output to another (2>&1 or >&2), rather than being followed by a file.
+ */
+bool isDuplicatingRedirection(const char *operator);
+
 /**
  * Parse a given line by tokenizing it and placings its components into a LineInput structure.
+ * The line is scanned once, handling quotes, escapes and the |, <, >, >>, 2>, &> and & operators as they are found.
+ * Parsing stops at the end of the string or at the first newline. The line itself is never modified.
+ * The line must be a single pipeline: ;, &&, || and & before the end of the line are reported as errors.
  * @param line The line that the user inputted, which is to be parsed.
  * @param lineInput A structure containing the logical parsing of the line, which is filled by this function.
- * @return 0 if success, a non-zero integer otherwise.
+ * @return 0 if success, a ParseError otherwise.
+ */
+int parse(const char *line, LineInput *lineInput);
+
+/**
+ * Parse a line of known length, which need not be NUL-terminated (such as a line within a memory-mapped script).
+ * @param line The start of the line to be parsed.
+ * @param length The number of characters in the line, not including any newline.
+ * @param lineInput A structure containing the logical parsing of the line, which is filled by this function.
+ * @return 0 if success, a ParseError otherwise.
  */
-int parse(char *line, LineInput *lineInput);
+int parseSpan(const char *line, size_t length, LineInput *lineInput);
 
 /**
- * All this does is remove '\' characters
- * @param input The input to remove '\' from
+ * Split text into tokens, ready for its commands to be parsed with parseNext().
+ * @param parser The parser to prepare.
+ * @param text The text to parse, which need not be NUL-terminated and is never modified.
+ * @param length The number of characters in the text.
+ * @param arena The arena that tokens and commands are allocated from. They stay valid until the arena is reset.
+ * @return 0 if success, a ParseError otherwise (with parser->errorLine set to where it happened).
  */
-void stripEscapeChars(LineInput *input);
+int initParser(Parser *parser, const char *text, size_t length, Arena *arena);
 
 /**
- * If the command is followed by quotes, then convert everything in the quotes
- * into a single string argument that is used with the command.
- * @param input The input to check and modify if quotes are found.
+ * Parse the next line's worth of commands, which is more than one line of text when an if, while, until or for
+ * spans several. After an error, the rest of the line is skipped so that parsing can carry on from the next one.
+ * @param parser The parser, prepared by initParser().
+ * @param node Set to the first of the commands, or NULL once there are none left.
+ * @return 0 if success, a ParseError otherwise (with parser->errorLine set to where it happened).
  */
-void processQuotes(LineInput *input);
+int parseNext(Parser *parser, Node **node);
+
+/**
+ * Parse every command in some text, linking them all together in order.
+ * @param text The text to parse, which need not be NUL-terminated and is never modified.
+ * @param length The number of characters in the text.
+ * @param arena The arena that tokens and commands are allocated from. They stay valid until the arena is reset.
+ * @param program Set to the first command, or NULL if there are none.
+ * @return 0 if success, the first ParseError otherwise.
+ */
+int parseProgram(const char *text, size_t length, Arena *arena, Node **program);
+
+/**
+ * Describe why a line failed to parse.
+ * @param error The ParseError returned by parse().
+ * @return A message describing the error.
+ */
+const char *describeParseError(int error);
 
 /**
  * Print a given line input. Print the number of commands followed by each token that is parsed.
  * @param lineInput The structure of parsed tokens to be printed.
  */
 void printLineInput(LineInput *lineInput);
+
+#endif /* Parse_h */
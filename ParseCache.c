@@ -0,0 +1,240 @@
+#include "ParseCache.h"
+#include "Trace.h"
+
+#define NUM_BUCKETS 1024
+#define DEFAULT_LIMIT_KB 4096 // Used unless NSH_PARSE_CACHE gives a limit in kilobytes
+
+static ParsedLine *buckets[NUM_BUCKETS];
+static ParsedLine *newest = NULL, *oldest = NULL;
+static size_t totalSize = 0, limit = 0;
+static bool configured = false;
+static unsigned long numLines = 0, hits = 0, misses = 0, evictions = 0;
+
+/**
+ * Hash a line's text (FNV-1a).
+ * @param text The text to hash.
+ * @param length The number of characters in the text.
+ * @return The hash.
+ */
+static uint64_t hashText(const char *text, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+    for (i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)text[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Take a line out of the order of use.
+ * @param line The line.
+ */
+static void unlinkFromOrder(ParsedLine *line) {
+    if (line->newer) {
+        line->newer->older = line->older;
+    } else {
+        newest = line->older;
+    }
+    if (line->older) {
+        line->older->newer = line->newer;
+    } else {
+        oldest = line->newer;
+    }
+    line->newer = line->older = NULL;
+}
+
+/**
+ * Make a line the most recently used.
+ * @param line The line.
+ */
+static void markUsed(ParsedLine *line) {
+    if (line == newest) {
+        return;
+    }
+    if (line->newer || line->older || line == oldest) {
+        unlinkFromOrder(line);
+    }
+    line->older = newest;
+    if (newest) {
+        newest->newer = line;
+    }
+    newest = line;
+    if (oldest == NULL) {
+        oldest = line;
+    }
+}
+
+/**
+ * Release a line's memory.
+ * @param line The line.
+ */
+static void freeParsedLine(ParsedLine *line) {
+    freeArena(&line->arena);
+    free(line);
+}
+
+/**
+ * Forget a line that is not being executed.
+ * @param line The line.
+ */
+static void removeParsedLine(ParsedLine *line) {
+    ParsedLine **link;
+    for (link = &buckets[line->hash % NUM_BUCKETS]; *link != line; link = &(*link)->next) {
+        continue;
+    }
+    *link = line->next;
+    unlinkFromOrder(line);
+    totalSize -= line->size;
+    numLines--;
+    freeParsedLine(line);
+}
+
+/**
+ * Evict the least recently used lines that are not being executed, until the cache is within its limit.
+ */
+static void evictParsedLines(void) {
+    ParsedLine *line = oldest;
+    while (totalSize > limit && line) {
+        ParsedLine *newer = line->newer;
+        if (line->users == 0) {
+            removeParsedLine(line);
+            evictions++;
+        }
+        line = newer;
+    }
+}
+
+/**
+ * Read the cache's limit from NSH_PARSE_CACHE, the first time the cache is used.
+ */
+static void configureParseCache(void) {
+    configured = true;
+    const char *limitVar = getenv("NSH_PARSE_CACHE");
+    char *end;
+    long kilobytes = limitVar ? strtol(limitVar, &end, 10) : DEFAULT_LIMIT_KB;
+    if (limitVar && (*limitVar == '\0' || *end != '\0' || kilobytes < 0)) {
+        fprintf(stderr, "NSH_PARSE_CACHE must be a size in kilobytes, not '%s'.\n", limitVar);
+        kilobytes = DEFAULT_LIMIT_KB;
+    }
+    limit = (size_t)kilobytes * 1024;
+}
+
+/**
+ * Look up the parsed commands of a line, parsing it (and remembering the result) only if it hasn't been seen recently.
+ * Lines with syntax errors are not remembered. The entry must be released once its commands have run.
+ * @param text The line, which need not be NUL-terminated.
+ * @param length The number of characters in the line.
+ * @param error Set to 0 if success, a ParseError otherwise.
+ * @return The parsed line, or NULL if it has a syntax error.
+ */
+ParsedLine *acquireParsedLine(const char *text, size_t length, int *error) {
+    if (!configured) {
+        configureParseCache();
+    }
+    uint64_t hash = hashText(text, length);
+    ParsedLine *line;
+    for (line = buckets[hash % NUM_BUCKETS]; line; line = line->next) {
+        if (line->hash == hash && line->length == length && memcmp(line->text, text, length) == 0) {
+            hits++;
+            line->users++;
+            markUsed(line);
+            traceInstant("parse", "cached", line->text);
+            *error = kParseSuccess;
+            return line;
+        }
+    }
+    
+    misses++;
+    if ((line = malloc(sizeof(ParsedLine) + length + 1)) == NULL) {
+        perror("Unable to allocate memory.\n\r");
+        exit(EXIT_FAILURE);
+    }
+    memset(line, 0, sizeof(ParsedLine));
+    memcpy(line->text, text, length); // The commands point into the text, so it is kept along with them
+    line->text[length] = '\0';
+    line->length = length;
+    line->hash = hash;
+    line->arena.firstChunkSize = 1024; // Most lines are short, so more of them fit in the cache
+    if ((*error = parseProgram(line->text, length, &line->arena, &line->program))) {
+        freeParsedLine(line);
+        return NULL;
+    }
+    line->size = sizeof(ParsedLine) + length + 1 + arenaSize(&line->arena);
+    line->users = 1;
+    if (line->size > limit) {
+        return line; // Never remembered, so freed once released
+    }
+    
+    line->cached = true;
+    line->next = buckets[hash % NUM_BUCKETS];
+    buckets[hash % NUM_BUCKETS] = line;
+    markUsed(line);
+    totalSize += line->size;
+    numLines++;
+    evictParsedLines();
+    return line;
+}
+
+/**
+ * Allow a parsed line to be evicted again, once its commands have finished running.
+ * @param line The line returned by acquireParsedLine().
+ */
+void releaseParsedLine(ParsedLine *line) {
+    line->users--;
+    if (!line->cached) {
+        freeParsedLine(line);
+    } else if (line->users == 0 && totalSize > limit) {
+        evictParsedLines();
+    }
+}
+
+/**
+ * Limit how much memory the cache may hold. Least recently used lines are evicted to stay within the limit.
+ * @param bytes The limit, or 0 to stop remembering lines at all.
+ */
+void setParseCacheLimit(size_t bytes) {
+    configured = true;
+    limit = bytes;
+    evictParsedLines();
+}
+
+/**
+ * Forget every line that is not being executed, and reset the hit and miss counters.
+ */
+void clearParseCache(void) {
+    ParsedLine *line = oldest;
+    while (line) {
+        ParsedLine *newer = line->newer;
+        if (line->users == 0) {
+            removeParsedLine(line);
+        }
+        line = newer;
+    }
+    hits = misses = evictions = 0;
+}
+
+/**
+ * Process a 'parsecache' command.
+ * 'parsecache' prints how many lines are remembered, how much memory they use, and how often lines were found,
+ * and 'parsecache -r' forgets every line and resets the counters.
+ * @param cmd The 'parsecache' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processParseCache(char *cmd[], StdFds fds) {
+    if (cmd[1] != NULL && strcmp(cmd[1], "-r") == 0 && cmd[2] == NULL) {
+        clearParseCache();
+        return EXIT_SUCCESS;
+    } else if (cmd[1] != NULL) {
+        dprintf(fds.err, "usage: parsecache [-r]\n");
+        return 2;
+    }
+    if (!configured) {
+        configureParseCache();
+    }
+    unsigned long lookups = hits + misses;
+    dprintf(fds.out, "%lu lines, %zu KB of %zu KB\n", numLines, (totalSize + 1023) / 1024, limit / 1024);
+    dprintf(fds.out, "%lu hits, %lu misses (%.1f%% hit rate), %lu evicted\n",
+            hits, misses, lookups ? 100.0 * hits / lookups : 0.0, evictions);
+    return EXIT_SUCCESS;
+}
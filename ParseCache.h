@@ -0,0 +1,68 @@
+#ifndef ParseCache_h
+#define ParseCache_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "Arena.h"
+#include "Parse.h"
+#include "Builtin.h"
+
+/**
+ * A line that has already been parsed, kept along with its commands so that the next time the very same line
+ * is run, it goes straight to execution. Entries are kept in order of use, to evict the least recently used first.
+ */
+typedef struct parsedLine {
+    uint64_t hash;
+    Node *program;
+    Arena arena;
+    size_t size;
+    int users; // An entry that is being executed is never evicted
+    bool cached; // Lines too large for the cache are freed as soon as they are released
+    struct parsedLine *next; // The next entry in the same bucket
+    struct parsedLine *newer, *older;
+    size_t length;
+    char text[];
+} ParsedLine;
+
+/**
+ * Look up the parsed commands of a line, parsing it (and remembering the result) only if it hasn't been seen recently.
+ * Lines with syntax errors are not remembered. The entry must be released once its commands have run.
+ * @param text The line, which need not be NUL-terminated.
+ * @param length The number of characters in the line.
+ * @param error Set to 0 if success, a ParseError otherwise.
+ * @return The parsed line, or NULL if it has a syntax error.
+ */
+ParsedLine *acquireParsedLine(const char *text, size_t length, int *error);
+
+/**
+ * Allow a parsed line to be evicted again, once its commands have finished running.
+ * @param line The line returned by acquireParsedLine().
+ */
+void releaseParsedLine(ParsedLine *line);
+
+/**
+ * Limit how much memory the cache may hold. Least recently used lines are evicted to stay within the limit.
+ * @param bytes The limit, or 0 to stop remembering lines at all.
+ */
+void setParseCacheLimit(size_t bytes);
+
+/**
+ * Forget every line that is not being executed, and reset the hit and miss counters.
+ */
+void clearParseCache(void);
+
+/**
+ * Process a 'parsecache' command.
+ * 'parsecache' prints how many lines are remembered, how much memory they use, and how often lines were found,
+ * and 'parsecache -r' forgets every line and resets the counters.
+ * @param cmd The 'parsecache' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processParseCache(char *cmd[], StdFds fds);
+
+#endif /* ParseCache_h */
@@ -0,0 +1,340 @@
+#ifdef __linux__
+#define _GNU_SOURCE // F_SETPIPE_SZ, pipe2(), splice()
+#endif
+
+#include "Pipes.h"
+#include "Spawn.h"
+#include "Stats.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#define MAX_PIPE_COUNTERS 64
+#define COUNTER_CHUNK_SIZE 65536
+
+/**
+ * The bytes one counted pipe has carried. Kept in memory shared with the copies of the shell doing the counting,
+ * which fill it in as the bytes pass through.
+ */
+typedef struct pipeCounter {
+    bool used, finished;
+    pid_t pid; // The copy of the shell doing the counting
+    long sequence; // When the pipe started, relative to the others
+    long capacity;
+    unsigned long long bytes;
+    double seconds; // From the first byte to the last
+    char label[80];
+} PipeCounter;
+
+static long pipeSize = 0; // 0 leaves pipes at the system's default
+static bool configured = false;
+static bool pipePackets = false;
+static bool pipeCounting = false;
+static PipeCounter *counters = NULL; // Shared with every counting copy of the shell, once a pipe has been counted
+static long numCountersStarted = 0;
+static int counterSlot = -1; // The counter a forked copy of the shell fills in
+static int counterReadEnd = -1; // The end of its output pipe that only the next stage may hold open
+
+/**
+ * @return The largest capacity the system lets an unprivileged process give a pipe, or -1 if pipes can't be resized.
+ */
+static long maxPipeSize(void) {
+#ifdef F_SETPIPE_SZ
+    static long maxSize = 0;
+    if (maxSize == 0) {
+        FILE *limit = fopen("/proc/sys/fs/pipe-max-size", "r");
+        if (limit == NULL || fscanf(limit, "%ld", &maxSize) != 1 || maxSize <= 0) {
+            maxSize = 1024 * 1024; // The usual limit
+        }
+        if (limit) {
+            fclose(limit);
+        }
+    }
+    return maxSize;
+#else
+    return -1;
+#endif
+}
+
+/**
+ * Read the capacity of pipes from NSH_PIPE_SIZE, the first time a pipe is opened or its capacity asked for.
+ */
+static void configurePipes(void) {
+    configured = true;
+    const char *sizeVar = getenv("NSH_PIPE_SIZE");
+    long bytes;
+    if (sizeVar == NULL) {
+        return;
+    } else if (!parseByteSize(sizeVar, &bytes)) {
+        fprintf(stderr, "NSH_PIPE_SIZE must be a size in bytes (k or m may follow), not '%s'.\n", sizeVar);
+    } else if (setPipeSize(bytes) == -1) {
+        fprintf(stderr, "NSH_PIPE_SIZE is ignored, as pipes can't be resized on this system.\n");
+    }
+}
+
+/**
+ * Open a pipe between two stages of a pipeline, with the capacity set by setPipeSize(),
+ * in packet mode if setPipePackets() asked for it. Both ends are closed on exec.
+ * @param fd Filled with the read end and the write end.
+ * @return 0 if success, -1 otherwise.
+ */
+int openStagePipe(int fd[2]) {
+    if (!configured) {
+        configurePipes();
+    }
+#ifdef __linux__
+    if (pipe2(fd, O_CLOEXEC | (pipePackets ? O_DIRECT : 0)) == -1) {
+        return -1;
+    }
+#else
+    if (openPipe(fd) == -1) {
+        return -1;
+    }
+#endif
+#ifdef F_SETPIPE_SZ
+    if (pipeSize) {
+        fcntl(fd[1], F_SETPIPE_SZ, (int)pipeSize); // Left at the default if the user's pipes already use all they may
+    }
+#endif
+    return 0;
+}
+
+/**
+ * Choose the capacity of the pipes between pipeline stages. Larger pipes let a fast stage run further ahead
+ * before it has to wait, so the stages switch back and forth less often.
+ * @param bytes The capacity to ask for, which is limited to what the system allows. 0 goes back to the system's default.
+ * @return The capacity pipes will be given (0 for the default), or -1 if this system can't resize pipes.
+ */
+long setPipeSize(long bytes) {
+    configured = true; // Takes precedence over NSH_PIPE_SIZE
+    long maxSize = maxPipeSize();
+    if (maxSize == -1) {
+        return -1;
+    }
+    pipeSize = bytes > maxSize ? maxSize : bytes;
+    return pipeSize;
+}
+
+/**
+ * @return The capacity pipes between pipeline stages are given, or 0 for the system's default.
+ */
+long getPipeSize(void) {
+    if (!configured) {
+        configurePipes();
+    }
+    return pipeSize;
+}
+
+/**
+ * Choose whether pipes between pipeline stages are opened in packet mode (O_DIRECT), where every write
+ * is read back whole by a single read, and whatever a shorter read leaves of it is thrown away.
+ * @param packets Whether or not to use packet mode.
+ * @return 0 if success, -1 if this system has no packet mode.
+ */
+int setPipePackets(bool packets) {
+#ifdef __linux__
+    pipePackets = packets;
+    return 0;
+#else
+    return packets ? -1 : 0;
+#endif
+}
+
+/**
+ * @return Whether or not pipes between pipeline stages are opened in packet mode.
+ */
+bool getPipePackets(void) {
+    return pipePackets;
+}
+
+/**
+ * Choose whether the bytes passing through every pipe between pipeline stages are counted, for 'stats' to report.
+ * Each counted pipe has a copy of the shell moving its bytes along, so counting is off unless asked for.
+ * @param counting Whether or not to count.
+ */
+void setPipeCounting(bool counting) {
+    pipeCounting = counting;
+}
+
+/**
+ * @return Whether or not the bytes through pipes between pipeline stages are counted.
+ */
+bool getPipeCounting(void) {
+    return pipeCounting;
+}
+
+/**
+ * Move bytes from one descriptor to another, letting the kernel move them between pipes where it can.
+ * @param from The descriptor to read from.
+ * @param to The descriptor to write to.
+ * @return The number of bytes moved, 0 at the end of the input, or -1 if either end failed.
+ */
+static ssize_t moveChunk(int from, int to) {
+    static char buffer[COUNTER_CHUNK_SIZE];
+#ifdef __linux__
+    static bool spliceWorks = true;
+    if (spliceWorks) {
+        ssize_t moved = splice(from, NULL, to, NULL, sizeof(buffer), SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (moved != -1 || errno != EINVAL) {
+            return moved;
+        }
+        spliceWorks = false;
+    }
+#endif
+    ssize_t numRead = read(from, buffer, sizeof(buffer));
+    if (numRead <= 0) {
+        return numRead;
+    }
+    return writeAll(to, buffer, numRead) == -1 ? -1 : numRead;
+}
+
+/**
+ * Move everything from standard input to standard output, counting the bytes in the shared counter as they go.
+ * Runs in a copy of the shell.
+ * @param cmd The counter's name, for tracing.
+ * @param fds The pipe being counted, and the pipe that carries its bytes on to the next stage.
+ * @return The exit status of the counter.
+ */
+static int countPipe(char *cmd[], StdFds fds) {
+    close(counterReadEnd);
+    signal(SIGPIPE, SIG_IGN); // A next stage that stops reading ends the count, rather than the counter
+    signal(SIGINT, SIG_IGN); // As does a ^C, once it has stopped the stages on either side
+    signal(SIGQUIT, SIG_IGN);
+    PipeCounter *counter = &counters[counterSlot];
+    struct timespec first = {0}, last;
+    ssize_t moved;
+    while ((moved = moveChunk(fds.in, fds.out)) != 0) {
+        if (moved == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &last);
+        if (counter->bytes == 0) {
+            first = last;
+        }
+        counter->bytes += moved;
+        counter->seconds = secondsBetween(&first, &last);
+    }
+    counter->finished = true;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @param counter A counter that is in use.
+ * @return Whether or not the pipe's counting is over, because it either finished or was killed.
+ */
+static bool counterFinished(PipeCounter *counter) {
+    if (!counter->finished && kill(counter->pid, 0) == -1 && errno == ESRCH) {
+        counter->finished = true;
+    }
+    return counter->finished;
+}
+
+/**
+ * Find a counter for a pipe that is starting, reusing the oldest finished one once they are all taken.
+ * @return The counter's index, or -1 if every counter belongs to a pipe that is still running.
+ */
+static int claimCounter(void) {
+    if (counters == NULL) {
+        counters = mmap(NULL, MAX_PIPE_COUNTERS * sizeof(PipeCounter), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (counters == MAP_FAILED) {
+            counters = NULL;
+            return -1;
+        }
+    }
+    int i, oldest = -1;
+    for (i = 0; i < MAX_PIPE_COUNTERS; i++) {
+        if (!counters[i].used) {
+            return i;
+        } else if (counterFinished(&counters[i]) && (oldest == -1 || counters[i].sequence < counters[oldest].sequence)) {
+            oldest = i;
+        }
+    }
+    return oldest;
+}
+
+/**
+ * Count the bytes a pipe carries, by having a copy of the shell move them into a second pipe as they arrive.
+ * The copy belongs to no job, and finishes when the pipe's writer does or the next stage stops reading.
+ * @param input The read end of the pipe, which is closed.
+ * @param label The stages the pipe connects, for the report.
+ * @param pgid The process group the copy joins: -1 for the shell's own, 0 for a new one.
+ * @return The descriptor the next stage should read from instead: the pipe itself, if it can't be counted.
+ */
+int startPipeCounter(int input, const char *label, pid_t pgid) {
+    int slot = claimCounter(), fd[2];
+    if (slot == -1 || openStagePipe(fd) == -1) {
+        return input;
+    }
+    PipeCounter *counter = &counters[slot];
+    memset(counter, 0, sizeof(PipeCounter));
+    counter->used = true;
+    counter->sequence = numCountersStarted++;
+#ifdef F_GETPIPE_SZ
+    counter->capacity = fcntl(input, F_GETPIPE_SZ);
+#endif
+    snprintf(counter->label, sizeof(counter->label), "%s", label);
+    
+    counterSlot = slot;
+    counterReadEnd = fd[0];
+    char *argv[] = { "pipe counter", NULL };
+    StdFds fds = { input, fd[1], STDERR_FILENO };
+    if ((counter->pid = forkBuiltin(countPipe, argv, fds, pgid)) == -1) {
+        counter->used = false;
+        close(fd[0]);
+        close(fd[1]);
+        return input;
+    }
+    close(input);
+    close(fd[1]);
+    return fd[0];
+}
+
+/**
+ * Print the bytes every counted pipe has carried, and how fast, oldest first. Prints nothing if no pipe was counted.
+ * @param fd Where to print.
+ */
+void printPipeCounters(int fd) {
+    if (counters == NULL) {
+        return;
+    }
+    bool printed[MAX_PIPE_COUNTERS] = { false };
+    bool headerPrinted = false;
+    while (true) {
+        int i, next = -1;
+        for (i = 0; i < MAX_PIPE_COUNTERS; i++) {
+            if (counters[i].used && !printed[i] && (next == -1 || counters[i].sequence < counters[next].sequence)) {
+                next = i;
+            }
+        }
+        if (next == -1) {
+            return;
+        }
+        if (!headerPrinted) {
+            dprintf(fd, "\n%14s %10s %10s %11s  %s\n", "pipe bytes", "seconds", "MB/s", "capacity", "between");
+            headerPrinted = true;
+        }
+        PipeCounter *counter = &counters[next];
+        double rate = counter->seconds > 0 ? counter->bytes / counter->seconds / 1e6 : 0;
+        dprintf(fd, "%14llu %9.3fs %10.1f %8ld KB  %s%s\n", counter->bytes, counter->seconds, rate,
+                counter->capacity / 1024, counter->label, counterFinished(counter) ? "" : " (running)");
+        printed[next] = true;
+    }
+}
+
+/**
+ * Forget every counted pipe that has finished.
+ */
+void resetPipeCounters(void) {
+    int i;
+    for (i = 0; counters && i < MAX_PIPE_COUNTERS; i++) {
+        if (counters[i].used && counterFinished(&counters[i])) {
+            counters[i].used = false;
+        }
+    }
+}
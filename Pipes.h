@@ -0,0 +1,78 @@
+#ifndef Pipes_h
+#define Pipes_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+/**
+ * Open a pipe between two stages of a pipeline, with the capacity set by setPipeSize(),
+ * in packet mode if setPipePackets() asked for it. Both ends are closed on exec.
+ * @param fd Filled with the read end and the write end.
+ * @return 0 if success, -1 otherwise.
+ */
+int openStagePipe(int fd[2]);
+
+/**
+ * Choose the capacity of the pipes between pipeline stages. Larger pipes let a fast stage run further ahead
+ * before it has to wait, so the stages switch back and forth less often.
+ * @param bytes The capacity to ask for, which is limited to what the system allows. 0 goes back to the system's default.
+ * @return The capacity pipes will be given (0 for the default), or -1 if this system can't resize pipes.
+ */
+long setPipeSize(long bytes);
+
+/**
+ * @return The capacity pipes between pipeline stages are given, or 0 for the system's default.
+ */
+long getPipeSize(void);
+
+/**
+ * Choose whether pipes between pipeline stages are opened in packet mode (O_DIRECT), where every write
+ * is read back whole by a single read, and whatever a shorter read leaves of it is thrown away.
+ * @param packets Whether or not to use packet mode.
+ * @return 0 if success, -1 if this system has no packet mode.
+ */
+int setPipePackets(bool packets);
+
+/**
+ * @return Whether or not pipes between pipeline stages are opened in packet mode.
+ */
+bool getPipePackets(void);
+
+/**
+ * Choose whether the bytes passing through every pipe between pipeline stages are counted, for 'stats' to report.
+ * Each counted pipe has a copy of the shell moving its bytes along, so counting is off unless asked for.
+ * @param counting Whether or not to count.
+ */
+void setPipeCounting(bool counting);
+
+/**
+ * @return Whether or not the bytes through pipes between pipeline stages are counted.
+ */
+bool getPipeCounting(void);
+
+/**
+ * Count the bytes a pipe carries, by having a copy of the shell move them into a second pipe as they arrive.
+ * The copy belongs to no job, and finishes when the pipe's writer does or the next stage stops reading.
+ * @param input The read end of the pipe, which is closed.
+ * @param label The stages the pipe connects, for the report.
+ * @param pgid The process group the copy joins: -1 for the shell's own, 0 for a new one.
+ * @return The descriptor the next stage should read from instead: the pipe itself, if it can't be counted.
+ */
+int startPipeCounter(int input, const char *label, pid_t pgid);
+
+/**
+ * Print the bytes every counted pipe has carried, and how fast, oldest first. Prints nothing if no pipe was counted.
+ * @param fd Where to print.
+ */
+void printPipeCounters(int fd);
+
+/**
+ * Forget every counted pipe that has finished.
+ */
+void resetPipeCounters(void);
+
+#endif /* Pipes_h */
@@ -0,0 +1,377 @@
+#ifdef __linux__
+#define _GNU_SOURCE // sched_setaffinity(), CPU_SET()
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+#include "Placement.h"
+#include "Builtin.h"
+
+#include <limits.h>
+
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+static bool autoPlacement = false;
+static int *cpuOrder = NULL; // Every CPU the shell may run on, with CPUs that share cache next to each other
+static int numOrderedCpus = 0;
+static int nextCpu = 0; // Where the next automatically placed pipeline starts
+
+/**
+ * Read the CPUs a 'pin' prefix names, as a list of CPU numbers and ranges such as 0-3,8.
+ * @param text The list of CPUs.
+ * @param placement Pinned to the CPUs.
+ * @return Whether or not the text was a list of CPUs.
+ */
+bool parseCpuList(const char *text, Placement *placement) {
+    memset(placement->cpus, 0, sizeof(placement->cpus));
+    const char *c = text;
+    do {
+        char *end;
+        long first = strtol(c, &end, 10), last = first;
+        if (end == c || first < 0) {
+            return false;
+        }
+        if (*end == '-') {
+            c = end + 1;
+            last = strtol(c, &end, 10);
+            if (end == c || last < first) {
+                return false;
+            }
+        }
+        if (last >= MAX_PLACEMENT_CPUS) {
+            return false;
+        }
+        for (; first <= last; first++) {
+            placement->cpus[first / 8] |= 1 << (first % 8);
+        }
+        c = end;
+    } while (*c++ == ',');
+    if (c[-1] != '\0') {
+        return false;
+    }
+    placement->pinned = true;
+    return true;
+}
+
+/**
+ * Read an I/O priority, given as idle, best-effort or realtime, optionally followed by :LEVEL from 0 (highest) to 7.
+ * @param text The I/O priority.
+ * @param placement Given the I/O priority.
+ * @return Whether or not the text was an I/O priority.
+ */
+static bool parseIoPriority(const char *text, Placement *placement) {
+    static const char *classes[] = { "realtime", "best-effort", "idle" }; // Numbered from 1, as the kernel does
+    size_t length = strcspn(text, ":");
+    int i;
+    for (i = 0; i < 3; i++) {
+        if (strlen(classes[i]) == length && strncmp(classes[i], text, length) == 0) {
+            break;
+        }
+    }
+    if (i == 3) {
+        return false;
+    }
+    placement->ioClass = i + 1;
+    placement->ioLevel = 4; // The kernel's default level
+    if (text[length] == ':') {
+        char *end;
+        placement->ioLevel = (int)strtol(&text[length + 1], &end, 10);
+        if (end == &text[length + 1] || *end != '\0' || placement->ioLevel < 0 || placement->ioLevel > 7) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Read a resource limit, which may be 'unlimited'.
+ * @param text The limit.
+ * @param bytes Whether or not the limit is a size in bytes, which may be followed by k, m or g.
+ * @param value Set to the limit.
+ * @return Whether or not the text was a limit.
+ */
+static bool parseResourceLimit(const char *text, bool bytes, rlim_t *value) {
+    if (strcmp(text, "unlimited") == 0) {
+        *value = RLIM_INFINITY;
+        return true;
+    }
+    long number;
+    if (bytes) {
+        if (!parseByteSize(text, &number)) {
+            return false;
+        }
+    } else {
+        char *end;
+        errno = 0;
+        number = strtol(text, &end, 10);
+        if (end == text || *end != '\0' || number < 0 || errno == ERANGE) {
+            return false;
+        }
+    }
+    *value = (rlim_t)number;
+    return true;
+}
+
+/**
+ * Read the settings a 'limit' prefix gives, as a comma separated list of nice=N, ionice=CLASS[:LEVEL],
+ * cpu=SECONDS, as=BYTES and nofile=N. Resource limits may also be 'unlimited'.
+ * @param text The settings.
+ * @param placement Updated with the settings.
+ * @param bad Set to the setting that could not be read, if any.
+ * @return Whether or not every setting could be read.
+ */
+bool parseLimits(const char *text, Placement *placement, const char **bad) {
+    static const struct {
+        const char *name;
+        int resource;
+        bool bytes;
+    } resources[] = {
+        { "cpu", RLIMIT_CPU, false },
+        { "as", RLIMIT_AS, true },
+        { "nofile", RLIMIT_NOFILE, false },
+    };
+    char setting[64];
+    const char *c = text;
+    while (*c) {
+        size_t length = strcspn(c, ",");
+        *bad = c;
+        if (length >= sizeof(setting)) {
+            return false;
+        }
+        memcpy(setting, c, length);
+        setting[length] = '\0';
+        c += length + (c[length] == ',');
+    
+        char *value = strchr(setting, '=');
+        if (value == NULL) {
+            return false;
+        }
+        *value++ = '\0';
+        if (strcmp(setting, "nice") == 0) {
+            char *end;
+            long nice = strtol(value, &end, 10);
+            if (end == value || *end != '\0' || nice < -20 || nice > 19) {
+                return false;
+            }
+            placement->niced = true;
+            placement->nice = (int)nice;
+            continue;
+        } else if (strcmp(setting, "ionice") == 0) {
+            if (!parseIoPriority(value, placement)) {
+                return false;
+            }
+            continue;
+        }
+        int i;
+        for (i = 0; i < 3 && strcmp(setting, resources[i].name) != 0; i++) {
+        }
+        rlim_t limit;
+        if (i == 3 || !parseResourceLimit(value, resources[i].bytes, &limit)) {
+            return false;
+        }
+        int j;
+        for (j = 0; j < placement->numLimits && placement->limits[j].resource != resources[i].resource; j++) {
+        }
+        placement->limits[j].resource = resources[i].resource; // The last setting for a resource wins
+        placement->limits[j].value = limit;
+        if (j == placement->numLimits) {
+            placement->numLimits++;
+        }
+    }
+    *bad = NULL;
+    return true;
+}
+
+/**
+ * @param placement A placement, or NULL.
+ * @return Whether or not applying the placement changes anything.
+ */
+bool placementNeeded(const Placement *placement) {
+    return placement && (placement->pinned || placement->niced || placement->ioClass || placement->numLimits);
+}
+
+/**
+ * Apply a placement to the calling process, a child that is about to run its command.
+ * A priority that can't be given is reported and left alone, but CPUs or a limit that can't be are an error.
+ * @param placement The placement to apply.
+ * @param name The command, used when reporting errors.
+ * @return 0 if success, -1 (with the error reported) otherwise.
+ */
+int applyPlacement(const Placement *placement, const char *name) {
+    if (placement->pinned) {
+#ifdef __linux__
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        int cpu;
+        for (cpu = 0; cpu < MAX_PLACEMENT_CPUS && cpu < CPU_SETSIZE; cpu++) {
+            if (placement->cpus[cpu / 8] & (1 << (cpu % 8))) {
+                CPU_SET(cpu, &cpus);
+            }
+        }
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+            fprintf(stderr, "%s: can't be pinned to those CPUs: %s\n", name, strerror(errno));
+            return -1;
+        }
+#else
+        fprintf(stderr, "%s: processes can't be pinned to CPUs on this system\n", name);
+        return -1;
+#endif
+    }
+    if (placement->niced && setpriority(PRIO_PROCESS, 0, placement->nice) == -1) {
+        fprintf(stderr, "%s: nice %d: %s\n", name, placement->nice, strerror(errno));
+    }
+    if (placement->ioClass) {
+#ifdef SYS_ioprio_set
+        int priority = placement->ioClass << IOPRIO_CLASS_SHIFT | placement->ioLevel;
+        if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, priority) == -1) {
+            fprintf(stderr, "%s: ionice: %s\n", name, strerror(errno));
+        }
+#else
+        fprintf(stderr, "%s: ionice: I/O priorities aren't supported on this system\n", name);
+#endif
+    }
+    int i;
+    for (i = 0; i < placement->numLimits; i++) {
+        struct rlimit limit;
+        getrlimit(placement->limits[i].resource, &limit);
+        limit.rlim_cur = placement->limits[i].value; // Only the soft limit, which the command may raise again
+        if (setrlimit(placement->limits[i].resource, &limit) == -1) {
+            fprintf(stderr, "%s: limit: %s\n", name, strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Choose whether the stages of every pipeline are pinned automatically, each to its own CPU, with adjacent stages
+ * on CPUs that share as much cache as possible, so the bytes between them stay in the cache they share.
+ * @param automatic Whether or not to place stages automatically.
+ * @return 0 if success, -1 if this system can't pin processes to CPUs.
+ */
+int setAutoPlacement(bool automatic) {
+#ifdef __linux__
+    autoPlacement = automatic;
+    return 0;
+#else
+    return automatic ? -1 : 0;
+#endif
+}
+
+/**
+ * @return Whether or not the stages of every pipeline are placed automatically.
+ */
+bool getAutoPlacement(void) {
+    return autoPlacement;
+}
+
+#ifdef __linux__
+/**
+ * Find which CPUs share a level of cache with a CPU.
+ * @param cpu The CPU.
+ * @param level The level of cache, such as 2 or 3.
+ * @return The lowest numbered CPU that shares the cache, which stands for all of them, or the CPU itself if unknown.
+ */
+static int cacheGroup(int cpu, int level) {
+    int index;
+    for (index = 0; index < 8; index++) {
+        char path[128];
+        int cacheLevel = 0, first = cpu;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, index);
+        FILE *file = fopen(path, "r");
+        if (file == NULL) {
+            break;
+        }
+        bool read = fscanf(file, "%d", &cacheLevel) == 1;
+        fclose(file);
+        if (!read || cacheLevel != level) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+        if ((file = fopen(path, "r")) != NULL) {
+            if (fscanf(file, "%d", &first) != 1) {
+                first = cpu;
+            }
+            fclose(file);
+        }
+        return first;
+    }
+    return cpu;
+}
+
+/**
+ * @param a The last-level cache, level 2 cache and number of one CPU.
+ * @param b The same for another CPU.
+ * @return Whether or not the first CPU is ordered after the second.
+ */
+static bool comesAfter(const int a[3], const int b[3]) {
+    int i;
+    for (i = 0; i < 2 && a[i] == b[i]; i++) {
+    }
+    return a[i] > b[i];
+}
+
+/**
+ * Order the CPUs the shell may run on so that CPUs sharing a last-level cache come together,
+ * and within them, CPUs sharing a level 2 cache (such as the hyperthreads of one core).
+ */
+static void orderCpus(void) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+        return;
+    }
+    int numCpus = CPU_COUNT(&allowed);
+    int (*keys)[3] = malloc(numCpus * sizeof(*keys));
+    if ((cpuOrder = malloc(numCpus * sizeof(int))) == NULL || keys == NULL) {
+        perror("Unable to allocate memory.\n\r");
+        exit(EXIT_FAILURE);
+    }
+    int cpu;
+    for (cpu = 0; cpu < CPU_SETSIZE && numOrderedCpus < numCpus; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) {
+            continue;
+        }
+        int key[3] = { cacheGroup(cpu, 3), cacheGroup(cpu, 2), cpu };
+        int i = numOrderedCpus++; // Insertion sort, as there are few enough CPUs
+        while (i > 0 && comesAfter(keys[i - 1], key)) {
+            memcpy(keys[i], keys[i - 1], sizeof(key));
+            cpuOrder[i] = cpuOrder[i - 1];
+            i--;
+        }
+        memcpy(keys[i], key, sizeof(key));
+        cpuOrder[i] = cpu;
+    }
+    free(keys);
+}
+#endif
+
+/**
+ * Pin the stages of a pipeline to CPUs, when placing stages automatically. Stages that were pinned already are left
+ * as they are. Each pipeline starts on the CPU after the last one the previous pipeline used.
+ * @param placements The placement of each stage, in order.
+ * @param numStages The number of stages in the pipeline.
+ */
+void placeStages(Placement placements[], int numStages) {
+#ifdef __linux__
+    if (!autoPlacement || numStages < 2) { // A lone command is left free to use as many CPUs as it likes
+        return;
+    }
+    if (cpuOrder == NULL) {
+        orderCpus();
+    }
+    int i;
+    for (i = 0; i < numStages && numOrderedCpus > 0; i++) {
+        if (placements[i].pinned) {
+            continue;
+        }
+        int cpu = cpuOrder[nextCpu];
+        nextCpu = (nextCpu + 1) % numOrderedCpus;
+        if (cpu < MAX_PLACEMENT_CPUS) {
+            memset(placements[i].cpus, 0, sizeof(placements[i].cpus));
+            placements[i].cpus[cpu / 8] |= 1 << (cpu % 8);
+            placements[i].pinned = true;
+        }
+    }
+#endif
+}
@@ -0,0 +1,88 @@
+#ifndef Placement_h
+#define Placement_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#define MAX_PLACEMENT_CPUS 1024
+#define MAX_PLACEMENT_LIMITS 3
+
+/**
+ * Where a pipeline stage runs and what it may use: the CPUs it may run on, its priority for the CPU and for I/O,
+ * and limits on its resources. Applied in the stage's own process, just before it runs the command.
+ */
+typedef struct placement {
+    bool pinned;
+    unsigned char cpus[MAX_PLACEMENT_CPUS / 8]; // One bit per CPU the stage may run on, when pinned
+    bool niced;
+    int nice;
+    int ioClass; // 0 leaves the I/O priority alone
+    int ioLevel;
+    int numLimits;
+    struct {
+        int resource; // RLIMIT_CPU, RLIMIT_AS or RLIMIT_NOFILE
+        rlim_t value;
+    } limits[MAX_PLACEMENT_LIMITS];
+} Placement;
+
+/**
+ * Read the CPUs a 'pin' prefix names, as a list of CPU numbers and ranges such as 0-3,8.
+ * @param text The list of CPUs.
+ * @param placement Pinned to the CPUs.
+ * @return Whether or not the text was a list of CPUs.
+ */
+bool parseCpuList(const char *text, Placement *placement);
+
+/**
+ * Read the settings a 'limit' prefix gives, as a comma separated list of nice=N, ionice=CLASS[:LEVEL],
+ * cpu=SECONDS, as=BYTES and nofile=N. Resource limits may also be 'unlimited'.
+ * @param text The settings.
+ * @param placement Updated with the settings.
+ * @param bad Set to the setting that could not be read, if any.
+ * @return Whether or not every setting could be read.
+ */
+bool parseLimits(const char *text, Placement *placement, const char **bad);
+
+/**
+ * @param placement A placement, or NULL.
+ * @return Whether or not applying the placement changes anything.
+ */
+bool placementNeeded(const Placement *placement);
+
+/**
+ * Apply a placement to the calling process, a child that is about to run its command.
+ * A priority that can't be given is reported and left alone, but CPUs or a limit that can't be are an error.
+ * @param placement The placement to apply.
+ * @param name The command, used when reporting errors.
+ * @return 0 if success, -1 (with the error reported) otherwise.
+ */
+int applyPlacement(const Placement *placement, const char *name);
+
+/**
+ * Choose whether the stages of every pipeline are pinned automatically, each to its own CPU, with adjacent stages
+ * on CPUs that share as much cache as possible, so the bytes between them stay in the cache they share.
+ * @param automatic Whether or not to place stages automatically.
+ * @return 0 if success, -1 if this system can't pin processes to CPUs.
+ */
+int setAutoPlacement(bool automatic);
+
+/**
+ * @return Whether or not the stages of every pipeline are placed automatically.
+ */
+bool getAutoPlacement(void);
+
+/**
+ * Pin the stages of a pipeline to CPUs, when placing stages automatically. Stages that were pinned already are left
+ * as they are. Each pipeline starts on the CPU after the last one the previous pipeline used.
+ * @param placements The placement of each stage, in order.
+ * @param numStages The number of stages in the pipeline.
+ */
+void placeStages(Placement placements[], int numStages);
+
+#endif /* Placement_h */
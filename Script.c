@@ -0,0 +1,169 @@
+#include "Script.h"
+#include "Execute.h"
+#include "ParseCache.h"
+#include "Events.h"
+
+/**
+ * Map a script into memory and parse every one of its lines.
+ * Every syntax error in the script is reported (along with its line number) before returning.
+ * @param path The script to load.
+ * @param script Filled with the script's commands.
+ * @return 0 if success, -1 if the script could not be read or contains a syntax error.
+ */
+int loadScript(const char *path, Script *script) {
+    memset(script, 0, sizeof(Script));
+    
+    int fileNum;
+    if ((fileNum = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+        perror(path);
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fileNum, &info) == -1) {
+        perror(path);
+        close(fileNum);
+        return -1;
+    }
+    script->length = info.st_size;
+    if (script->length > 0) {
+        script->text = mmap(NULL, script->length, PROT_READ, MAP_PRIVATE, fileNum, 0);
+        if (script->text == MAP_FAILED) {
+            perror(path);
+            close(fileNum);
+            script->text = NULL;
+            return -1;
+        }
+        madvise(script->text, script->length, MADV_SEQUENTIAL);
+    }
+    close(fileNum);
+    
+    int numErrors = 0;
+    Parser parser;
+    Node *command;
+    int error = initParser(&parser, script->text, script->length, &script->arena);
+    while (error || (error = parseNext(&parser, &command)) || command != NULL) {
+        if (error) {
+            fprintf(stderr, "%s:%d: Syntax error: %s.\n", path, parser.errorLine, describeParseError(error));
+            numErrors++;
+            error = kParseSuccess;
+            continue;
+        }
+        if (script->numCommands == script->capacity) {
+            script->capacity = script->capacity ? script->capacity * 2 : 64;
+            if ((script->commands = realloc(script->commands, script->capacity * sizeof(Node *))) == NULL) {
+                perror("Unable to allocate memory.\n\r");
+                exit(EXIT_FAILURE);
+            }
+        }
+        script->commands[script->numCommands++] = command;
+    }
+    return numErrors ? -1 : 0;
+}
+
+/**
+ * Execute every command of a loaded script in order.
+ * @param script The script to run.
+ * @return The exit status of the last command.
+ */
+int runScript(Script *script) {
+    int status = EXIT_SUCCESS;
+    int i;
+    for (i = 0; i < script->numCommands; i++) {
+        Node *command = script->commands[i];
+        printf("%.*s\n", (int)command->sourceLength, command->source);
+        status = executeNode(command);
+    }
+    fflush(stdout);
+    return status;
+}
+
+/**
+ * Release everything a loaded script holds, including its mapping.
+ * @param script The script to free.
+ */
+void freeScript(Script *script) {
+    if (script->text) {
+        munmap(script->text, script->length);
+    }
+    free(script->commands);
+    freeArena(&script->arena);
+    memset(script, 0, sizeof(Script));
+}
+
+/**
+ * Parse and execute a single line of input, echoing it first. At an interactive prompt, finished
+ * background jobs are reported and the next prompt is printed afterwards.
+ * @param line The line to process. A trailing newline is removed.
+ * @param input Where the line was read from, or NULL if it was given on the command line.
+ * @return The exit status of the line, or 2 if it has a syntax error.
+ */
+int processLine(char *line, FILE *input) {
+    int status = EXIT_SUCCESS;
+    
+    if(line[strlen(line)-1] == '\n')
+        line[strlen(line)-1] = '\0';   /* zap the newline */
+    
+    if (line[0] != '#') {
+        printf("%s\n", line);
+        char *text = line, *joined = NULL;
+        size_t length = strlen(line);
+        ParsedLine *parsed; // Repeated lines are only parsed the first time
+        int error;
+        char *next = NULL;
+        size_t nextCapacity = 0;
+        bool cancelled = false;
+        while ((parsed = acquireParsedLine(text, length, &error)) == NULL && input != NULL &&
+               (error == kParseIncomplete || error == kParseUnterminatedHereDocument)) {
+            // An if, while, until or for, or a here-document's body, carries on over the following lines
+            if (input == stdin) {
+                printf("> ");
+                fflush(stdout);
+            }
+            ssize_t nextLength = readInputLine(&next, &nextCapacity, input); // However long the line is
+            if (nextLength == -2) { // ^C abandons the whole command
+                cancelled = true;
+                break;
+            }
+            if (nextLength == -1) {
+                break;
+            }
+            if (nextLength > 0 && next[nextLength - 1] == '\n') {
+                next[--nextLength] = '\0';
+            }
+            printf("%s\n", next);
+            if ((joined = realloc(joined, length + nextLength + 2)) == NULL) {
+                perror("Unable to allocate memory.\n\r");
+                exit(EXIT_FAILURE);
+            }
+            if (text == line) {
+                memcpy(joined, line, length);
+            }
+            joined[length++] = '\n';
+            memcpy(&joined[length], next, nextLength + 1);
+            length += nextLength;
+            text = joined;
+        }
+        if (cancelled) {
+            printf("\n");
+            status = 128 + SIGINT;
+        } else if (error) {
+            fflush(stdout);
+            fprintf(stderr, "Syntax error: %s.\n", describeParseError(error));
+            status = 2;
+        } else {
+            status = executeNode(parsed->program);
+            releaseParsedLine(parsed);
+        }
+        free(joined);
+        free(next);
+    }
+    if(input == stdin)
+    {
+        if (jobControlEnabled()) {
+            notifyJobs();
+        }
+        printf("? ");
+        fflush(stdout);
+    }
+    return status;
+}
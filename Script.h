@@ -0,0 +1,60 @@
+#ifndef Script_h
+#define Script_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Arena.h"
+#include "Parse.h"
+
+/**
+ * A whole script, memory-mapped and parsed into a list of commands before any of them run.
+ * Each command is a line's worth, which spans several lines of the script when an if, while, until or for does.
+ */
+typedef struct script {
+    char *text;
+    size_t length;
+    Node **commands;
+    int numCommands, capacity;
+    Arena arena;
+} Script;
+
+/**
+ * Map a script into memory and parse every one of its lines.
+ * Every syntax error in the script is reported (along with its line number) before returning.
+ * @param path The script to load.
+ * @param script Filled with the script's commands.
+ * @return 0 if success, -1 if the script could not be read or contains a syntax error.
+ */
+int loadScript(const char *path, Script *script);
+
+/**
+ * Execute every command of a loaded script in order.
+ * @param script The script to run.
+ * @return The exit status of the last command.
+ */
+int runScript(Script *script);
+
+/**
+ * Release everything a loaded script holds, including its mapping.
+ * @param script The script to free.
+ */
+void freeScript(Script *script);
+
+/**
+ * Parse and execute a single line of input, echoing it first. At an interactive prompt, finished
+ * background jobs are reported and the next prompt is printed afterwards.
+ * When an if, while, until or for is left open, further lines are read from the input to finish it.
+ * @param line The line to process. A trailing newline is removed.
+ * @param input Where the line was read from, or NULL if it was given on the command line.
+ * @return The exit status of the line, or 2 if it has a syntax error.
+ */
+int processLine(char *line, FILE *input);
+
+#endif /* Script_h */
@@ -0,0 +1,378 @@
+#ifdef __linux__
+#define _GNU_SOURCE // struct ucred, for SO_PEERCRED
+#endif
+
+#include "Server.h"
+#include "Script.h"
+#include "ParseCache.h"
+#include "Job.h"
+#include "Variables.h"
+
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+extern char **environ;
+
+// The largest request accepted, which mostly bounds how large a client's environment can be
+#define MAX_REQUEST_SIZE (16 * 1024 * 1024)
+
+/**
+ * A client whose request is being run by a forked worker, waiting for the worker's exit status.
+ */
+typedef struct connection {
+    Job *job;
+    int fd;
+} Connection;
+
+/**
+ * Fill in the address of a socket.
+ * @param path The socket's path.
+ * @param address Filled with the address.
+ * @return 0 if success, -1 if the path is too long for a socket.
+ */
+static int socketAddress(const char *path, struct sockaddr_un *address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address->sun_path, path);
+    return 0;
+}
+
+/**
+ * Receive a request, along with the client's descriptors. The server reads it itself, before forking a worker,
+ * so that the line can be parsed (and remembered) in the server rather than afresh in every worker.
+ * @param connection The client's connection, which gives up on a client that stops sending part way through.
+ * @param fds Filled with the client's standard input, output and error, which the caller closes.
+ * @param length Set to the length of the payload.
+ * @return The payload, to be freed by the caller, or NULL if the connection did not carry a valid request.
+ */
+static char *receiveRequest(int connection, int fds[3], size_t *length) {
+    RequestHeader header;
+    struct iovec buffer = { &header, sizeof(header) };
+    union {
+        struct cmsghdr align;
+        char data[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &buffer;
+    message.msg_iovlen = 1;
+    message.msg_control = control.data;
+    message.msg_controllen = sizeof(control.data);
+    
+    ssize_t received;
+    while ((received = recvmsg(connection, &message, 0)) == -1 && errno == EINTR) {
+        continue;
+    }
+    struct cmsghdr *rights = received > 0 ? CMSG_FIRSTHDR(&message) : NULL;
+    if (rights == NULL || rights->cmsg_level != SOL_SOCKET || rights->cmsg_type != SCM_RIGHTS ||
+        rights->cmsg_len != CMSG_LEN(3 * sizeof(int))) {
+        int numReceived = rights && rights->cmsg_type == SCM_RIGHTS ? (rights->cmsg_len - CMSG_LEN(0)) / sizeof(int) : 0;
+        int i;
+        for (i = 0; i < numReceived; i++) { // The server lives on, so nothing a stranger sent may stay open
+            memcpy(&fds[0], CMSG_DATA(rights) + i * sizeof(int), sizeof(int));
+            close(fds[0]);
+        }
+        return NULL; // Not a client, since every request comes with the client's descriptors
+    }
+    memcpy(fds, CMSG_DATA(rights), 3 * sizeof(int));
+    char *payload = NULL;
+    if (((size_t)received < sizeof(header) &&
+         readAll(connection, (char *)&header + received, sizeof(header) - received) == -1) ||
+        header.magic != SERVER_MAGIC || header.length > MAX_REQUEST_SIZE ||
+        (payload = malloc(header.length + 1)) == NULL || readAll(connection, payload, header.length) == -1) {
+        free(payload);
+        close(fds[0]);
+        close(fds[1]);
+        close(fds[2]);
+        return NULL;
+    }
+    payload[header.length] = '\0';
+    
+    // The payload is the working directory, then the command line, then the environment, each ending with a NUL
+    char *line = payload + strlen(payload) + 1;
+    if (line >= payload + header.length) {
+        free(payload);
+        close(fds[0]);
+        close(fds[1]);
+        close(fds[2]);
+        return NULL;
+    }
+    *length = header.length;
+    return payload;
+}
+
+/**
+ * In a forked worker, take over the client's descriptors, working directory and environment,
+ * and run its command line. The worker's exit status is the line's, which the server passes back to the client.
+ * @param payload The request, as receiveRequest() returned it.
+ * @param length The length of the payload.
+ * @param fds The client's standard input, output and error.
+ */
+static void serveRequest(char *payload, size_t length, int fds[3]) {
+    char *end = payload + length;
+    char *cwd = payload;
+    char *line = cwd + strlen(cwd) + 1;
+    char *variables = line + strlen(line) + 1;
+    int numVariables = 0;
+    char *variable;
+    for (variable = variables; variable < end; variable += strlen(variable) + 1) {
+        numVariables++;
+    }
+    char **environment = malloc((numVariables + 1) * sizeof(char *));
+    if (environment == NULL) {
+        perror("Unable to allocate memory.\n\r");
+        _exit(EXIT_FAILURE);
+    }
+    numVariables = 0;
+    for (variable = variables; variable < end; variable += strlen(variable) + 1) {
+        environment[numVariables++] = variable;
+    }
+    environment[numVariables] = NULL;
+    
+    int i;
+    for (i = 0; i < 3; i++) {
+        if (fds[i] != i) {
+            dup2(fds[i], i);
+            close(fds[i]);
+        }
+    }
+    environ = environment;
+    initVariables(); // The client's variables, in place of the server's
+    signal(SIGPIPE, SIG_DFL);
+    if (chdir(cwd) == -1) {
+        fprintf(stderr, "nsh: %s: %s\n", cwd, strerror(errno));
+    }
+    int status = processLine(line, NULL); // Found in the parse cache the server filled before forking
+    fflush(stdout);
+    exit(status);
+}
+
+/**
+ * Check that a client runs as the same user as the server. A client's line runs with the server's privileges,
+ * on descriptors the client hands over, so no other user may have it run.
+ * @param connection A connection accepted from a client.
+ * @return Whether or not the client may be served.
+ */
+static bool isSameUser(int connection) {
+#ifdef __linux__
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+    return getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0 && credentials.uid == geteuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(connection, &uid, &gid) == 0 && uid == geteuid();
+#endif
+}
+
+/**
+ * Serve command lines over a Unix domain socket until the shell is killed.
+ * Each line is parsed by the server itself, through its parse cache, so that a line it has seen before is not parsed again.
+ * It is then run by a forked copy of the server, which inherits the parsed line and the warm command cache,
+ * so several clients are served at once. A request's output goes straight to the client's own descriptors,
+ * and its exit status is sent back once the line has finished. Only the server's own user may connect:
+ * the socket is created with mode 0600, and clients running as anyone else are turned away.
+ * @param path Where to create the socket. Anything already there is replaced.
+ * @return 1 if the socket could not be created. Otherwise never returns.
+ */
+int runServer(const char *path) {
+    struct sockaddr_un address;
+    int listener;
+    if (socketAddress(path, &address) == -1 || (listener = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+    fcntl(listener, F_SETFD, FD_CLOEXEC);
+    unlink(path);
+    mode_t previousMask = umask(0177); // The socket is created with mode 0600, with no moment it is open to others
+    int bound = bind(listener, (struct sockaddr *)&address, sizeof(address));
+    umask(previousMask);
+    if (bound == -1 || listen(listener, SOMAXCONN) == -1) {
+        perror(path);
+        close(listener);
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN); // A client that goes away must not take the server with it
+    fprintf(stderr, "nsh: serving on %s\n", path);
+    
+    Connection *connections = NULL;
+    int numConnections = 0, capacity = 0;
+    
+    // SIGCHLD is only let through while waiting for a connection, so that a worker finishing always wakes the server
+    sigset_t previous, waiting;
+    blockChildSignals(&previous);
+    waiting = previous;
+    sigdelset(&waiting, SIGCHLD);
+    while (true) {
+        int i;
+        for (i = 0; i < numConnections; i++) { // Tell every client whose line has finished how it went
+            Connection *connection = &connections[i];
+            if (jobState(connection->job) != kJobDone) {
+                continue;
+            }
+            ResponseHeader response = { SERVER_MAGIC, jobExitStatus(connection->job) };
+            writeAll(connection->fd, &response, sizeof(response));
+            close(connection->fd);
+            removeJob(connection->job);
+            connections[i--] = connections[--numConnections];
+        }
+        
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(listener, &readable);
+        if (pselect(listener + 1, &readable, NULL, NULL, NULL, &waiting) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Unable to wait for a connection.\n\r");
+            exit(EXIT_FAILURE);
+        }
+        int fd = accept(listener, NULL, NULL);
+        if (fd == -1) {
+            continue;
+        } else if (!isSameUser(fd)) {
+            fprintf(stderr, "nsh: refused a connection from another user\n");
+            close(fd);
+            continue;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        struct timeval timeout = { 1, 0 }; // A client that stalls part way through its request holds up the server no longer
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        int fds[3];
+        size_t length;
+        char *payload = receiveRequest(fd, fds, &length);
+        if (payload == NULL) {
+            close(fd);
+            continue;
+        }
+        char *line = payload + strlen(payload) + 1;
+        if (line[0] && line[strlen(line) - 1] == '\n') {
+            line[strlen(line) - 1] = '\0'; // As processLine() will, so that the worker finds the very same line
+        }
+        int error;
+        ParsedLine *parsed = acquireParsedLine(line, strlen(line), &error); // A syntax error is left to the worker to report
+        if (numConnections == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            if ((connections = realloc(connections, capacity * sizeof(Connection))) == NULL) {
+                perror("Unable to allocate memory.\n\r");
+                exit(EXIT_FAILURE);
+            }
+        }
+        
+        fflush(stdout);
+        fflush(stderr);
+        Job *job = addJob(1, "connection");
+        clock_gettime(CLOCK_MONOTONIC, &job->processes[0].started);
+        pid_t pid = fork();
+        if (pid == 0) { // The worker starts over with no connections or jobs of its own
+            close(listener);
+            close(fd);
+            clearJobs();
+            restoreChildSignals(&previous);
+            serveRequest(payload, length, fds);
+        }
+        if (parsed) {
+            releaseParsedLine(parsed);
+        }
+        free(payload);
+        for (i = 0; i < 3; i++) {
+            close(fds[i]);
+        }
+        if (pid == -1) {
+            perror("Unable to fork a child process.\n\r");
+            close(fd);
+            removeJob(job);
+            continue;
+        }
+        job->processes[0].pid = pid;
+        connections[numConnections].job = job;
+        connections[numConnections++].fd = fd;
+    }
+}
+
+/**
+ * Run a command line on a server, as though it were run by this process:
+ * in its working directory, with its environment, reading and writing its standard input, output and error.
+ * @param path The server's socket.
+ * @param line The command line to run.
+ * @return The exit status of the line, or -1 if no server could be reached (so the line should be run locally).
+ */
+int runOnServer(const char *path, const char *line) {
+    struct sockaddr_un address;
+    char cwd[PATH_MAX];
+    int server;
+    if (socketAddress(path, &address) == -1 || getcwd(cwd, sizeof(cwd)) == NULL ||
+        (server = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        return -1;
+    }
+    if (connect(server, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        close(server);
+        return -1;
+    }
+    
+    size_t length = strlen(cwd) + 1 + strlen(line) + 1;
+    int i;
+    for (i = 0; environ[i]; i++) {
+        length += strlen(environ[i]) + 1;
+    }
+    char *payload = malloc(length), *end = payload;
+    if (payload == NULL) {
+        perror("Unable to allocate memory.\n\r");
+        exit(EXIT_FAILURE);
+    }
+    end = stpcpy(end, cwd) + 1;
+    end = stpcpy(end, line) + 1;
+    for (i = 0; environ[i]; i++) {
+        end = stpcpy(end, environ[i]) + 1;
+    }
+    
+    // The header carries this process's standard input, output and error, for the server to use as its own
+    RequestHeader header = { SERVER_MAGIC, (uint32_t)length };
+    struct iovec buffer = { &header, sizeof(header) };
+    union {
+        struct cmsghdr align;
+        char data[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &buffer;
+    message.msg_iovlen = 1;
+    message.msg_control = control.data;
+    message.msg_controllen = sizeof(control.data);
+    struct cmsghdr *rights = CMSG_FIRSTHDR(&message);
+    rights->cmsg_level = SOL_SOCKET;
+    rights->cmsg_type = SCM_RIGHTS;
+    rights->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    memcpy(CMSG_DATA(rights), fds, sizeof(fds));
+    
+    ssize_t sent;
+    while ((sent = sendmsg(server, &message, 0)) == -1 && errno == EINTR) {
+        continue;
+    }
+    if (sent == -1) { // Such as when one of the descriptors is closed, which can't be sent
+        free(payload);
+        close(server);
+        return -1;
+    }
+    if ((size_t)sent < sizeof(header)) {
+        writeAll(server, (char *)&header + sent, sizeof(header) - sent);
+    }
+    int status = EXIT_FAILURE;
+    ResponseHeader response;
+    if (writeAll(server, payload, length) == -1 || readAll(server, &response, sizeof(response)) == -1 ||
+        response.magic != SERVER_MAGIC) {
+        fprintf(stderr, "nsh: Lost the connection to the server.\n");
+    } else {
+        status = response.status;
+    }
+    free(payload);
+    close(server);
+    return status;
+}
@@ -0,0 +1,60 @@
+#ifndef Server_h
+#define Server_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/un.h>
+
+/**
+ * The first bytes of every message between a client and the server, to catch anything that isn't nsh on the other end.
+ */
+#define SERVER_MAGIC 0x4e534831 // "NSH1"
+
+/**
+ * Precedes a request, which is sent along with the client's standard input, output and error (as SCM_RIGHTS).
+ * The payload that follows is the client's working directory, its command line, and then every variable
+ * of its environment, each terminated by a NUL.
+ */
+typedef struct requestHeader {
+    uint32_t magic;
+    uint32_t length;
+} RequestHeader;
+
+/**
+ * The server's reply once a request's command line has finished.
+ */
+typedef struct responseHeader {
+    uint32_t magic;
+    int32_t status;
+} ResponseHeader;
+
+/**
+ * Serve command lines over a Unix domain socket until the shell is killed.
+ * Each line is parsed by the server itself, through its parse cache, so that a line it has seen before is not parsed again.
+ * It is then run by a forked copy of the server, which inherits the parsed line and the warm command cache,
+ * so several clients are served at once. A request's output goes straight to the client's own descriptors,
+ * and its exit status is sent back once the line has finished.
+ * @param path Where to create the socket. Anything already there is replaced.
+ * @return 1 if the socket could not be created. Otherwise never returns.
+ */
+int runServer(const char *path);
+
+/**
+ * Run a command line on a server, as though it were run by this process:
+ * in its working directory, with its environment, reading and writing its standard input, output and error.
+ * @param path The server's socket.
+ * @param line The command line to run.
+ * @return The exit status of the line, or -1 if no server could be reached (so the line should be run locally).
+ */
+int runOnServer(const char *path, const char *line);
+
+#endif /* Server_h */
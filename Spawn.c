@@ -0,0 +1,368 @@
+#ifdef __linux__
+#define _GNU_SOURCE // pipe2()
+#endif
+
+#include "Spawn.h"
+
+#include <signal.h>
+
+#include "Trace.h"
+#include "Zygote.h"
+#include "Events.h"
+#include "Job.h"
+#include "Variables.h"
+
+// The launcher used when NSH_LAUNCHER does not name one. Build with -DNSH_LAUNCH_MODE=kLaunchFork to compare against fork().
+#ifndef NSH_LAUNCH_MODE
+#define NSH_LAUNCH_MODE kLaunchSpawn
+#endif
+
+static LaunchMode launchMode = NSH_LAUNCH_MODE;
+static const Placement *launchPlacement = NULL;
+
+/**
+ * Fill a set with every signal that the shell handles or ignores itself, but that a command should get the default behavior for.
+ * @param signals The set to fill.
+ */
+static void defaultSignalSet(sigset_t *signals) {
+    sigemptyset(signals);
+    sigaddset(signals, SIGINT);
+    sigaddset(signals, SIGQUIT);
+    sigaddset(signals, SIGPIPE);
+    sigaddset(signals, SIGCHLD);
+    sigaddset(signals, SIGTSTP);
+    sigaddset(signals, SIGTTIN);
+    sigaddset(signals, SIGTTOU);
+}
+
+/**
+ * In a forked child, undo the shell's signal handling before calling exec, and unblock every signal.
+ * @param keepChildHandler Whether or not to leave the SIGCHLD handler installed, for a child that keeps running shell code.
+ */
+static void resetChildSignals(bool keepChildHandler) {
+    sigset_t signals;
+    defaultSignalSet(&signals);
+    if (keepChildHandler) {
+        sigdelset(&signals, SIGCHLD);
+    }
+    int signum;
+    for (signum = 1; signum < NSIG; signum++) {
+        if (sigismember(&signals, signum) == 1) {
+            signal(signum, SIG_DFL);
+        }
+    }
+    sigemptyset(&signals);
+    sigprocmask(SIG_SETMASK, &signals, NULL);
+}
+
+/**
+ * Choose how every following child process is launched.
+ * @param mode The launcher to use.
+ */
+void setLaunchMode(LaunchMode mode) {
+    launchMode = mode;
+}
+
+/**
+ * @return The launcher currently in use.
+ */
+LaunchMode getLaunchMode(void) {
+    return launchMode;
+}
+
+/**
+ * Choose where, and with what limits, every following child process runs, until it is set back to NULL.
+ * A child with a placement is always forked, and applies the placement itself just before calling exec,
+ * since neither posix_spawn() nor the zygote can run anything in the child first.
+ * @param placement The placement, which must stay valid while children are launched, or NULL for none.
+ */
+void setLaunchPlacement(const Placement *placement) {
+    launchPlacement = placementNeeded(placement) ? placement : NULL;
+}
+
+/**
+ * Look up a launcher by name, as given in the NSH_LAUNCHER environment variable.
+ * @param name One of "fork", "spawn" or "zygote".
+ * @param mode Set to the matching launcher, if one is found.
+ * @return Whether or not the name matched a launcher.
+ */
+bool launchModeFromName(const char *name, LaunchMode *mode) {
+    if (strcmp(name, "fork") == 0) {
+        *mode = kLaunchFork;
+        return true;
+    } else if (strcmp(name, "spawn") == 0) {
+        *mode = kLaunchSpawn;
+        return true;
+    } else if (strcmp(name, "zygote") == 0) {
+        *mode = kLaunchZygote;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Create a pipe whose ends are closed on exec, so that only the processes they are explicitly handed to keep them open.
+ * @param fd Filled with the read end followed by the write end.
+ * @return 0 if success, -1 otherwise.
+ */
+int openPipe(int fd[2]) {
+#ifdef __linux__
+    return pipe2(fd, O_CLOEXEC); // At once, so a child forked by another thread can't inherit the pipe in between
+#else
+    if (pipe(fd) == -1) {
+        return -1;
+    }
+    if (fcntl(fd[0], F_SETFD, FD_CLOEXEC) == -1 || fcntl(fd[1], F_SETFD, FD_CLOEXEC) == -1) {
+        close(fd[0]);
+        close(fd[1]);
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+/**
+ * Wait for a child that was just forked to call exec, and learn whether it found the executable it was given.
+ * @param report A pipe opened with openPipe() before the child was forked, or two -1s. The child writes a byte to it
+ *               if the executable had gone and it had to search $PATH itself. Both ends are closed.
+ * @return Whether or not the child reported that the executable had gone.
+ */
+bool awaitExecReport(int report[2]) {
+    if (report[0] == -1) {
+        return false;
+    }
+    close(report[1]); // Leaves the child's copy, which closes on exec
+    char byte;
+    ssize_t numRead;
+    while ((numRead = read(report[0], &byte, 1)) == -1 && errno == EINTR) {
+        continue;
+    }
+    close(report[0]);
+    return numRead == 1;
+}
+
+/**
+ * Launch a command without waiting for it, using the current launcher.
+ * The command is looked up through the command cache and executed by its full path.
+ * @param argv The command to launch, followed by its arguments and a terminating NULL.
+ * @param fds The descriptors the command should use as its standard input, output and error.
+ * @param pgid The process group to place the command in: -1 for the shell's own, 0 for a new one led by the command.
+ * @param missing Set to whether or not the executable the command cache remembered had gone by the time a child tried
+ *                to run it, in which case the caller should forget it.
+ * @return The pid of the launched command, or -1 if it could not be launched.
+ */
+pid_t launchProcess(char *argv[], StdFds fds, pid_t pgid, bool *missing) {
+    double start = tracingEnabled() ? traceClock() : 0;
+    *missing = false;
+    const char *path = resolveCommand(argv[0]);
+    if (path == NULL) {
+        fprintf(stderr, "%s: command not found\n", argv[0]);
+        errno = ENOENT;
+        return -1;
+    }
+    if (launchMode == kLaunchFork || launchPlacement) {
+        pid_t pid = forkProcess(path, argv, fds, pgid, missing);
+        traceSpan("launch", "fork", start, tracingEnabled() ? traceClock() : 0, 0, path);
+        return pid;
+    }
+    if (launchMode == kLaunchZygote && zygoteRunning()) {
+        pid_t pid = zygoteSpawn(path, argv, fds, pgid, missing);
+        traceSpan("launch", "zygote", start, tracingEnabled() ? traceClock() : 0, 0, path);
+        if (pid != -1) {
+            return pid;
+        }
+        perror("Zygote failed, launching directly.\n\r");
+        launchMode = kLaunchSpawn;
+    }
+    
+    pid_t pid = spawnProcess(path, argv, fds, pgid);
+    if (pid == -1 && errno == ENOENT && path != argv[0]) { // The remembered executable went away, so look for it again
+        forgetCommand(argv[0]);
+        if ((path = resolveCommand(argv[0])) != NULL) {
+            pid = spawnProcess(path, argv, fds, pgid);
+        }
+    }
+    if (pid == -1) {
+        perror(argv[0]);
+    }
+    traceSpan("launch", "posix_spawn", start, tracingEnabled() ? traceClock() : 0, 0, path);
+    return pid;
+}
+
+/**
+ * Work out the order to copy a command's descriptors into place, so that none is overwritten before it has been copied.
+ * Error output copied from the shell's own output ('2>&1 > file') has to be copied before output is replaced by the file.
+ * @param sources The descriptors the command should use as its standard input, output and error.
+ * @param order Set to the standard descriptors, in the order they should be copied.
+ */
+static void orderStdFds(const int sources[3], int order[3]) {
+    bool copied[3] = { false, false, false };
+    int numOrdered, i, j;
+    for (numOrdered = 0; numOrdered < 3; numOrdered++) {
+        int next = -1;
+        for (i = 0; i < 3 && next == -1; i++) {
+            bool needed = false; // Still to be copied somewhere else
+            for (j = 0; j < 3; j++) {
+                needed = needed || (!copied[j] && j != i && sources[j] == i);
+            }
+            next = !copied[i] && !needed ? i : -1;
+        }
+        for (i = 0; i < 3 && next == -1; i++) { // Only descriptors swapped by the caller form a cycle
+            next = !copied[i] ? i : -1;
+        }
+        copied[next] = true;
+        order[numOrdered] = next;
+    }
+}
+
+/**
+ * Launch a command by forking the shell, and wire its descriptors in the child before calling exec.
+ * If the executable no longer exists at path, the child falls back to searching $PATH itself, and says so
+ * over a pipe that the parent reads until the child has called exec, as posix_spawn() waits for it.
+ * @param path The executable to run.
+ * @param argv The command to launch, followed by its arguments and a terminating NULL.
+ * @param fds The descriptors the command should use as its standard input, output and error.
+ * @param pgid The process group to place the command in: -1 for the shell's own, 0 for a new one led by the command.
+ * @param missing Set to whether or not the executable had gone from path, when path was looked up rather than given.
+ * @return The pid of the launched command, or -1 (with errno set) if no process could be forked.
+ */
+pid_t forkProcess(const char *path, char *argv[], StdFds fds, pid_t pgid, bool *missing) {
+    int report[2] = { -1, -1 };
+    if (path != argv[0] && openPipe(report) == -1) { // Without it, nothing is learned about the executable
+        report[0] = report[1] = -1;
+    }
+    pid_t pid;
+    switch (pid = fork()) {
+        case -1: // Such as EAGAIN under load, which fails only this command
+            perror("Unable to fork a child process.\n\r");
+            int error = errno;
+            *missing = awaitExecReport(report); // Only closes the pipe
+            errno = error;
+            return -1;
+            
+        case 0: // Child
+            resetChildSignals(false);
+            if (pgid != -1) {
+                setpgid(0, pgid);
+            }
+            if (launchPlacement && applyPlacement(launchPlacement, argv[0]) == -1) {
+                _exit(126);
+            }
+            int sources[3] = { fds.in, fds.out, fds.err }, order[3], i;
+            orderStdFds(sources, order);
+            for (i = 0; i < 3; i++) {
+                if (sources[order[i]] != order[i] && dup2(sources[order[i]], order[i]) == -1) {
+                    perror("dup2() failed.\n\r");
+                    _exit(EXIT_FAILURE);
+                }
+            }
+            // Every other descriptor the shell opened is closed on exec
+            traceInstant("launch", "exec", path);
+            execv(path, argv);
+            if (errno == ENOENT && path != argv[0]) {
+                if (report[1] != -1) {
+                    write(report[1], "", 1);
+                }
+                execvp(argv[0], argv);
+            }
+            perror(argv[0]);
+            _exit(errno == ENOENT ? 127 : 126);
+            
+        default: // Parent
+            if (pgid != -1) { // Also done here, so the group exists no matter which process runs first
+                setpgid(pid, pgid ? pgid : pid);
+            }
+            *missing = awaitExecReport(report);
+            return pid;
+    }
+}
+
+/**
+ * Launch a command with posix_spawn(), describing its descriptors as file actions.
+ * @param path The executable to run.
+ * @param argv The command to launch, followed by its arguments and a terminating NULL.
+ * @param fds The descriptors the command should use as its standard input, output and error.
+ * @param pgid The process group to place the command in: -1 for the shell's own, 0 for a new one led by the command.
+ * @return The pid of the launched command, or -1 (with errno set) if it could not be launched.
+ */
+pid_t spawnProcess(const char *path, char *argv[], StdFds fds, pid_t pgid) {
+    // Built for every launch, as threads using libnsh launch at the same time. Only memory is touched.
+    posix_spawnattr_t attributes;
+    sigset_t defaultSignals, noSignals;
+    sigemptyset(&noSignals);
+    defaultSignalSet(&defaultSignals);
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setsigdefault(&attributes, &defaultSignals);
+    posix_spawnattr_setsigmask(&attributes, &noSignals);
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    if (pgid != -1) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attributes, pgid);
+    }
+    posix_spawnattr_setflags(&attributes, flags);
+    
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    int sources[3] = { fds.in, fds.out, fds.err }, order[3], i;
+    orderStdFds(sources, order);
+    for (i = 0; i < 3; i++) {
+        if (sources[order[i]] != order[i]) {
+            posix_spawn_file_actions_adddup2(&actions, sources[order[i]], order[i]);
+        }
+    }
+    
+    pid_t pid;
+    int error = posix_spawn(&pid, path, &actions, &attributes, argv, getEnvironment());
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return pid;
+}
+
+/**
+ * Run a builtin in a forked copy of the shell, such as when it is one stage of a pipeline.
+ * The child keeps the shell's SIGCHLD handler, since builtins such as 'parallel' wait on children of their own,
+ * but leaves the shell's event loop, and the deadlines of the shell's jobs, to the shell.
+ * @param run The builtin to run.
+ * @param argv The command to run, followed by its arguments and a terminating NULL.
+ * @param fds The descriptors the builtin should use as its standard input, output and error.
+ * @param pgid The process group to place the child in: -1 for the shell's own, 0 for a new one led by the child.
+ * @return The pid of the child, which exits with the builtin's status, or -1 (with errno set) if no process could be forked.
+ */
+pid_t forkBuiltin(BuiltinFunction run, char *argv[], StdFds fds, pid_t pgid) {
+    double start = tracingEnabled() ? traceClock() : 0;
+    pid_t pid;
+    switch (pid = fork()) {
+        case -1:
+            perror("Unable to fork a child process.\n\r");
+            return -1;
+            
+        case 0: { // Child
+            resetChildSignals(true);
+            leaveZygote(); // Commands the builtin launches are its own children
+            leaveEventLoop(); // As is reaping them, through the SIGCHLD handler that is still installed
+            clearJobDeadlines();
+            if (pgid != -1) {
+                setpgid(0, pgid);
+            }
+            if (launchPlacement && applyPlacement(launchPlacement, argv[0]) == -1) {
+                _exit(126);
+            }
+            launchPlacement = NULL; // Whatever the builtin launches inherits the placement anyway
+            traceInstant("launch", "builtin", argv[0]);
+            int status = run(argv, fds);
+            fflush(stdout);
+            _exit(status);
+        }
+            
+        default: // Parent
+            if (pgid != -1) {
+                setpgid(pid, pgid ? pgid : pid);
+            }
+            traceSpan("launch", "fork", start, tracingEnabled() ? traceClock() : 0, 0, argv[0]);
+            return pid;
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef Spawn_h
+#define Spawn_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/types.h>
+
+#include "Builtin.h"
+#include "CommandCache.h"
+#include "Placement.h"
+
+/**
+ * The ways in which a child process can be launched.
+ * kLaunchFork copies the shell with fork() and wires the child's descriptors before calling exec.
+ * kLaunchSpawn uses posix_spawn() file actions, which never copy the shell's address space.
+ * kLaunchZygote asks the zygote, a small helper forked when the shell starts, to fork and exec on the shell's behalf.
+ */
+typedef enum launchMode {
+    kLaunchFork,
+    kLaunchSpawn,
+    kLaunchZygote
+} LaunchMode;
+
+/**
+ * Choose how every following child process is launched.
+ * @param mode The launcher to use.
+ */
+void setLaunchMode(LaunchMode mode);
+
+/**
+ * @return The launcher currently in use.
+ */
+LaunchMode getLaunchMode(void);
+
+/**
+ * Choose where, and with what limits, every following child process runs, until it is set back to NULL.
+ * A child with a placement is always forked, and applies the placement itself just before calling exec,
+ * since neither posix_spawn() nor the zygote can run anything in the child first.
+ * @param placement The placement, which must stay valid while children are launched, or NULL for none.
+ */
+void setLaunchPlacement(const Placement *placement);
+
+/**
+ * Look up a launcher by name, as given in the NSH_LAUNCHER environment variable.
+ * @param name One of "fork", "spawn" or "zygote".
+ * @param mode Set to the matching launcher, if one is found.
+ * @return Whether or not the name matched a launcher.
+ */
+bool launchModeFromName(const char *name, LaunchMode *mode);
+
+/**
+ * Create a pipe whose ends are closed on exec, so that only the processes they are explicitly handed to keep them open.
+ * @param fd Filled with the read end followed by the write end.
+ * @return 0 if success, -1 otherwise.
+ */
+int openPipe(int fd[2]);
+
+/**
+ * Wait for a child that was just forked to call exec, and learn whether it found the executable it was given.
+ * @param report A pipe opened with openPipe() before the child was forked, or two -1s. The child writes a byte to it
+ *               if the executable had gone and it had to search $PATH itself. Both ends are closed.
+ * @return Whether or not the child reported that the executable had gone.
+ */
+bool awaitExecReport(int report[2]);
+
+/**
+ * Launch a command without waiting for it, using the current launcher.
+ * The command is looked up through the command cache and executed by its full path.
+ * @param argv The command to launch, followed by its arguments and a terminating NULL.
+ * @param fds The descriptors the command should use as its standard input, output and error.
+ * @param pgid The process group to place the command in: -1 for the shell's own, 0 for a new one led by the command.
+ * @param missing Set to whether or not the executable the command cache remembered had gone by the time a child tried
+ *                to run it, in which case the caller should forget it.
+ * @return The pid of the launched command, or -1 if it could not be launched.
+ */
+pid_t launchProcess(char *argv[], StdFds fds, pid_t pgid, bool *missing);
+
+/**
+ * Launch a command by forking the shell, and wire its descriptors in the child before calling exec.
+ * If the executable no longer exists at path, the child falls back to searching $PATH itself, and says so
+ * over a pipe that the parent reads until the child has called exec, as posix_spawn() waits for it.
+ * @param path The executable to run.
+ * @param argv The command to launch, followed by its arguments and a terminating NULL.
+ * @param fds The descriptors the command should use as its standard input, output and error.
+ * @param pgid The process group to place the command in: -1 for the shell's own, 0 for a new one led by the command.
+ * @param missing Set to whether or not the executable had gone from path, when path was looked up rather than given.
+ * @return The pid of the launched command, or -1 (with errno set) if no process could be forked.
+ */
+pid_t forkProcess(const char *path, char *argv[], StdFds fds, pid_t pgid, bool *missing);
+
+/**
+ * Launch a command with posix_spawn(), describing its descriptors as file actions.
+ * @param path The executable to run.
+ * @param argv The command to launch, followed by its arguments and a terminating NULL.
+ * @param fds The descriptors the command should use as its standard input, output and error.
+ * @param pgid The process group to place the command in: -1 for the shell's own, 0 for a new one led by the command.
+ * @return The pid of the launched command, or -1 (with errno set) if it could not be launched.
+ */
+pid_t spawnProcess(const char *path, char *argv[], StdFds fds, pid_t pgid);
+
+/**
+ * Run a builtin in a forked copy of the shell, such as when it is one stage of a pipeline.
+ * The child keeps the shell's SIGCHLD handler, since builtins such as 'parallel' wait on children of their own,
+ * but leaves the shell's event loop, and the deadlines of the shell's jobs, to the shell.
+ * @param run The builtin to run.
+ * @param argv The command to run, followed by its arguments and a terminating NULL.
+ * @param fds The descriptors the builtin should use as its standard input, output and error.
+ * @param pgid The process group to place the child in: -1 for the shell's own, 0 for a new one led by the child.
+ * @return The pid of the child, which exits with the builtin's status, or -1 (with errno set) if no process could be forked.
+ */
+pid_t forkBuiltin(BuiltinFunction run, char *argv[], StdFds fds, pid_t pgid);
+
+#endif /* Spawn_h */
@@ -0,0 +1,137 @@
+#include "Stats.h"
+#include "Job.h"
+#include "Pipes.h"
+
+static UsageTotals sessionTotals;
+static struct timespec sessionStart;
+static struct rusage sessionStartUsage;
+
+/**
+ * @param time A time as reported in a struct rusage.
+ * @return The time in seconds.
+ */
+static double secondsOf(struct timeval time) {
+    return time.tv_sec + time.tv_usec / 1e6;
+}
+
+/**
+ * Forget every command recorded so far, and start timing the session anew.
+ */
+void resetStats(void) {
+    memset(&sessionTotals, 0, sizeof(sessionTotals));
+    clock_gettime(CLOCK_MONOTONIC, &sessionStart);
+    getrusage(RUSAGE_SELF, &sessionStartUsage);
+}
+
+/**
+ * Add the resources used by a command to a running total.
+ * @param totals The total to add to. The peak memory is the largest of any command added.
+ * @param real How long the command ran, in seconds.
+ * @param usage The resources the command used, as reported by wait4().
+ */
+void addUsage(UsageTotals *totals, double real, const struct rusage *usage) {
+    totals->count++;
+    totals->real += real;
+    totals->user += secondsOf(usage->ru_utime);
+    totals->system += secondsOf(usage->ru_stime);
+    if (usage->ru_maxrss > totals->maxRss) {
+        totals->maxRss = usage->ru_maxrss;
+    }
+    totals->voluntarySwitches += usage->ru_nvcsw;
+    totals->involuntarySwitches += usage->ru_nivcsw;
+}
+
+/**
+ * Record the resources used by a finished command in the session's totals.
+ * Safe to call from the SIGCHLD handler.
+ * @param real How long the command ran, in seconds.
+ * @param usage The resources the command used, as reported by wait4().
+ */
+void recordUsage(double real, const struct rusage *usage) {
+    addUsage(&sessionTotals, real, usage);
+}
+
+/**
+ * Work out the resources used between two readings of getrusage().
+ * @param before The earlier reading.
+ * @param after The later reading.
+ * @param difference Filled with the resources used in between. The peak memory is the later reading's.
+ */
+void usageBetween(const struct rusage *before, const struct rusage *after, struct rusage *difference) {
+    *difference = *after;
+    timersub(&after->ru_utime, &before->ru_utime, &difference->ru_utime);
+    timersub(&after->ru_stime, &before->ru_stime, &difference->ru_stime);
+    difference->ru_nvcsw = after->ru_nvcsw - before->ru_nvcsw;
+    difference->ru_nivcsw = after->ru_nivcsw - before->ru_nivcsw;
+}
+
+/**
+ * @param start The earlier time.
+ * @param end The later time.
+ * @return The number of seconds between the two times.
+ */
+double secondsBetween(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Print the column headings that printUsage() lines up with.
+ * @param fd Where to print.
+ */
+void printUsageHeader(int fd) {
+    dprintf(fd, "%10s %10s %10s %11s %15s  %s\n", "real", "user", "sys", "max rss", "switches v/i", "command");
+}
+
+/**
+ * Print one line describing the resources used by one or more commands.
+ * @param fd Where to print.
+ * @param totals The resources used.
+ * @param label What used them, printed at the end of the line.
+ */
+void printUsage(int fd, const UsageTotals *totals, const char *label) {
+    char switches[48];
+    snprintf(switches, sizeof(switches), "%ld/%ld", totals->voluntarySwitches, totals->involuntarySwitches);
+    dprintf(fd, "%9.3fs %9.3fs %9.3fs %8ld KB %15s  %s\n",
+            totals->real, totals->user, totals->system, totals->maxRss, switches, label);
+}
+
+/**
+ * Process a 'stats' command, printing the resources used by every command the session has run, and by the shell itself,
+ * followed by the bytes through every counted pipe. 'stats -r' starts counting anew.
+ * @param cmd The 'stats' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processStats(char *cmd[], StdFds fds) {
+    if (cmd[1] && strcmp(cmd[1], "-r") == 0) {
+        resetStats();
+        resetPipeCounters();
+        return EXIT_SUCCESS;
+    } else if (cmd[1]) {
+        dprintf(fds.err, "stats: usage: stats [-r]\n");
+        return 2;
+    }
+    
+    // Copied with SIGCHLD blocked, so that a command can't be recorded halfway through
+    sigset_t previous;
+    blockChildSignals(&previous);
+    reapChildren(); // Commands that finished since the shell last waited count too
+    UsageTotals commands = sessionTotals;
+    restoreChildSignals(&previous);
+    
+    UsageTotals shell = {0};
+    struct rusage current, usage;
+    struct timespec now;
+    getrusage(RUSAGE_SELF, &current);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    usageBetween(&sessionStartUsage, &current, &usage);
+    addUsage(&shell, secondsBetween(&sessionStart, &now), &usage);
+    
+    char label[64];
+    snprintf(label, sizeof(label), "%ld command%s", commands.count, commands.count == 1 ? "" : "s");
+    printUsageHeader(fds.out);
+    printUsage(fds.out, &commands, label);
+    printUsage(fds.out, &shell, "shell");
+    printPipeCounters(fds.out); // Only once 'set pipestats=on' has counted some
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,83 @@
+#ifndef Stats_h
+#define Stats_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "Builtin.h"
+
+/**
+ * Resources used by one or more commands: wall time, CPU time, peak memory and context switches.
+ */
+typedef struct usageTotals {
+    long count;
+    double real, user, system;
+    long maxRss, voluntarySwitches, involuntarySwitches;
+} UsageTotals;
+
+/**
+ * Forget every command recorded so far, and start timing the session anew.
+ */
+void resetStats(void);
+
+/**
+ * Add the resources used by a command to a running total.
+ * @param totals The total to add to. The peak memory is the largest of any command added.
+ * @param real How long the command ran, in seconds.
+ * @param usage The resources the command used, as reported by wait4().
+ */
+void addUsage(UsageTotals *totals, double real, const struct rusage *usage);
+
+/**
+ * Record the resources used by a finished command in the session's totals.
+ * Safe to call from the SIGCHLD handler.
+ * @param real How long the command ran, in seconds.
+ * @param usage The resources the command used, as reported by wait4().
+ */
+void recordUsage(double real, const struct rusage *usage);
+
+/**
+ * Work out the resources used between two readings of getrusage().
+ * @param before The earlier reading.
+ * @param after The later reading.
+ * @param difference Filled with the resources used in between. The peak memory is the later reading's.
+ */
+void usageBetween(const struct rusage *before, const struct rusage *after, struct rusage *difference);
+
+/**
+ * @param start The earlier time.
+ * @param end The later time.
+ * @return The number of seconds between the two times.
+ */
+double secondsBetween(const struct timespec *start, const struct timespec *end);
+
+/**
+ * Print the column headings that printUsage() lines up with.
+ * @param fd Where to print.
+ */
+void printUsageHeader(int fd);
+
+/**
+ * Print one line describing the resources used by one or more commands.
+ * @param fd Where to print.
+ * @param totals The resources used.
+ * @param label What used them, printed at the end of the line.
+ */
+void printUsage(int fd, const UsageTotals *totals, const char *label);
+
+/**
+ * Process a 'stats' command, printing the resources used by every command the session has run, and by the shell itself,
+ * followed by the bytes through every counted pipe. 'stats -r' starts counting anew.
+ * @param cmd The 'stats' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processStats(char *cmd[], StdFds fds);
+
+#endif /* Stats_h */
@@ -0,0 +1,174 @@
+#include "Trace.h"
+
+#define EVENT_SIZE 1024
+
+static int traceFd = -1;
+static pid_t tracePid = 0; // Every event is shown as part of the shell that started the trace
+
+/**
+ * Write a string into an event, escaped as a JSON string (without its quotes).
+ * @param event Where to write.
+ * @param size How much room is left.
+ * @param text The string to escape.
+ * @return The number of bytes written.
+ */
+static int escapeJson(char *event, size_t size, const char *text) {
+    size_t length = 0;
+    for (; *text && length + 7 < size; text++) {
+        unsigned char c = *text;
+        if (c == '"' || c == '\\') {
+            event[length++] = '\\';
+            event[length++] = c;
+        } else if (c < 0x20) {
+            length += snprintf(&event[length], size - length, "\\u%04x", c);
+        } else {
+            event[length++] = c;
+        }
+    }
+    event[length] = '\0';
+    return length;
+}
+
+/**
+ * Append a finished event to the trace, along with the comma that separates it from the next one.
+ * @param event The event's JSON text.
+ * @param length The length of the event.
+ */
+static void writeEvent(char *event, int length) {
+    if (length < 0 || length > EVENT_SIZE - 3) {
+        length = EVENT_SIZE - 3;
+    }
+    event[length++] = ',';
+    event[length++] = '\n';
+    ssize_t written;
+    do {
+        written = write(traceFd, event, length);
+    } while (written == -1 && errno == EINTR);
+}
+
+/**
+ * Close the trace's array, once the shell that started it exits.
+ */
+static void finishTrace(void) {
+    if (traceFd == -1 || getpid() != tracePid) {
+        return;
+    }
+    char event[EVENT_SIZE];
+    int length = snprintf(event, sizeof(event), "{\"name\": \"exit\", \"cat\": \"shell\", \"ph\": \"i\", \"s\": \"p\", "
+                          "\"ts\": %.3f, \"pid\": %d, \"tid\": %d}\n]\n", traceClock(), (int)tracePid, (int)tracePid);
+    write(traceFd, event, length);
+    close(traceFd);
+    traceFd = -1;
+}
+
+/**
+ * Start writing a timeline of what the shell does to a file, in Chrome's trace-event JSON format,
+ * so that it can be viewed with chrome://tracing or Perfetto. The trace is finished when the shell exits.
+ * Each event is written with a single write() to a file opened for appending, so children of the shell can add their own.
+ * @param path The file to write the trace to. It is truncated first.
+ * @return 0 if success, -1 if the file could not be opened.
+ */
+int startTrace(const char *path) {
+    if ((traceFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0666)) == -1) {
+        return -1;
+    }
+    tracePid = getpid();
+    write(traceFd, "[\n", 2);
+    traceProcessName(tracePid, "nsh");
+    atexit(finishTrace);
+    return 0;
+}
+
+/**
+ * @return Whether or not a trace is being written. Checking this is all tracing costs when it is off.
+ */
+bool tracingEnabled(void) {
+    return traceFd != -1;
+}
+
+/**
+ * @param time A time read from CLOCK_MONOTONIC.
+ * @return The same time, in microseconds on the clock that trace events are timestamped with.
+ */
+double traceTimeOf(const struct timespec *time) {
+    return time->tv_sec * 1e6 + time->tv_nsec / 1e3;
+}
+
+/**
+ * @return The current time, in microseconds on the clock that trace events are timestamped with.
+ */
+double traceClock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return traceTimeOf(&now);
+}
+
+/**
+ * Record something that took a span of time.
+ * @param category The kind of event, such as "parse" or "launch".
+ * @param name What happened.
+ * @param start When it started, from traceClock().
+ * @param end When it ended, from traceClock().
+ * @param tid The process the span belongs to on the timeline, or 0 for the calling process.
+ * @param detail More about the event, such as the command involved, or NULL.
+ */
+void traceSpan(const char *category, const char *name, double start, double end, pid_t tid, const char *detail) {
+    if (traceFd == -1) {
+        return;
+    }
+    char event[EVENT_SIZE];
+    int length = snprintf(event, sizeof(event), "{\"name\": \"");
+    length += escapeJson(&event[length], sizeof(event) - length - 384, name);
+    length += snprintf(&event[length], sizeof(event) - length,
+                       "\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d",
+                       category, start, end - start, (int)tracePid, (int)(tid ? tid : getpid()));
+    if (detail) {
+        length += snprintf(&event[length], sizeof(event) - length, ", \"args\": {\"detail\": \"");
+        length += escapeJson(&event[length], sizeof(event) - length - 8, detail);
+        length += snprintf(&event[length], sizeof(event) - length, "\"}");
+    }
+    length += snprintf(&event[length], sizeof(event) - length, "}");
+    writeEvent(event, length);
+}
+
+/**
+ * Record something that happened at a single moment.
+ * @param category The kind of event.
+ * @param name What happened.
+ * @param detail More about the event, or NULL.
+ */
+void traceInstant(const char *category, const char *name, const char *detail) {
+    if (traceFd == -1) {
+        return;
+    }
+    char event[EVENT_SIZE];
+    int length = snprintf(event, sizeof(event), "{\"name\": \"");
+    length += escapeJson(&event[length], sizeof(event) - length - 384, name);
+    length += snprintf(&event[length], sizeof(event) - length,
+                       "\", \"cat\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d",
+                       category, traceClock(), (int)tracePid, (int)getpid());
+    if (detail) {
+        length += snprintf(&event[length], sizeof(event) - length, ", \"args\": {\"detail\": \"");
+        length += escapeJson(&event[length], sizeof(event) - length - 8, detail);
+        length += snprintf(&event[length], sizeof(event) - length, "\"}");
+    }
+    length += snprintf(&event[length], sizeof(event) - length, "}");
+    writeEvent(event, length);
+}
+
+/**
+ * Label a process's row of the timeline.
+ * @param tid The process.
+ * @param name The label, such as the command it ran.
+ */
+void traceProcessName(pid_t tid, const char *name) {
+    if (traceFd == -1) {
+        return;
+    }
+    char event[EVENT_SIZE];
+    int length = snprintf(event, sizeof(event), "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, "
+                          "\"args\": {\"name\": \"%d ", (int)tracePid, (int)tid, (int)tid);
+    length += escapeJson(&event[length], sizeof(event) - length - 8, name);
+    length += snprintf(&event[length], sizeof(event) - length, "\"}}");
+    writeEvent(event, length);
+}
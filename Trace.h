@@ -0,0 +1,65 @@
+#ifndef Trace_h
+#define Trace_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+
+/**
+ * Start writing a timeline of what the shell does to a file, in Chrome's trace-event JSON format,
+ * so that it can be viewed with chrome://tracing or Perfetto. The trace is finished when the shell exits.
+ * Each event is written with a single write() to a file opened for appending, so children of the shell can add their own.
+ * @param path The file to write the trace to. It is truncated first.
+ * @return 0 if success, -1 if the file could not be opened.
+ */
+int startTrace(const char *path);
+
+/**
+ * @return Whether or not a trace is being written. Checking this is all tracing costs when it is off.
+ */
+bool tracingEnabled(void);
+
+/**
+ * @return The current time, in microseconds on the clock that trace events are timestamped with.
+ */
+double traceClock(void);
+
+/**
+ * @param time A time read from CLOCK_MONOTONIC.
+ * @return The same time, in microseconds on the clock that trace events are timestamped with.
+ */
+double traceTimeOf(const struct timespec *time);
+
+/**
+ * Record something that took a span of time.
+ * @param category The kind of event, such as "parse" or "launch".
+ * @param name What happened.
+ * @param start When it started, from traceClock().
+ * @param end When it ended, from traceClock().
+ * @param tid The process the span belongs to on the timeline, or 0 for the calling process.
+ * @param detail More about the event, such as the command involved, or NULL.
+ */
+void traceSpan(const char *category, const char *name, double start, double end, pid_t tid, const char *detail);
+
+/**
+ * Record something that happened at a single moment.
+ * @param category The kind of event.
+ * @param name What happened.
+ * @param detail More about the event, or NULL.
+ */
+void traceInstant(const char *category, const char *name, const char *detail);
+
+/**
+ * Label a process's row of the timeline.
+ * @param tid The process.
+ * @param name The label, such as the command it ran.
+ */
+void traceProcessName(pid_t tid, const char *name);
+
+#endif /* Trace_h */
@@ -0,0 +1,310 @@
+#ifdef __linux__
+#define _GNU_SOURCE // copy_file_range(), splice(), tee(), memfd_create(), F_GETPIPE_SZ
+#endif
+
+#include "Transfer.h"
+#include "Builtin.h"
+
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#endif
+
+#define COPY_BUFFER_SIZE 65536
+
+// The most bytes asked of the kernel at once. Anything larger is moved in several calls.
+#define TRANSFER_CHUNK_SIZE (1 << 24)
+
+// Returned when the kernel can't move the bytes between two descriptors, before any have been moved
+#define TRANSFER_UNSUPPORTED -2
+
+/**
+ * Copy everything from one descriptor to several others through a buffer, with read() and write().
+ * @param from The descriptor to read from, starting at its current offset.
+ * @param to The descriptors to write to.
+ * @param numTo The number of descriptors to write to.
+ * @return 0 if success, -1 (with errno set) otherwise.
+ */
+int copyDataToAll(int from, const int to[], int numTo) {
+    char buffer[COPY_BUFFER_SIZE];
+    while (true) {
+        ssize_t numRead = read(from, buffer, sizeof(buffer));
+        if (numRead == 0) {
+            return 0;
+        } else if (numRead == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        int i;
+        for (i = 0; i < numTo; i++) {
+            if (writeAll(to[i], buffer, numRead) == -1) {
+                return -1;
+            }
+        }
+    }
+}
+
+/**
+ * Copy everything from one descriptor to another through a buffer, with read() and write().
+ * @param from The descriptor to read from, starting at its current offset.
+ * @param to The descriptor to write to.
+ * @return 0 if success, -1 (with errno set) otherwise.
+ */
+int copyData(int from, int to) {
+    return copyDataToAll(from, &to, 1);
+}
+
+#ifdef __linux__
+
+/**
+ * The system calls that can move bytes without them passing through the shell.
+ */
+typedef enum transferMethod {
+    kTransferCopyRange,
+    kTransferSplice,
+    kTransferSendfile
+} TransferMethod;
+
+/**
+ * Move everything from one descriptor to another with a single kind of system call.
+ * @param method The system call to use.
+ * @param from The descriptor to read from.
+ * @param to The descriptor to write to.
+ * @return 0 if success, TRANSFER_UNSUPPORTED if the kernel refused before moving anything, or -1 (with errno set) otherwise.
+ */
+static int kernelTransfer(TransferMethod method, int from, int to) {
+    bool started = false;
+    while (true) {
+        ssize_t moved;
+        switch (method) {
+            case kTransferCopyRange:
+                moved = copy_file_range(from, NULL, to, NULL, TRANSFER_CHUNK_SIZE, 0);
+                break;
+            case kTransferSplice:
+                moved = splice(from, NULL, to, NULL, TRANSFER_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE);
+                break;
+            default:
+                moved = sendfile(to, from, NULL, TRANSFER_CHUNK_SIZE);
+                break;
+        }
+        
+        if (moved > 0) {
+            started = true;
+        } else if (moved == 0) {
+            // Some files (such as those under /proc) claim to be empty to these calls, so let read() have the final say
+            return started ? 0 : TRANSFER_UNSUPPORTED;
+        } else if (errno != EINTR) {
+            if (!started && (errno == EINVAL || errno == ENOSYS || errno == EXDEV || errno == EOPNOTSUPP || errno == EBADF)) {
+                return TRANSFER_UNSUPPORTED;
+            }
+            return -1;
+        }
+    }
+}
+
+/**
+ * Move exactly a given number of bytes from a pipe to another descriptor.
+ * @param from The pipe, which holds at least that many bytes.
+ * @param to The descriptor to write to.
+ * @param length The number of bytes to move.
+ * @param spliced Whether to move them with splice(), or else through a buffer (for a terminal or a file opened to append).
+ * @return 0 if success, -1 (with errno set) otherwise.
+ */
+static int drainPipe(int from, int to, size_t length, bool spliced) {
+    char buffer[COPY_BUFFER_SIZE];
+    while (length > 0) {
+        ssize_t moved;
+        if (spliced) {
+            moved = splice(from, NULL, to, NULL, length, SPLICE_F_MOVE | SPLICE_F_MORE);
+        } else if ((moved = read(from, buffer, length < sizeof(buffer) ? length : sizeof(buffer))) > 0 &&
+                   writeAll(to, buffer, moved) == -1) {
+            return -1;
+        }
+        if (moved == -1 && errno != EINTR) {
+            return -1;
+        } else if (moved == 0) { // The pipe held fewer bytes than it should have
+            errno = EIO;
+            return -1;
+        }
+        length -= moved > 0 ? moved : 0;
+    }
+    return 0;
+}
+
+/**
+ * Duplicate the bytes at the front of one pipe into another, without taking them out of the first.
+ * @param from The pipe to duplicate from.
+ * @param to The pipe to duplicate into.
+ * @param length The most bytes to duplicate.
+ * @return The number of bytes duplicated, 0 once the first pipe is closed and empty, or -1 (with errno set) if failure.
+ */
+static ssize_t duplicatePipe(int from, int to, size_t length) {
+    ssize_t duplicated;
+    while ((duplicated = tee(from, to, length, 0)) == -1 && errno == EINTR) {
+        continue;
+    }
+    return duplicated;
+}
+
+/**
+ * Duplicate everything from a pipe into several descriptors without the bytes passing through the shell.
+ * Each round, tee() duplicates what the pipe holds into a private pipe per extra descriptor, which is empty and as large
+ * as the input, so it always takes everything it is given. splice() then moves the bytes themselves to the first
+ * descriptor, and each duplicate on to its own descriptor.
+ * @param from The pipe to read from.
+ * @param to The descriptors to write to.
+ * @param numTo The number of descriptors to write to, at least two.
+ * @return 0 if success, TRANSFER_UNSUPPORTED if the kernel refused before moving anything, or -1 (with errno set) otherwise.
+ */
+static int kernelFanOut(int from, const int to[], int numTo) {
+    int (*copies)[2] = calloc(numTo, sizeof(int[2]));
+    bool *spliced = calloc(numTo, sizeof(bool));
+    if (copies == NULL || spliced == NULL) { // Left to read() and write(), which need no memory
+        free(copies);
+        free(spliced);
+        return TRANSFER_UNSUPPORTED;
+    }
+    // splice() only writes to pipes and to files not opened to append, so the first such descriptor takes the bytes
+    int i, first = -1, size = fcntl(from, F_GETPIPE_SZ), result = TRANSFER_UNSUPPORTED;
+    for (i = 0; i < numTo; i++) {
+        struct stat status;
+        int flags = fcntl(to[i], F_GETFL);
+        spliced[i] = fstat(to[i], &status) == 0 && flags != -1 && !(flags & O_APPEND) &&
+                     (S_ISFIFO(status.st_mode) || S_ISREG(status.st_mode));
+        if (spliced[i] && first == -1) {
+            first = i;
+        }
+        copies[i][0] = copies[i][1] = -1;
+    }
+    bool ready = first != -1 && size > 0;
+    for (i = 0; i < numTo && ready; i++) {
+        ready = i == first || (pipe2(copies[i], O_CLOEXEC) == 0 && fcntl(copies[i][1], F_SETPIPE_SZ, size) >= size);
+    }
+    
+    bool started = false;
+    while (ready) {
+        // The first duplicate decides how many bytes this round moves, and every other one must match it
+        ssize_t length = -1;
+        for (i = 0; i < numTo && length != 0; i++) {
+            if (i == first) {
+                continue;
+            }
+            ssize_t duplicated = duplicatePipe(from, copies[i][1], length == -1 ? TRANSFER_CHUNK_SIZE : (size_t)length);
+            if (duplicated == -1 || (length != -1 && duplicated != length)) {
+                errno = duplicated == -1 ? errno : EIO; // A mismatch can't happen, as each copy is empty and as large
+                break;
+            }
+            length = duplicated;
+        }
+        if (i < numTo && length != 0) {
+            result = !started && (errno == EINVAL || errno == ENOSYS) ? TRANSFER_UNSUPPORTED : -1;
+            break;
+        } else if (length == 0) {
+            result = 0;
+            break;
+        }
+        started = true;
+        for (i = 0; i < numTo; i++) {
+            if (drainPipe(i == first ? from : copies[i][0], to[i], length, spliced[i]) == -1) {
+                break;
+            }
+        }
+        if (i < numTo) {
+            result = -1;
+            break;
+        }
+    }
+    for (i = 0; i < numTo; i++) {
+        if (copies[i][0] != -1) {
+            close(copies[i][0]);
+            close(copies[i][1]);
+        }
+    }
+    free(copies);
+    free(spliced);
+    return result;
+}
+
+#endif
+
+/**
+ * Move everything from one descriptor to another, letting the kernel move the bytes whenever it can:
+ * copy_file_range() between regular files, splice() when either end is a pipe, and sendfile() from a regular file.
+ * Falls back to copyData() when the kernel refuses.
+ * @param from The descriptor to read from, starting at its current offset.
+ * @param to The descriptor to write to.
+ * @return 0 if success, -1 (with errno set) otherwise.
+ */
+int transferData(int from, int to) {
+#ifdef __linux__
+    struct stat fromStat, toStat;
+    if (fstat(from, &fromStat) == 0 && fstat(to, &toStat) == 0) {
+        int result = TRANSFER_UNSUPPORTED;
+        if (S_ISREG(fromStat.st_mode) && S_ISREG(toStat.st_mode)) {
+            result = kernelTransfer(kTransferCopyRange, from, to);
+        }
+        if (result == TRANSFER_UNSUPPORTED && (S_ISFIFO(fromStat.st_mode) || S_ISFIFO(toStat.st_mode))) {
+            result = kernelTransfer(kTransferSplice, from, to);
+        }
+        if (result == TRANSFER_UNSUPPORTED && S_ISREG(fromStat.st_mode)) {
+            result = kernelTransfer(kTransferSendfile, from, to);
+        }
+        if (result != TRANSFER_UNSUPPORTED) {
+            return result;
+        }
+    }
+#endif
+    return copyData(from, to);
+}
+
+/**
+ * Copy everything from one descriptor to several others. When reading from a pipe, tee() and splice() duplicate the
+ * bytes and move them on without them ever passing through the shell. Falls back to read() and write() otherwise.
+ * @param from The descriptor to read from, starting at its current offset.
+ * @param to The descriptors to write to.
+ * @param numTo The number of descriptors to write to.
+ * @return 0 if success, -1 (with errno set) otherwise.
+ */
+int fanOutData(int from, const int to[], int numTo) {
+    if (numTo == 1) {
+        return transferData(from, to[0]);
+    }
+#ifdef __linux__
+    struct stat fromStat;
+    if (numTo > 1 && fstat(from, &fromStat) == 0 && S_ISFIFO(fromStat.st_mode)) {
+        int result = kernelFanOut(from, to, numTo);
+        if (result != TRANSFER_UNSUPPORTED) {
+            return result;
+        }
+    }
+#endif
+    return copyDataToAll(from, to, numTo);
+}
+
+/**
+ * Create an anonymous file that lives only in memory where the system allows it, and is never seen on disk.
+ * Uses memfd_create() on Linux, and an already unlinked temporary file elsewhere.
+ * @param name A name for the file, which only shows up when debugging.
+ * @return A descriptor for the file, closed on exec, or -1 if no file could be created.
+ */
+int openMemoryFile(const char *name) {
+#ifdef __linux__
+    int memoryFile = memfd_create(name, MFD_CLOEXEC);
+    if (memoryFile != -1) {
+        return memoryFile;
+    }
+#endif
+    FILE *file = tmpfile(); // Already unlinked, so it disappears once closed
+    if (file == NULL) {
+        return -1;
+    }
+    int fileNum = dup(fileno(file));
+    fclose(file);
+    if (fileNum != -1) {
+        fcntl(fileNum, F_SETFD, FD_CLOEXEC);
+    }
+    return fileNum;
+}
@@ -0,0 +1,58 @@
+#ifndef Transfer_h
+#define Transfer_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/**
+ * Move everything from one descriptor to another, letting the kernel move the bytes whenever it can:
+ * copy_file_range() between regular files, splice() when either end is a pipe, and sendfile() from a regular file.
+ * Falls back to copyData() when the kernel refuses.
+ * @param from The descriptor to read from, starting at its current offset.
+ * @param to The descriptor to write to.
+ * @return 0 if success, -1 (with errno set) otherwise.
+ */
+int transferData(int from, int to);
+
+/**
+ * Copy everything from one descriptor to another through a buffer, with read() and write().
+ * @param from The descriptor to read from, starting at its current offset.
+ * @param to The descriptor to write to.
+ * @return 0 if success, -1 (with errno set) otherwise.
+ */
+int copyData(int from, int to);
+
+/**
+ * Copy everything from one descriptor to several others through a buffer, with read() and write().
+ * @param from The descriptor to read from, starting at its current offset.
+ * @param to The descriptors to write to.
+ * @param numTo The number of descriptors to write to.
+ * @return 0 if success, -1 (with errno set) otherwise.
+ */
+int copyDataToAll(int from, const int to[], int numTo);
+
+/**
+ * Copy everything from one descriptor to several others. When reading from a pipe, tee() and splice() duplicate the
+ * bytes and move them on without them ever passing through the shell. Falls back to read() and write() otherwise.
+ * @param from The descriptor to read from, starting at its current offset.
+ * @param to The descriptors to write to.
+ * @param numTo The number of descriptors to write to.
+ * @return 0 if success, -1 (with errno set) otherwise.
+ */
+int fanOutData(int from, const int to[], int numTo);
+
+/**
+ * Create an anonymous file that lives only in memory where the system allows it, and is never seen on disk.
+ * Uses memfd_create() on Linux, and an already unlinked temporary file elsewhere.
+ * @param name A name for the file, which only shows up when debugging.
+ * @return A descriptor for the file, closed on exec, or -1 if no file could be created.
+ */
+int openMemoryFile(const char *name);
+
+#endif /* Transfer_h */
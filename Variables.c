@@ -0,0 +1,371 @@
+#include "Variables.h"
+
+#include <ctype.h>
+#include <stdint.h>
+
+#define MIN_SLOTS 64
+
+extern char **environ;
+
+/**
+ * A slot of the variable table, which is open addressed: a variable lives in the first free slot at or after the one
+ * its name hashes to. A variable's name and value are kept together as name=value, ready to hand to commands.
+ */
+typedef struct variable {
+    char *entry; // name=value, or NULL for a free slot
+    size_t nameLength;
+    uint64_t hash;
+    bool exported;
+    bool removed; // Left by a variable that was unset, so lookups carry on past it
+} Variable;
+
+static Variable *slots = NULL; // NULL until the shell takes over the environment
+static size_t numSlots = 0, numUsed = 0, numVariables = 0; // numUsed also counts slots left by unset variables
+static char **environment = NULL; // Every exported entry, which environ points to
+static unsigned long environmentVersion = 0;
+
+/**
+ * A simple string hash (FNV-1a).
+ * @param name The string to hash.
+ * @param length The number of characters to hash.
+ * @return The hash of the string.
+ */
+static uint64_t hashName(const char *name, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+    for (i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Find a variable's slot.
+ * @param name The variable's name.
+ * @param length The number of characters of the name.
+ * @param hash The hash of the name.
+ * @param vacant Set to the first slot the variable could be added in, if it is not found.
+ * @return The variable's slot, or NULL if it is not set.
+ */
+static Variable *findVariable(const char *name, size_t length, uint64_t hash, Variable **vacant) {
+    *vacant = NULL;
+    size_t i;
+    for (i = hash & (numSlots - 1); ; i = (i + 1) & (numSlots - 1)) { // Always ends, as some slots are never used
+        Variable *slot = &slots[i];
+        if (slot->entry == NULL) {
+            if (*vacant == NULL) {
+                *vacant = slot;
+            }
+            if (!slot->removed) {
+                return NULL;
+            }
+        } else if (slot->hash == hash && slot->nameLength == length && memcmp(slot->entry, name, length) == 0) {
+            return slot;
+        }
+    }
+}
+
+/**
+ * Make room for another variable, moving every variable into a larger table once three quarters of the slots are used.
+ * Slots left by unset variables are dropped along the way.
+ */
+static void reserveSlot(void) {
+    if ((numUsed + 1) * 4 <= numSlots * 3) {
+        return;
+    }
+    size_t newNumSlots = MIN_SLOTS;
+    while ((numVariables + 1) * 2 > newNumSlots) {
+        newNumSlots *= 2;
+    }
+    Variable *oldSlots = slots;
+    size_t oldNumSlots = numSlots, i;
+    if ((slots = calloc(newNumSlots, sizeof(Variable))) == NULL) {
+        perror("Unable to allocate memory.\n\r");
+        exit(EXIT_FAILURE);
+    }
+    numSlots = newNumSlots;
+    numUsed = numVariables;
+    for (i = 0; i < oldNumSlots; i++) {
+        if (oldSlots[i].entry) {
+            Variable *vacant;
+            findVariable(oldSlots[i].entry, oldSlots[i].nameLength, oldSlots[i].hash, &vacant);
+            *vacant = oldSlots[i];
+        }
+    }
+    free(oldSlots);
+}
+
+/**
+ * Give a variable a value, adding it if it is new. The environment is left for the caller to rebuild.
+ * @param name The variable's name.
+ * @param length The number of characters of the name.
+ * @param value The value.
+ * @return The variable.
+ */
+static Variable *storeVariable(const char *name, size_t length, const char *value) {
+    reserveSlot();
+    uint64_t hash = hashName(name, length);
+    Variable *vacant, *variable = findVariable(name, length, hash, &vacant);
+    size_t valueLength = strlen(value);
+    char *entry = malloc(length + valueLength + 2);
+    if (entry == NULL) {
+        perror("Unable to allocate memory.\n\r");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(entry, name, length);
+    entry[length] = '=';
+    memcpy(entry + length + 1, value, valueLength + 1);
+    if (variable == NULL) {
+        variable = vacant;
+        if (!variable->removed) {
+            numUsed++;
+        }
+        numVariables++;
+        variable->nameLength = length;
+        variable->hash = hash;
+        variable->exported = variable->removed = false;
+    }
+    free(variable->entry);
+    variable->entry = entry;
+    return variable;
+}
+
+/**
+ * Build the environment again from every exported variable, and point environ at it.
+ */
+static void rebuildEnvironment(void) {
+    char **rebuilt = malloc((numVariables + 1) * sizeof(char *));
+    if (rebuilt == NULL) {
+        perror("Unable to allocate memory.\n\r");
+        exit(EXIT_FAILURE);
+    }
+    size_t i, numExported = 0;
+    for (i = 0; i < numSlots; i++) {
+        if (slots[i].entry && slots[i].exported) {
+            rebuilt[numExported++] = slots[i].entry;
+        }
+    }
+    rebuilt[numExported] = NULL;
+    environ = rebuilt;
+    free(environment);
+    environment = rebuilt;
+    environmentVersion++;
+}
+
+/**
+ * Take over the environment: every variable in it becomes an exported shell variable, and from then on the environment
+ * handed to commands (and environ itself) is an array built from the exported variables, rebuilt only when one changes.
+ * Until this is called (or a variable is set), variables are read straight from the environment.
+ */
+void initVariables(void) {
+    // Calling this again (such as in a server's worker, given a client's environment) starts over from environ
+    Variable *oldSlots = slots;
+    size_t oldNumSlots = numSlots, i;
+    slots = NULL;
+    numSlots = numUsed = numVariables = 0;
+    for (i = 0; environ[i]; i++) {
+        const char *equals = strchr(environ[i], '=');
+        if (equals && equals > environ[i]) { // Any name at all, so that nothing in the environment is lost
+            storeVariable(environ[i], equals - environ[i], equals + 1)->exported = true;
+        }
+    }
+    reserveSlot(); // An empty environment still gets a table
+    rebuildEnvironment();
+    for (i = 0; i < oldNumSlots; i++) {
+        free(oldSlots[i].entry);
+    }
+    free(oldSlots);
+}
+
+/**
+ * @param name A possible variable name.
+ * @param length The number of characters of the name.
+ * @return Whether or not the name is a valid variable name: a letter or _, followed by letters, digits and _.
+ */
+bool isVariableName(const char *name, size_t length) {
+    if (length == 0 || (!isalpha((unsigned char)name[0]) && name[0] != '_')) {
+        return false;
+    }
+    size_t i;
+    for (i = 1; i < length; i++) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Look up a variable, exported or not.
+ * @param name The variable's name.
+ * @return The variable's value, or NULL if it is unset. Valid until the variable next changes.
+ */
+const char *getVariable(const char *name) {
+    if (slots == NULL) {
+        return getenv(name);
+    }
+    size_t length = strlen(name);
+    Variable *vacant, *variable = findVariable(name, length, hashName(name, length), &vacant);
+    return variable ? variable->entry + length + 1 : NULL;
+}
+
+/**
+ * Give a variable a value, adding it if it is new. A new variable is not exported, and an exported one stays exported.
+ * @param name The variable's name.
+ * @param value The value.
+ * @return 0 if success, -1 if the name is not a valid variable name.
+ */
+int setVariable(const char *name, const char *value) {
+    size_t length = strlen(name);
+    if (!isVariableName(name, length)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (slots == NULL) {
+        initVariables();
+    }
+    if (storeVariable(name, length, value)->exported) {
+        rebuildEnvironment();
+    }
+    return 0;
+}
+
+/**
+ * Export a variable, so that every command run from then on has it in its environment.
+ * @param name The variable's name.
+ * @param value The value to give it, or NULL to keep its value (an unset variable is set to nothing).
+ * @return 0 if success, -1 if the name is not a valid variable name.
+ */
+int exportVariable(const char *name, const char *value) {
+    size_t length = strlen(name);
+    if (!isVariableName(name, length)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (slots == NULL) {
+        initVariables();
+    }
+    Variable *vacant, *variable = findVariable(name, length, hashName(name, length), &vacant);
+    if (value || variable == NULL) {
+        variable = storeVariable(name, length, value ? value : "");
+    } else if (variable->exported) {
+        return 0;
+    }
+    variable->exported = true;
+    rebuildEnvironment();
+    return 0;
+}
+
+/**
+ * Remove a variable, taking it out of the environment if it was exported.
+ * @param name The variable's name.
+ * @return 0 if success (whether or not it was set), -1 if the name is not a valid variable name.
+ */
+int unsetVariable(const char *name) {
+    size_t length = strlen(name);
+    if (!isVariableName(name, length)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (slots == NULL) {
+        initVariables();
+    }
+    Variable *vacant, *variable = findVariable(name, length, hashName(name, length), &vacant);
+    if (variable == NULL) {
+        return 0;
+    }
+    char *entry = variable->entry;
+    variable->entry = NULL;
+    variable->removed = true;
+    numVariables--;
+    if (variable->exported) {
+        rebuildEnvironment();
+    }
+    free(entry); // Only once environ no longer holds it
+    return 0;
+}
+
+/**
+ * @return The environment to hand to commands: every exported variable as name=value, followed by NULL.
+ */
+char **getEnvironment(void) {
+    return slots ? environment : environ;
+}
+
+/**
+ * @return A number that changes whenever the environment does, for keeping copies of it up to date.
+ */
+unsigned long getEnvironmentVersion(void) {
+    return environmentVersion;
+}
+
+/**
+ * Write a value quoted so that the shell reads it back unchanged.
+ * @param fd The descriptor to write to.
+ * @param value The value.
+ */
+static void writeQuoted(int fd, const char *value) {
+    dprintf(fd, "'");
+    const char *quote;
+    while ((quote = strchr(value, '\'')) != NULL) {
+        dprintf(fd, "%.*s'\\''", (int)(quote - value), value);
+        value = quote + 1;
+    }
+    dprintf(fd, "%s'", value);
+}
+
+/**
+ * Process an 'export' command.
+ * 'export' lists every exported variable, and 'export name[=value]...' exports each variable given.
+ * @param cmd The 'export' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processExport(char *cmd[], StdFds fds) {
+    int i;
+    if (cmd[1] == NULL) {
+        char **exported = getEnvironment();
+        for (i = 0; exported[i]; i++) {
+            const char *equals = strchr(exported[i], '=');
+            if (equals && isVariableName(exported[i], equals - exported[i])) {
+                dprintf(fds.out, "export %.*s=", (int)(equals - exported[i]), exported[i]);
+                writeQuoted(fds.out, equals + 1);
+                dprintf(fds.out, "\n");
+            }
+        }
+        return EXIT_SUCCESS;
+    }
+    
+    int status = EXIT_SUCCESS;
+    for (i = 1; cmd[i]; i++) {
+        char *equals = strchr(cmd[i], '='), name[256];
+        size_t length = equals ? (size_t)(equals - cmd[i]) : strlen(cmd[i]);
+        if (length >= sizeof(name)) {
+            length = 0; // Too long to be a name worth having
+        }
+        snprintf(name, sizeof(name), "%.*s", (int)length, cmd[i]);
+        if (length == 0 || exportVariable(name, equals ? equals + 1 : NULL) == -1) {
+            dprintf(fds.err, "export: %s: not a valid identifier\n", cmd[i]);
+            status = EXIT_FAILURE;
+        }
+    }
+    return status;
+}
+
+/**
+ * Process an 'unset' command, removing each variable given.
+ * @param cmd The 'unset' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processUnset(char *cmd[], StdFds fds) {
+    int status = EXIT_SUCCESS;
+    int i;
+    for (i = 1; cmd[i]; i++) {
+        if (unsetVariable(cmd[i]) == -1) {
+            dprintf(fds.err, "unset: %s: not a valid identifier\n", cmd[i]);
+            status = EXIT_FAILURE;
+        }
+    }
+    return status;
+}
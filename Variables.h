@@ -0,0 +1,84 @@
+#ifndef Variables_h
+#define Variables_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "Builtin.h"
+
+/**
+ * Take over the environment: every variable in it becomes an exported shell variable, and from then on the environment
+ * handed to commands (and environ itself) is an array built from the exported variables, rebuilt only when one changes.
+ * Until this is called (or a variable is set), variables are read straight from the environment.
+ */
+void initVariables(void);
+
+/**
+ * @param name A possible variable name.
+ * @param length The number of characters of the name.
+ * @return Whether or not the name is a valid variable name: a letter or _, followed by letters, digits and _.
+ */
+bool isVariableName(const char *name, size_t length);
+
+/**
+ * Look up a variable, exported or not.
+ * @param name The variable's name.
+ * @return The variable's value, or NULL if it is unset. Valid until the variable next changes.
+ */
+const char *getVariable(const char *name);
+
+/**
+ * Give a variable a value, adding it if it is new. A new variable is not exported, and an exported one stays exported.
+ * @param name The variable's name.
+ * @param value The value.
+ * @return 0 if success, -1 if the name is not a valid variable name.
+ */
+int setVariable(const char *name, const char *value);
+
+/**
+ * Export a variable, so that every command run from then on has it in its environment.
+ * @param name The variable's name.
+ * @param value The value to give it, or NULL to keep its value (an unset variable is set to nothing).
+ * @return 0 if success, -1 if the name is not a valid variable name.
+ */
+int exportVariable(const char *name, const char *value);
+
+/**
+ * Remove a variable, taking it out of the environment if it was exported.
+ * @param name The variable's name.
+ * @return 0 if success (whether or not it was set), -1 if the name is not a valid variable name.
+ */
+int unsetVariable(const char *name);
+
+/**
+ * @return The environment to hand to commands: every exported variable as name=value, followed by NULL.
+ */
+char **getEnvironment(void);
+
+/**
+ * @return A number that changes whenever the environment does, for keeping copies of it up to date.
+ */
+unsigned long getEnvironmentVersion(void);
+
+/**
+ * Process an 'export' command.
+ * 'export' lists every exported variable, and 'export name[=value]...' exports each variable given.
+ * @param cmd The 'export' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processExport(char *cmd[], StdFds fds);
+
+/**
+ * Process an 'unset' command, removing each variable given.
+ * @param cmd The 'unset' command to process
+ * @param fds The descriptors to use as standard input, output and error.
+ * @return The exit status of the command.
+ */
+int processUnset(char *cmd[], StdFds fds);
+
+#endif /* Variables_h */
@@ -0,0 +1,410 @@
+#include "Zygote.h"
+#include "Spawn.h"
+#include "Variables.h"
+
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // Where it is missing, a zygote that went away raises SIGPIPE instead
+#endif
+
+// The largest request accepted, which mostly bounds how large the shell's environment can be
+#define MAX_REQUEST_SIZE (16 * 1024 * 1024)
+
+static int requestFd = -1, eventFd = -1;
+static char *environmentBlock = NULL; // Every variable of the environment, each ending with a NUL, as requests carry it
+static size_t environmentLength = 0;
+static unsigned long blockVersion = 0;
+
+/**
+ * Lay out the environment the way requests carry it, only when it has changed since it was last laid out,
+ * so that launching a command costs nothing for the size of the environment beyond sending it.
+ */
+static void updateEnvironmentBlock(void) {
+    if (environmentBlock && blockVersion == getEnvironmentVersion()) {
+        return;
+    }
+    char **environment = getEnvironment();
+    size_t length = 0;
+    int i;
+    for (i = 0; environment[i]; i++) {
+        length += strlen(environment[i]) + 1;
+    }
+    char *block = realloc(environmentBlock, length ? length : 1), *end = block;
+    if (block == NULL) {
+        perror("Unable to allocate memory.\n\r");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; environment[i]; i++) {
+        end = stpcpy(end, environment[i]) + 1;
+    }
+    environmentBlock = block;
+    environmentLength = length;
+    blockVersion = getEnvironmentVersion();
+}
+
+/**
+ * Send every byte of a buffer over a socket, without raising SIGPIPE if the other end is gone.
+ * @param fd The socket.
+ * @param buffer The bytes to send.
+ * @param length The number of bytes.
+ * @return 0 if success, -1 otherwise.
+ */
+static int sendAll(int fd, const void *buffer, size_t length) {
+    size_t sent = 0;
+    while (sent < length) {
+        ssize_t result = send(fd, (const char *)buffer + sent, length - sent, MSG_NOSIGNAL);
+        if (result == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        sent += result;
+    }
+    return 0;
+}
+
+/**
+ * Only here so that SIGCHLD interrupts the zygote's wait for the next request.
+ */
+static void noteChildSignal(int signum) {
+}
+
+/**
+ * In a child of the zygote, become the requested command.
+ * @param request The request being served.
+ * @param fds The command's standard input, output and error.
+ * @param payload The request's working directory, path, arguments and environment.
+ * @param length The length of the payload.
+ * @param reportFd Where to write a byte if the executable has gone from its path, or -1.
+ */
+static void execRequest(SpawnRequest *request, int fds[3], char *payload, size_t length, int reportFd) {
+    int signals[] = { SIGINT, SIGQUIT, SIGPIPE, SIGCHLD, SIGTSTP, SIGTTIN, SIGTTOU };
+    int i;
+    for (i = 0; i < (int)(sizeof(signals) / sizeof(signals[0])); i++) {
+        signal(signals[i], SIG_DFL);
+    }
+    sigset_t empty;
+    sigemptyset(&empty);
+    sigprocmask(SIG_SETMASK, &empty, NULL);
+    if (request->pgid != -1) {
+        setpgid(0, request->pgid);
+    }
+    
+    char *end = payload + length;
+    char *cwd = payload, *path = cwd + strlen(cwd) + 1;
+    char **argv = malloc((request->argc + 1) * sizeof(char *));
+    char **environment = malloc((length / 2 + 1) * sizeof(char *));
+    if (argv == NULL || environment == NULL) {
+        _exit(126);
+    }
+    char *string = path + strlen(path) + 1;
+    for (i = 0; i < request->argc && string < end; i++, string += strlen(string) + 1) {
+        argv[i] = string;
+    }
+    argv[i] = NULL;
+    int numVariables = 0;
+    for (; string < end; string += strlen(string) + 1) {
+        environment[numVariables++] = string;
+    }
+    environment[numVariables] = NULL;
+    
+    for (i = 0; i < 3; i++) {
+        if (fds[i] != i && dup2(fds[i], i) == -1) {
+            _exit(EXIT_FAILURE);
+        }
+    }
+    for (i = 0; i < 3; i++) { // The received descriptors are not closed on exec, unlike the zygote's own
+        if (fds[i] > STDERR_FILENO) {
+            close(fds[i]);
+        }
+    }
+    chdir(cwd);
+    environ = environment;
+    execv(path, argv);
+    if (errno == ENOENT && strchr(argv[0], '/') == NULL) {
+        if (reportFd != -1) {
+            write(reportFd, "", 1);
+        }
+        execvp(argv[0], argv);
+    }
+    perror(argv[0]);
+    _exit(errno == ENOENT ? 127 : 126);
+}
+
+/**
+ * Receive one request and launch its command.
+ * @return 0 if a request was served, -1 once the shell has gone away.
+ */
+static int serveRequest(void) {
+    SpawnRequest request;
+    struct iovec buffer = { &request, sizeof(request) };
+    union {
+        struct cmsghdr align;
+        char data[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &buffer;
+    message.msg_iovlen = 1;
+    message.msg_control = control.data;
+    message.msg_controllen = sizeof(control.data);
+    
+    ssize_t received;
+    while ((received = recvmsg(requestFd, &message, 0)) == -1 && errno == EINTR) {
+        continue;
+    }
+    if (received <= 0) {
+        return -1;
+    }
+    struct cmsghdr *rights = CMSG_FIRSTHDR(&message);
+    if (rights == NULL || rights->cmsg_type != SCM_RIGHTS || rights->cmsg_len != CMSG_LEN(3 * sizeof(int))) {
+        return -1;
+    }
+    int fds[3];
+    memcpy(fds, CMSG_DATA(rights), sizeof(fds));
+    char *payload = NULL;
+    if (((size_t)received < sizeof(request) &&
+         readAll(requestFd, (char *)&request + received, sizeof(request) - received) == -1) ||
+        request.length > MAX_REQUEST_SIZE || (payload = malloc(request.length + 1)) == NULL ||
+        readAll(requestFd, payload, request.length) == -1) {
+        return -1;
+    }
+    payload[request.length] = '\0';
+    
+    int report[2] = { -1, -1 };
+    if (openPipe(report) == -1) { // Without it, nothing is learned about the executable
+        report[0] = report[1] = -1;
+    }
+    SpawnReply reply = { fork(), 0, 0 };
+    if (reply.pid == 0) {
+        execRequest(&request, fds, payload, request.length, report[1]);
+    } else if (reply.pid == -1) {
+        reply.error = errno;
+    } else if (request.pgid != -1) { // Also done here, so the group exists no matter which process runs first
+        setpgid(reply.pid, request.pgid ? request.pgid : reply.pid);
+    }
+    reply.missing = awaitExecReport(report);
+    int i;
+    for (i = 0; i < 3; i++) {
+        close(fds[i]);
+    }
+    free(payload);
+    return sendAll(requestFd, &reply, sizeof(reply));
+}
+
+/**
+ * The zygote's whole life: launch commands as they are requested, and report every change in their state,
+ * until the shell goes away.
+ * @param shellPid The shell, which is sent a SIGCHLD whenever there are changes to read.
+ */
+static void runZygote(pid_t shellPid) {
+    // The zygote shares the shell's process group, but the terminal's signals are for the shell and its commands
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = noteChildSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGCHLD, &action, NULL);
+    
+    // SIGCHLD is only let through while waiting for a request, so no change in state goes unnoticed
+    sigset_t blocked, waiting;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &blocked, &waiting);
+    sigdelset(&waiting, SIGCHLD);
+    
+    while (true) {
+        ChildEvent event;
+        bool reported = false;
+        pid_t pid;
+        while ((pid = wait4(-1, &event.status, WNOHANG | WUNTRACED | WCONTINUED, &event.usage)) > 0) {
+            event.pid = pid;
+            send(eventFd, &event, sizeof(event), MSG_NOSIGNAL);
+            reported = true;
+        }
+        if (reported) {
+            kill(shellPid, SIGCHLD);
+        }
+        
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(requestFd, &readable);
+        if (pselect(requestFd + 1, &readable, NULL, NULL, NULL, &waiting) == -1) {
+            continue; // Interrupted by a child changing state
+        }
+        if (serveRequest() == -1) {
+            _exit(EXIT_SUCCESS);
+        }
+    }
+}
+
+/**
+ * Fork the zygote: a helper that launches commands on the shell's behalf by forking its own small address space,
+ * so that launching stays fast however much memory the shell comes to hold. Should be called as early as possible.
+ * The zygote reports every change in its children's state to the shell, followed by a SIGCHLD.
+ * @return 0 if success, -1 if the zygote could not be started.
+ */
+int startZygote(void) {
+    int requests[2], events[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, requests) == -1) {
+        return -1;
+    }
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, events) == -1) { // Each change in state is one datagram
+        close(requests[0]);
+        close(requests[1]);
+        return -1;
+    }
+    int i;
+    for (i = 0; i < 2; i++) {
+        fcntl(requests[i], F_SETFD, FD_CLOEXEC);
+        fcntl(events[i], F_SETFD, FD_CLOEXEC);
+    }
+    fflush(stdout);
+    
+    pid_t shellPid = getpid();
+    pid_t pid = fork();
+    if (pid == -1) {
+        for (i = 0; i < 2; i++) {
+            close(requests[i]);
+            close(events[i]);
+        }
+        return -1;
+    } else if (pid == 0) {
+        close(requests[0]);
+        close(events[0]);
+        requestFd = requests[1];
+        eventFd = events[1];
+        runZygote(shellPid);
+    }
+    close(requests[1]);
+    close(events[1]);
+    requestFd = requests[0];
+    eventFd = events[0];
+    fcntl(eventFd, F_SETFL, O_NONBLOCK); // Drained by the SIGCHLD handler, which must never block
+    return 0;
+}
+
+/**
+ * @return Whether or not the zygote is running.
+ */
+bool zygoteRunning(void) {
+    return requestFd != -1;
+}
+
+/**
+ * Stop using the zygote from this process, such as in a forked copy of the shell, whose requests and events would
+ * otherwise be mixed up with the shell's. The zygote itself keeps running for the shell.
+ */
+void leaveZygote(void) {
+    if (requestFd != -1) {
+        close(requestFd);
+        close(eventFd);
+        requestFd = eventFd = -1;
+    }
+}
+
+/**
+ * Launch a command through the zygote.
+ * @param path The executable to run.
+ * @param argv The command to launch, followed by its arguments and a terminating NULL.
+ * @param fds The descriptors the command should use as its standard input, output and error.
+ * @param pgid The process group to place the command in: -1 for the shell's own, 0 for a new one led by the command.
+ * @param missing Set to whether or not the executable had gone from path.
+ * @return The pid of the launched command, or -1 (with errno set) if it could not be launched.
+ */
+pid_t zygoteSpawn(const char *path, char *argv[], StdFds fds, pid_t pgid, bool *missing) {
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        return -1;
+    }
+    SpawnRequest request = { 0, 0, pgid };
+    size_t length = strlen(cwd) + 1 + strlen(path) + 1;
+    int i;
+    for (i = 0; argv[i]; i++) {
+        length += strlen(argv[i]) + 1;
+    }
+    request.argc = i;
+    updateEnvironmentBlock();
+    request.length = length + environmentLength;
+    char *payload = malloc(length), *end = payload;
+    if (payload == NULL) {
+        perror("Unable to allocate memory.\n\r");
+        exit(EXIT_FAILURE);
+    }
+    end = stpcpy(end, cwd) + 1;
+    end = stpcpy(end, path) + 1;
+    for (i = 0; argv[i]; i++) {
+        end = stpcpy(end, argv[i]) + 1;
+    }
+    
+    struct iovec buffer = { &request, sizeof(request) };
+    union {
+        struct cmsghdr align;
+        char data[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &buffer;
+    message.msg_iovlen = 1;
+    message.msg_control = control.data;
+    message.msg_controllen = sizeof(control.data);
+    struct cmsghdr *rights = CMSG_FIRSTHDR(&message);
+    rights->cmsg_level = SOL_SOCKET;
+    rights->cmsg_type = SCM_RIGHTS;
+    rights->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    int descriptors[3] = { fds.in, fds.out, fds.err };
+    memcpy(CMSG_DATA(rights), descriptors, sizeof(descriptors));
+    
+    ssize_t sent;
+    while ((sent = sendmsg(requestFd, &message, MSG_NOSIGNAL)) == -1 && errno == EINTR) {
+        continue;
+    }
+    SpawnReply reply = { -1, EPIPE, 0 };
+    if (sent == -1 || ((size_t)sent < sizeof(request) &&
+                       sendAll(requestFd, (char *)&request + sent, sizeof(request) - sent) == -1) ||
+        sendAll(requestFd, payload, length) == -1 || sendAll(requestFd, environmentBlock, environmentLength) == -1 ||
+        readAll(requestFd, &reply, sizeof(reply)) == -1) {
+        reply.pid = -1;
+        reply.error = errno ? errno : EPIPE;
+    }
+    free(payload);
+    if (reply.pid == -1) {
+        errno = reply.error;
+    }
+    *missing = reply.missing;
+    return reply.pid;
+}
+
+/**
+ * Read the next change in state that the zygote has reported, without blocking. Safe to call from a signal handler.
+ * @param pid Set to the process that changed state.
+ * @param status Set to the status wait4() reported for it.
+ * @param usage Set to the resources it used, if it has finished.
+ * @return Whether or not there was a change to read.
+ */
+bool readZygoteEvent(pid_t *pid, int *status, struct rusage *usage) {
+    if (eventFd == -1) {
+        return false;
+    }
+    ChildEvent event;
+    if (recv(eventFd, &event, sizeof(event), 0) != sizeof(event)) {
+        return false;
+    }
+    *pid = event.pid;
+    *status = event.status;
+    *usage = event.usage;
+    return true;
+}
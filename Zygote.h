@@ -0,0 +1,86 @@
+#ifndef Zygote_h
+#define Zygote_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include "Builtin.h"
+
+/**
+ * Precedes a request to launch a command, which is sent along with the command's standard input, output and error
+ * (as SCM_RIGHTS). The payload that follows is the shell's working directory, the executable's path,
+ * the command's arguments, and then every variable of the shell's environment, each terminated by a NUL.
+ */
+typedef struct spawnRequest {
+    uint32_t length;
+    int32_t argc;
+    int32_t pgid;
+} SpawnRequest;
+
+/**
+ * The zygote's reply to a request: the pid of the launched command, or -1 along with the reason.
+ */
+typedef struct spawnReply {
+    int32_t pid;
+    int32_t error;
+    int32_t missing; // Whether the executable had gone from its path, so that the command was looked for on $PATH
+} SpawnReply;
+
+/**
+ * Sent by the zygote whenever one of the commands it launched changes state, just as wait4() would report it.
+ */
+typedef struct childEvent {
+    int32_t pid;
+    int32_t status;
+    struct rusage usage;
+} ChildEvent;
+
+/**
+ * Fork the zygote: a helper that launches commands on the shell's behalf by forking its own small address space,
+ * so that launching stays fast however much memory the shell comes to hold. Should be called as early as possible.
+ * The zygote reports every change in its children's state to the shell, followed by a SIGCHLD.
+ * @return 0 if success, -1 if the zygote could not be started.
+ */
+int startZygote(void);
+
+/**
+ * @return Whether or not the zygote is running.
+ */
+bool zygoteRunning(void);
+
+/**
+ * Stop using the zygote from this process, such as in a forked copy of the shell, whose requests and events would
+ * otherwise be mixed up with the shell's. The zygote itself keeps running for the shell.
+ */
+void leaveZygote(void);
+
+/**
+ * Launch a command through the zygote.
+ * @param path The executable to run.
+ * @param argv The command to launch, followed by its arguments and a terminating NULL.
+ * @param fds The descriptors the command should use as its standard input, output and error.
+ * @param pgid The process group to place the command in: -1 for the shell's own, 0 for a new one led by the command.
+ * @param missing Set to whether or not the executable had gone from path.
+ * @return The pid of the launched command, or -1 (with errno set) if it could not be launched.
+ */
+pid_t zygoteSpawn(const char *path, char *argv[], StdFds fds, pid_t pgid, bool *missing);
+
+/**
+ * Read the next change in state that the zygote has reported, without blocking. Safe to call from a signal handler.
+ * @param pid Set to the process that changed state.
+ * @param status Set to the status wait4() reported for it.
+ * @param usage Set to the resources it used, if it has finished.
+ * @return Whether or not there was a change to read.
+ */
+bool readZygoteEvent(pid_t *pid, int *status, struct rusage *usage);
+
+#endif /* Zygote_h */
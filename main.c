@@ -1,4 +1,10 @@
 #include "Execute.h"
+#include "Script.h"
+#include "Trace.h"
+#include "Server.h"
+#include "Zygote.h"
+#include "Events.h"
+#include "Variables.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,44 +15,75 @@
 
 /* 
  * If a signal interrupt is detected (Ctrl+C), this function will be called instead of terminating the program.
+ * The event loop reports ^C at the prompt, and this is called for it; without an event loop, it is the SIGINT handler.
  */
 void ignoreCtrlC(int sig_num) {
     printf("\b \b\b \b\n? "); // Remove "^C" from the console screen so that it never shows up.
     fflush(stdout);
 }
 
-void processLine(char *line, FILE *input) {
-    LineInput emptyLineInput = {0};
-    
-    if(line[strlen(line)-1] == '\n')
-        line[strlen(line)-1] = '\0';   /* zap the newline */
-    
-    if (line[0] != '#') {
-        LineInput *lineInput = &emptyLineInput;
-        parse(line, lineInput);
-//        printLineInput(lineInput);
-        execute(lineInput);
-    }
-    if(input == stdin)
-    {
-        printf("? ");
-        fflush(stdout);
+/**
+ * Run a command line given on the command line. When NSH_SERVER names a running server's socket,
+ * the line is handed to the server instead, which runs it with its command and parse caches already warm.
+ * @param line The command line to run.
+ * @return The exit status of the line.
+ */
+static int runCommand(char *line) {
+    const char *serverPath = getenv("NSH_SERVER");
+    if (serverPath != NULL && serverPath[0]) {
+        int status = runOnServer(serverPath, line);
+        if (status != -1) {
+            return status;
+        }
     }
+    return processLine(line, NULL);
 }
 
-
 int main(int argc, char *argv[]) {
     FILE *input = NULL;
+    const char *scriptPath = NULL;
     char line[LINE_MAX] = "";
     
+    // Every variable of the environment becomes an exported shell variable
+    initVariables();
+    
+    // Allow the launcher to be picked at runtime, to compare fork() against posix_spawn()
+    const char *launcherName = getenv("NSH_LAUNCHER");
+    if (launcherName != NULL) {
+        LaunchMode mode;
+        if (launchModeFromName(launcherName, &mode)) {
+            setLaunchMode(mode);
+        } else {
+            fprintf(stderr, "Unknown launcher '%s', expected 'fork', 'spawn' or 'zygote'.\n", launcherName);
+        }
+    }
+    // The zygote is forked before the shell grows, and is of no use to a server, whose workers launch for themselves
+    bool serving = argc == 3 && strcmp(argv[1], "--serve") == 0;
+    if (getLaunchMode() == kLaunchZygote && !serving && startZygote() == -1) {
+        perror("Unable to start the zygote.\n\r");
+        setLaunchMode(kLaunchSpawn);
+    }
+    
+    // Record a timeline of parsing, launching, redirecting and waiting, to be viewed in chrome://tracing
+    const char *tracePath = getenv("NSH_TRACE");
+    if (tracePath != NULL && tracePath[0] && startTrace(tracePath) == -1) {
+        perror(tracePath);
+    }
+    
+    // Children are reaped as soon as they finish. Only a shell reading from a terminal does job control.
+    initJobControl(argc == 1 && isatty(STDIN_FILENO));
+    
+    if (serving) { // Serve command lines from a Unix domain socket
+        return runServer(argv[2]);
+    }
+    
     if(argc == 2)
     {
-        input = fopen(argv[1], "r");
-        if(input == NULL)
+        if(access(argv[1], R_OK) == -1)
         {
-            processLine(argv[1], input);
-            exit(1);
+            exit(runCommand(argv[1]));
         }
+        scriptPath = argv[1];
     } else if (argc == 1) {
         input = stdin;
         
@@ -76,23 +113,40 @@ int main(int argc, char *argv[]) {
             if (spaceFound) {
                 char buffer[LINE_MAX];
                 sprintf(buffer, "%s \"%s\"", argv[1], argv[2]); // surround in quotes
-                processLine(buffer, input);
-                return 0;
+                return runCommand(buffer);
             }
         }
-        processLine(line, input);
-        return 0;
+        return runCommand(line);
     }
     
-    // Ignore Ctrl+C
-    if (signal(SIGINT, ignoreCtrlC) == SIG_ERR) {
+    // Wait for children, input, ^C and time limits all at once. Without an event loop, a handler ignores Ctrl+C
+    if (startEventLoop() == -1 && signal(SIGINT, ignoreCtrlC) == SIG_ERR) {
         perror("Signal failed.\n\r");
         exit(EXIT_FAILURE);
     }
     
-    setlinebuf(input);
-    while(fgets(line, sizeof(line), input)) {
-        processLine(line, input);
+    if (scriptPath != NULL) { // Parse the whole script up front, then run it
+        Script script;
+        if (loadScript(scriptPath, &script) == -1) {
+            exit(2);
+        }
+        int status = runScript(&script);
+        freeScript(&script);
+        return status;
+    }
+    
+    // Nothing is read ahead from a terminal, so a line can't be left sitting in the buffer while the shell waits for more
+    setvbuf(input, NULL, isatty(fileno(input)) ? _IONBF : _IOLBF, 0);
+    char *inputLine = NULL; // Grown to fit each line, however long
+    size_t capacity = 0;
+    ssize_t length;
+    while ((length = readInputLine(&inputLine, &capacity, input)) != -1) {
+        if (length == -2) { // ^C starts over at a new prompt
+            ignoreCtrlC(SIGINT);
+            continue;
+        }
+        processLine(inputLine, input);
     }
+    free(inputLine);
     return 0;
 }